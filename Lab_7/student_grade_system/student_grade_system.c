@@ -0,0 +1,10584 @@
+/**
+ * @file student_grade_system.c
+ * @brief A basic command-line system for managing student grades in C.
+ *
+ * This program allows a user to add new students with their scores, display
+ * all student records, and calculate the average score of all students.
+ * It demonstrates the use of structs, arrays, loops, and conditionals for
+ * data management.
+ *
+ * Core Concepts Illustrated:
+ * - struct: Defines a 'Student' data type to logically group related
+ * information (ID, name, score).
+ * - Arrays: Records are stored in large arena chunks of 'Student' structs
+ * that grow on demand, so the roster size is limited only by memory.
+ * - for loop: Used extensively to iterate through the array of students for
+ * displaying data, adding new records, and calculating statistics.
+ * - do-while loop: Manages the main menu, allowing the user to perform
+ * multiple actions until they choose to exit.
+ * - if/else statements: Used for input validation (e.g., checking that a
+ * score is in range) and for assigning letter grades based on scores.
+ * - Variables and Reassignment: Variables like 'student_count' and array
+ * elements are continuously updated as the user interacts with the system.
+ * - Functions: The program is modularized, with functions for each major
+ * feature (adding, displaying, etc.) to enhance readability and reuse.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // syscall(), for perf_event_open
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sched.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define MAX_NAME_LENGTH 50
+
+// The store grows in arena chunks of 2^16 records (about 4 MB each)
+#define STUDENT_CHUNK_SHIFT 16
+#define STUDENT_CHUNK_SIZE ((size_t)1 << STUDENT_CHUNK_SHIFT)
+#define STUDENT_CHUNK_MASK (STUDENT_CHUNK_SIZE - 1)
+
+// A record as entered or imported, before its name is interned
+typedef struct {
+    int id;
+    char name[MAX_NAME_LENGTH];
+    double score;
+} Student;
+
+// A stored record in the AoS layout; the name lives in the name arena
+typedef struct {
+    int id;
+    unsigned int name; // byte offset into StudentStore.names
+    double score;
+} StudentRow;
+
+// Physical layout of the store, chosen at startup with --layout=aos|soa
+typedef enum {
+    LAYOUT_AOS, // array of StudentRow structs, one interleaved record per row
+    LAYOUT_SOA  // separate contiguous id, score and name-offset columns
+} StoreLayout;
+
+/*
+ * One arena chunk of STUDENT_CHUNK_SIZE rows. Only the arrays belonging to
+ * the active layout are allocated. Chunks are never moved once allocated, so
+ * a StudentRow* handed out in the AoS layout stays valid until the store is
+ * compacted or reset.
+ */
+typedef struct {
+    StudentRow *rows;
+    int *ids;
+    double *scores;
+    unsigned int *name_offsets; // byte offsets into StudentStore.names
+    int mapped;                 // columns point into a snapshot mapping
+    uint64_t *dead;             // tombstones, one bit per row; NULL until a row here is deleted
+    unsigned long long *dead_at; // allocated with 'dead': per row, the number of the delete that set its bit
+    size_t dead_count;          // bits set in 'dead'
+} StudentChunk;
+
+/*
+ * Growable student store. Only the small chunk directory and the name
+ * arena are reallocated as it grows. Names are interned: each distinct name
+ * is stored once in the arena and rows refer to it by a 32-bit offset.
+ * After a snapshot is loaded in the SoA layout, full chunks and the name
+ * arena point straight into the mapped file instead of the heap.
+ *
+ * Rows are never changed in place. Deleting a student marks its row with a
+ * tombstone, which every scan skips; updating one tombstones the old row
+ * and appends the new version. Once tombstones make up compact_threshold
+ * of the rows, a background thread copies the live rows into fresh chunks
+ * (see CompactJob).
+ */
+typedef struct {
+    StoreLayout layout;
+    StudentChunk *chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    char *names;          // append-only arena of distinct NUL-terminated names
+    size_t names_used;
+    size_t names_capacity;
+    int names_mapped;     // names points into the snapshot mapping
+    void *mapping;        // snapshot mapping, or NULL
+    size_t mapping_size;
+    size_t dead_rows;     // tombstoned rows, counted in student_count until compacted
+} StudentStore;
+
+StudentStore student_database = {LAYOUT_AOS, NULL, 0, 0, NULL, 0, 0, 0, NULL, 0, 0};
+int indexes_stale = 0; // set when rows were loaded without building the indexes
+double compact_threshold = 0.25; // dead fraction of the rows that triggers a compaction, --compact-threshold=F
+
+/*
+ * Concurrent readers. One writer thread owns every change to the store and
+ * every lazy rebuild; any number of other threads may read through a
+ * StoreView without locks. The writer completes a row (and interns its
+ * name) before it publishes the new row count with release order, so a
+ * view sees only whole rows. The chunk directory and the name arena are
+ * never reallocated in place: the writer copies them, publishes the copy
+ * and retires the old block, which is freed once every reader that could
+ * still hold it has left (epoch-based reclamation). A compaction shrinks
+ * the row count along with the directory, so that pair is swapped under a
+ * sequence lock. Deletes are numbered, and the number of the last one is
+ * published with the row count under the same lock, so a view can tell
+ * the tombstones set before it opened from those set since. store_reset()
+ * and snapshot loads must not run while views are open.
+ */
+#define READER_SLOTS 64
+
+// Announcement of one active reader, alone on its cache line
+typedef struct {
+    unsigned long epoch; // global epoch when the reader entered, 0 if free
+} __attribute__((aligned(64))) ReaderSlot;
+
+// A block the writer replaced, waiting for its last readers to leave
+typedef struct {
+    void *block;
+    unsigned long epoch; // global epoch at retirement
+} RetiredBlock;
+
+typedef struct {
+    unsigned long epoch __attribute__((aligned(64))); // starts at 1, advanced by every retirement
+    ReaderSlot slots[READER_SLOTS];
+    RetiredBlock *retired;
+    size_t retired_count;
+    size_t retired_capacity;
+} StoreReclaimer;
+
+StoreReclaimer store_reclaimer = {1, {{0}}, NULL, 0, 0};
+size_t published_count = 0; // rows visible to views, written with release order
+unsigned long directory_sequence = 0; // odd while the directory, count or deletes are changed together
+unsigned long long delete_sequence = 0; // deletes made so far; each tombstone is stamped with its number
+unsigned long long published_deletes = 0; // deletes visible to views
+__thread unsigned int reader_slot_hint = 0; // slot this thread claimed last
+
+/*
+ * A read-only picture of the store as of store_view_begin(): the rows
+ * published by then, less the rows deleted by then. A row deleted while
+ * the view is open may already carry a tombstone, but its number is above
+ * the view's 'deletes', so the view still counts it as live; rows appended
+ * meanwhile lie beyond 'count'. A view therefore gives the same answers
+ * for as long as it is open.
+ */
+typedef struct {
+    const StudentChunk *chunks;
+    const char *names;
+    size_t count;
+    unsigned long long deletes; // tombstones numbered above this are ignored
+    unsigned int slot;
+} StoreView;
+
+// One reader thread of the --bench-readers benchmark, on its own cache line
+typedef struct {
+    pthread_t thread;
+    volatile int *stop;
+    size_t reads; // views opened
+    size_t rows;  // rows checked
+    size_t torn;  // rows (or totals) whose fields did not belong together
+    unsigned int seed;
+} __attribute__((aligned(64))) ReaderBench;
+
+#define BENCH_MAX_SIZES 16     // roster sizes accepted by --bench-rows
+#define BENCH_MIN_SECONDS 0.25 // a repeatable measurement is scaled up until it runs this long
+#define BENCH_COUNTERS 3       // hardware counters read around each measurement
+
+// How --bench-suite draws the length of each synthetic name
+typedef enum {
+    NAMES_FIXED,   // every name is MIN characters long
+    NAMES_UNIFORM, // lengths spread evenly over MIN..MAX
+    NAMES_SKEWED   // the shorter of two uniform draws: mostly short names, a long tail
+} NameLengthDistribution;
+
+// Settings and counters of the --bench-suite benchmark
+typedef struct {
+    const char *rows;  // roster sizes, --bench-rows=N[,N...]
+    const char *names; // name lengths, --bench-names=fixed:N|uniform:MIN-MAX|skewed:MIN-MAX
+    NameLengthDistribution distribution;
+    int min_length;
+    int max_length;
+    unsigned int seed;            // LCG state for the synthetic names and scores
+    int counters[BENCH_COUNTERS]; // perf_event_open() descriptors, -1 where unavailable
+} BenchSuite;
+
+BenchSuite bench_suite = {"1000,100000,1000000", "uniform:4-24", NAMES_UNIFORM, 4, 24, 1, {-1, -1, -1}};
+
+// One measured operation of the --bench-suite benchmark
+typedef struct {
+    const char *name;
+    const char *unit;  // what one op is: a student added, a row rendered ...
+    size_t calls;      // calls of the operation in the measured run
+    size_t ops;
+    double seconds;
+    long long counts[BENCH_COUNTERS]; // -1 where the counter is unavailable
+    long peak_rss_kb;
+} BenchResult;
+
+// Runs an operation `calls` times and returns how many ops that was
+typedef size_t (*BenchBody)(size_t calls);
+
+#define NO_NAME 0xFFFFFFFFu // offset of an empty intern table slot
+
+// One slot of the name intern table
+typedef struct {
+    uint32_t hash;
+    unsigned int offset; // start of the name in the arena, or NO_NAME
+} NameSlot;
+
+/*
+ * Open-addressing hash set over the names in the arena, used to find an
+ * already stored copy of a name. Like the ID index it doubles once 70% full.
+ * After a snapshot load it is rebuilt from the arena on the next insert.
+ */
+typedef struct {
+    NameSlot *slots;
+    size_t capacity;
+    size_t used;
+    int stale; // the arena was loaded without filling the table
+} NameTable;
+
+NameTable name_table = {NULL, 0, 0, 0};
+
+#define NO_TRIE_ROW 0xFFFFFFFFu // end of a trie node's row list
+#define NAME_SEARCH_LIMIT 20    // matches shown by a prefix search
+
+/*
+ * Node of the name trie. Children are kept as a singly linked sibling list
+ * in ascending label order, so a depth-first walk yields names in sorted
+ * order. Rows whose name ends at a node are chained through
+ * NameTrie.next_row in insertion order.
+ */
+typedef struct {
+    unsigned int child;     // first child, or 0 (node 0 is the root)
+    unsigned int sibling;   // next sibling, or 0
+    unsigned int first_row; // NO_TRIE_ROW if no name ends here
+    unsigned int last_row;
+    unsigned char label;    // lower-cased byte on the edge into this node
+} TrieNode;
+
+/*
+ * Case-insensitive trie over student names, kept up to date by every
+ * insert so a prefix search costs O(prefix length + matches shown).
+ */
+typedef struct {
+    TrieNode *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    unsigned int *next_row; // next row with the same name, by row
+    size_t row_capacity;
+    int stale;              // rows were loaded without adding their names
+} NameTrie;
+
+NameTrie name_trie = {NULL, 0, 0, NULL, 0, 0};
+size_t student_count = 0; // Rows in the store, deleted ones included until a compaction
+
+// Result of changing a record in the store
+typedef enum {
+    STORE_OK,
+    STORE_NO_MEMORY,
+    STORE_DUPLICATE_ID,
+    STORE_NOT_FOUND,
+    STORE_IO_ERROR // the write-ahead log could not take the change, so it was not made
+} StoreStatus;
+
+#define NO_ROW ((size_t)-1) // "not found" value for row lookups
+
+// One slot of the ID index; row == NO_ROW marks an empty slot
+typedef struct {
+    int id;
+    size_t row;
+} IdIndexSlot;
+
+/*
+ * Open-addressing (linear probing) hash index from student ID to row. The
+ * slot count is a power of two and the table is rebuilt at double the size
+ * once it is 70% full, so lookups stay O(1) whatever the roster size.
+ */
+typedef struct {
+    IdIndexSlot *slots;
+    size_t capacity;
+    size_t used;
+} IdIndex;
+
+IdIndex student_id_index = {NULL, 0, 0};
+
+#define SCORE_BTREE_FANOUT 64 // entries per leaf / children per inner node
+#define SCORE_BTREE_MAX_HEIGHT 16
+
+// Ordered index key; entries compare by score, then by row
+typedef struct {
+    double score;
+    size_t row;
+} ScoreEntry;
+
+/*
+ * Node of the B+-tree that orders students by score. Leaves hold the
+ * entries and are chained left to right for range scans. Inner nodes are
+ * ScoreInner, which starts with a ScoreNode; their keys are the smallest
+ * entry beneath each child (used for routing), and they also keep the
+ * number of entries beneath each child, so a rank - and therefore the count
+ * of a score range - is found in one root-to-leaf descent. Removals do not
+ * merge nodes, so a leaf may be left empty until the index is rebuilt by
+ * the next compaction; walks along the chain step over empty leaves.
+ */
+typedef struct ScoreNode {
+    int leaf;
+    int count; // entries (leaf) or children (inner node)
+    ScoreEntry keys[SCORE_BTREE_FANOUT];
+    struct ScoreNode *next; // leaf only: right neighbour
+} ScoreNode;
+
+typedef struct {
+    ScoreNode base;
+    size_t sizes[SCORE_BTREE_FANOUT];
+    ScoreNode *children[SCORE_BTREE_FANOUT];
+} ScoreInner;
+
+#define SCORE_INNER(node) ((ScoreInner *)(node))
+
+// Ordered index on score
+typedef struct {
+    ScoreNode *root;
+    int height; // number of levels, leaves included
+} ScoreIndex;
+
+ScoreIndex student_score_index = {NULL, 0};
+int score_index_deferred = 0; // set while a bulk load rebuilds the index afterwards
+
+#define IMPORT_BATCH 64 // CSV rows parsed ahead so their index slots can be prefetched
+
+#define SNAPSHOT_MAGIC "STUDSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+/*
+ * On-disk snapshot header. The file is a direct image of the SoA columns:
+ * ids (int32), scores (double), name offsets (uint32) and the name buffer,
+ * each starting on an 8-byte boundary at the offsets recorded here. The
+ * header checksum covers the header (with that field zeroed) and is always
+ * checked; the data checksum covers everything after the header and is
+ * only checked with --verify-snapshot, since it means reading every page.
+ * The section bounds and the name offsets are always checked, so a file
+ * that passes the header checksum but was damaged later cannot point a
+ * row outside the name buffer.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t row_count;
+    uint64_t names_size;
+    uint64_t ids_offset;
+    uint64_t scores_offset;
+    uint64_t name_offsets_offset;
+    uint64_t names_offset;
+    uint64_t file_size;
+    uint64_t data_checksum;
+    uint64_t header_checksum;
+} SnapshotHeader;
+
+// Streaming writer that checksums everything it writes
+typedef struct {
+    FILE *file;
+    uint64_t sum_a, sum_b;
+    unsigned char tail[8];
+    int tail_len;
+    uint64_t written;
+} SnapshotWriter;
+
+#define SNAPSHOT_COMPRESSED_VERSION 2
+#define SNAPSHOT_BLOCK_ROWS 4096 // rows per compressed block, a multiple of 8
+#define SCORE_BITS_RAW 255       // block keeps its scores as doubles
+#define MAX_CODED_NAME 255       // longest name a compressed snapshot can hold
+
+/*
+ * Compressed snapshot (--snapshot-compress). It starts like a plain one
+ * (magic, version, byte order), and the rows follow in blocks of
+ * SNAPSHOT_BLOCK_ROWS that are encoded independently, so one block can be
+ * decoded or aggregated without touching the rest of the file:
+ *
+ *   ids     the first ID is in the directory; the gaps to the previous ID,
+ *           less the smallest gap, are bit-packed at id_bits each
+ *   scores  centi-points above the block's lowest score, bit-packed at
+ *           score_bits each; a block holding a score that is not a whole
+ *           number of centi-points keeps raw doubles instead
+ *   names   front-coded: per row a varint count of leading bytes shared
+ *           with the previous name (0 for the block's first), a varint
+ *           suffix length and the suffix bytes
+ *
+ * A bit-packed section is a bit stream, lowest bit first, followed by 8
+ * zero bytes, so any value can be read with one unaligned 8-byte load. Every
+ * section starts on an 8-byte boundary, and a directory of SnapshotBlock
+ * entries after the last block locates them. The checksums work as in the
+ * plain format.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t row_count;
+    uint64_t block_count;
+    uint64_t directory_offset;
+    uint64_t file_size;
+    uint64_t data_checksum;
+    uint64_t header_checksum;
+} CompressedSnapshotHeader;
+
+// Directory entry of one compressed block
+typedef struct {
+    uint64_t offset;     // start of the block's ids in the file
+    int64_t gap_base;    // smallest gap between neighbouring IDs
+    uint32_t rows;
+    uint32_t names_size; // bytes of front-coded names
+    int32_t first_id;
+    uint32_t score_base; // lowest score in centi-points (0 for raw scores)
+    uint32_t score_max;  // highest score in centi-points (10000 for raw scores)
+    uint8_t id_bits;
+    uint8_t score_bits;  // or SCORE_BITS_RAW
+    uint16_t reserved;
+} SnapshotBlock;
+
+char *snapshot_path = NULL;  // set by --snapshot=FILE
+int verify_snapshot = 0;     // set by --verify-snapshot
+int compress_snapshot = 0;   // set by --snapshot-compress
+
+#define WAL_RECORD_ADD 1
+#define WAL_RECORD_UPDATE 2
+#define WAL_RECORD_DELETE 3
+#define WAL_HEADER_SIZE 8         // uint32 payload length + uint32 checksum
+#define WAL_MAX_PAYLOAD 256
+
+/*
+ * Append-only write-ahead log of store changes, with group commit. Each
+ * record is [payload length][FNV-1a of payload][payload]; an ADD or UPDATE
+ * payload is type, id (int32), score (double) and the name bytes, a DELETE
+ * payload is type and id.
+ *
+ * Every record gets a sequence number. Appends copy the record into the
+ * active buffer; a flusher thread swaps buffers and writes + fsyncs the
+ * full one when batch_size records are waiting or the oldest waiting
+ * record is flush_interval seconds old, then publishes the last sequence
+ * number it made durable. A change is acknowledged only once its record
+ * is durable: the menu and scripts wait for it in wal_log_record(), and
+ * since nothing else can append while the writer waits, such a group is
+ * closed at once. The server does not wait; it holds each client's reply
+ * until its record is durable, so the records of many clients share one
+ * fsync. With batch_size 1 every append is written and synced inline.
+ */
+typedef struct {
+    int fd;
+    size_t batch_size;
+    double flush_interval;
+    int sync;                 // 0: write but leave syncing to the OS
+    unsigned char *active;    // records waiting to be written
+    size_t active_used;
+    size_t active_capacity;
+    size_t pending;           // records in the active buffer
+    double oldest_pending;    // time the first of them was appended
+    int flushing;             // the flusher is writing a swapped-out buffer
+    int stop;
+    int failed;               // a write or fsync failed; the log, and so the store, refuse changes
+    size_t records;           // records made durable so far
+    size_t syncs;             // fsync calls so far
+    unsigned long long sequence; // number of the last record appended
+    unsigned long long synced;   // number of the last record made durable (atomic)
+    int notify_fd;            // written to after each group, or -1
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;      // signals the flusher
+    pthread_cond_t idle;      // signals that a flush finished
+} WriteAheadLog;
+
+WriteAheadLog wal = {-1, 64, 0.010, 1, NULL, 0, 0, 0, 0.0, 0, 0, 0, 0, 0, 0, 0, -1,
+                     0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+char *wal_path = NULL;  // set by --wal=FILE
+int wal_replaying = 0;  // set while replay re-applies logged records
+int wal_deferred = 0;   // set while the caller (the server) waits for wal.synced itself
+
+#define RENDER_BUFFER_SIZE (1 << 20)
+#define ROW_FORMAT_SLACK 400 // bytes a row needs besides the name (fits any double)
+#define RENDER_MAX_SPANS 64  // commands whose output can wait in the buffer at once
+
+/*
+ * Output buffer for table rendering. Rows are formatted into it by hand and
+ * it is handed to write(2) in large pieces, instead of one stdio call per
+ * row. While a script holds the output, the buffer collects the output of
+ * many commands; the spans record which command produced which bytes, so
+ * the time spent writing them can be charged to it.
+ */
+typedef struct {
+    char data[RENDER_BUFFER_SIZE];
+    size_t used;
+    int fd;     // destination: stdout, or the file being exported to
+    int failed; // a write failed since the flag was last cleared
+    int hold;   // keep tables buffered past their footer (script mode)
+    size_t span_end[RENDER_MAX_SPANS]; // span k is data[span_end[k - 1], span_end[k])
+    int span_kind[RENDER_MAX_SPANS];   // the CommandKind that produced span k
+    int span_count;
+} RenderBuffer;
+
+RenderBuffer table_output = {{0}, 0, STDOUT_FILENO, 0, 0, {0}, {0}, 0};
+
+// Outcome of one line of a command script
+typedef enum {
+    SCRIPT_OK,
+    SCRIPT_FAILED,
+    SCRIPT_QUIT
+} ScriptStatus;
+
+/*
+ * Query server (--serve=PATH). Clients on the same machine connect to a
+ * Unix domain socket and exchange frames: a uint32 payload length followed
+ * by the payload, all integers and doubles in native byte order. A request
+ * payload is an op byte and its arguments; a reply payload is a status byte
+ * and the result:
+ *
+ *   ADD      int32 id, float64 score, name bytes  ->  (nothing)
+ *   GET      int32 id                              ->  record
+ *   LIST     uint32 first row, uint32 max rows     ->  uint32 n, n records
+ *   STATS    (nothing)  ->  uint64 count, float64 mean, min, max,
+ *                           std. deviation, uint64 count per grade A-F
+ *   LATENCY  (nothing)  ->  per op ADD..DELETE: uint64 requests,
+ *                           uint64 p50 ns, uint64 p99 ns
+ *   UPDATE   int32 id, float64 score, name bytes  ->  (nothing)
+ *   DELETE   int32 id                              ->  (nothing)
+ *
+ * A record is int32 id, float64 score, uint8 name length, name bytes. LIST
+ * pages through row positions and leaves deleted rows out, so a page may
+ * hold fewer records than it covers rows.
+ */
+typedef enum {
+    OP_ADD = 1,
+    OP_GET,
+    OP_LIST,
+    OP_STATS,
+    OP_LATENCY,
+    OP_UPDATE,
+    OP_DELETE,
+    SERVER_OP_END // one past the last op
+} ServerOp;
+
+typedef enum {
+    REPLY_OK,
+    REPLY_NOT_FOUND,
+    REPLY_DUPLICATE_ID,
+    REPLY_BAD_REQUEST,
+    REPLY_NO_MEMORY,
+    REPLY_IO_ERROR // the write-ahead log failed; the change was not made, or (held reply) not made durable
+} ReplyStatus;
+
+#define SERVER_MAX_FRAME (1u << 20)         // largest payload either way
+#define SERVER_LIST_LIMIT 8192              // rows per LIST reply
+#define SERVER_READ_SIZE (64 * 1024)        // bytes read per wakeup
+#define SERVER_HIGH_WATER (4 * 1024 * 1024) // unsent reply bytes before a client is paused
+#define SERVER_MAX_EVENTS 64
+
+/*
+ * Log-linear histogram of latencies in nanoseconds: exact below 16 ns, then
+ * 8 buckets per power of two, so a percentile is off by at most 12.5%.
+ */
+#define LATENCY_BUCKETS (16 + 60 * 8)
+
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+} LatencyHistogram;
+
+LatencyHistogram server_latency[SERVER_OP_END];
+
+/*
+ * Commands of the menu and of script mode, for the per-command statistics.
+ * They are numbered like the menu, so a menu choice is its command.
+ */
+typedef enum {
+    CMD_NONE, // outside any command (or an unknown one)
+    CMD_ADD,
+    CMD_LIST,
+    CMD_AVERAGE,
+    CMD_LOOKUP,
+    CMD_BAND,
+    CMD_GRADES,
+    CMD_IMPORT,
+    CMD_SAVE,
+    CMD_SEARCH,
+    CMD_PERCENTILES,
+    CMD_RANK,
+    CMD_EXPORT,
+    CMD_UPDATE,
+    CMD_DELETE,
+    CMD_STATS,
+    CMD_QUERY,
+    CMD_GROUP,
+    COMMAND_END // one past the last command, and the menu's Exit choice
+} CommandKind;
+
+const char *const command_names[COMMAND_END] = {"other", "add", "list", "avg", "get", "band", "grades",
+                                                "import", "save", "search", "percentiles", "rank",
+                                                "export", "update", "delete", "stats", "query", "group"};
+
+// What one command cost, summed over its runs
+typedef struct {
+    LatencyHistogram latency;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t write_ns; // time spent writing the command's table output; in a script
+                       // that holds its output this comes after the command ends
+    uint64_t rows;     // table rows formatted
+    uint64_t bytes;    // table bytes rendered
+} CommandCounters;
+
+/*
+ * Statistics kept by one thread. Only the owner writes them, with relaxed
+ * atomic stores (plain stores on x86), so the stats command and the dump
+ * thread can add up every thread's block without stopping it.
+ */
+typedef struct ThreadStats {
+    CommandCounters commands[COMMAND_END]; // [CMD_NONE]: output outside commands
+    uint64_t records_added;
+    uint64_t records_updated;
+    uint64_t records_deleted;
+    CommandKind current; // command the thread is running
+    struct ThreadStats *next;
+} ThreadStats;
+
+// Every thread's statistics, and the optional periodic dump of their sum
+typedef struct {
+    ThreadStats *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;   // wakes the dump thread early to stop
+    const char *dump_path; // --stats-file=PATH, or NULL
+    double dump_interval;  // seconds between dumps, --stats-interval=S
+    pthread_t dumper;
+    int dumping;           // the dump thread is running
+    int stop;
+} StatsRegistry;
+
+StatsRegistry stats_registry = {NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 10.0, 0, 0, 0};
+__thread ThreadStats *thread_stats = NULL; // this thread's block, from thread_stats_get()
+
+// A reply that may not be sent before its write-ahead log record is durable
+typedef struct {
+    size_t start;                // offset of the reply frame in the client's out buffer
+    unsigned long long sequence; // the record's number
+} ServerHold;
+
+// One client connection with its partly read requests and unsent replies
+typedef struct {
+    int fd;
+    uint32_t events; // epoll interest currently registered
+    unsigned char *in;
+    size_t in_used;
+    size_t in_capacity;
+    unsigned char *out;
+    size_t out_sent; // bytes of out already written to the socket
+    size_t out_used;
+    size_t out_capacity;
+    ServerHold *holds; // held replies, oldest first; the replies after the first wait too
+    size_t hold_count;
+    size_t hold_capacity;
+    size_t slot; // position in server.clients
+} ServerClient;
+
+/*
+ * State of the running server. SIGINT and SIGTERM write a byte to
+ * stop_pipe, whose read end is watched by the epoll loop like a client;
+ * the log flusher writes to wal_pipe after each group commit, so held
+ * replies are released.
+ */
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    int stop_pipe[2];
+    int wal_pipe[2];
+    ServerClient **clients;
+    size_t client_count;
+    size_t client_capacity;
+} QueryServer;
+
+QueryServer server = {-1, -1, {-1, -1}, {-1, -1}, NULL, 0, 0};
+
+const char *const server_op_names[SERVER_OP_END] = {NULL, "ADD", "GET", "LIST", "STATS", "LATENCY",
+                                                      "UPDATE", "DELETE"};
+
+// Sort entry for the ranked export: a radix key and the row it belongs to
+typedef struct {
+    unsigned long long key;
+    unsigned int row;
+} SortEntry;
+
+// Order of the roster export
+typedef enum {
+    EXPORT_BY_SCORE, // score descending, ties by ID ascending
+    EXPORT_BY_ID     // ID ascending
+} ExportOrder;
+
+// Outcome of a bulk CSV import
+typedef struct {
+    size_t imported;
+    size_t rejected;
+    size_t bytes;
+    size_t first_bad_line; // 0 if every line was accepted
+    int log_failed;        // the import stopped because the write-ahead log failed
+} ImportResult;
+
+// Summary statistics over the score column
+typedef struct {
+    size_t count;
+    double sum;
+    double mean;
+    double min;
+    double max;
+    double variance; // population variance
+} ScoreStats;
+
+/*
+ * Running state of the statistics kernel. Sums are kept with Kahan
+ * compensation; the squared deviations are taken around 'shift' (the first
+ * score seen) so the one-pass variance does not suffer from cancellation.
+ */
+typedef struct {
+    size_t count;
+    double shift;
+    double sum, sum_c;
+    double dev, dev_c;
+    double dev_sq, dev_sq_c;
+    double min;
+    double max;
+} StatsAccumulator;
+
+// Kernel signature shared by the scalar and AVX2 implementations
+typedef void (*StatsKernel)(StatsAccumulator *acc, const double *scores, size_t n, size_t stride);
+
+int use_simd = 1; // cleared by --no-simd to benchmark the scalar kernel
+
+#define GRADE_COUNT 5 // letter grades A, B, C, D and F
+#define SCORE_SKETCH_BINS 10001 // quantile sketch: one bin per 0.01 point from 0 to 100
+
+/*
+ * Running totals over the score column. Every insert folds its score in
+ * and every delete takes it out again, so the average and
+ * grade-distribution queries never rescan the store. The score bins form
+ * a mergeable quantile sketch; since scores are limited to 0-100 a fixed
+ * 0.01-point grid bounds the error at half a bin.
+ */
+typedef struct {
+    StatsAccumulator stats;
+    size_t grade_counts[GRADE_COUNT];     // indexed by grade_index()
+    size_t score_bins[SCORE_SKETCH_BINS]; // indexed by score_bin()
+    int stale;                            // rows were loaded without updating the totals
+    unsigned long sequence;               // odd while stats, grade_counts or stale change
+} ScoreAggregates;
+
+ScoreAggregates score_totals = {{0, 0, 0, 0, 0, 0, 0, 0, INFINITY, -INFINITY}, {0}, {0}, 0, 0};
+int approx_quantiles = 0; // set by --approx-quantiles: answer percentiles from the sketch
+int check_aggregates = 0; // set by --check-aggregates: compare the totals with a full rescan
+
+#define REDUCE_TASK_ROWS 8192 // rows per reduction task: 64 KiB of SoA scores, fits in L2
+#define MAX_POOL_THREADS 64
+
+// Work item run by the thread pool: task 'index' of the current job
+typedef void (*PoolTask)(size_t index, void *arg);
+
+/*
+ * Fixed pool of worker threads, started on first use. The thread calling
+ * pool_run() works alongside them; tasks are claimed from a shared counter
+ * so faster threads take more of them.
+ */
+typedef struct {
+    size_t thread_count;      // threads per job including the caller, --threads=N (0: one per core)
+    size_t threshold;         // rows from which scans run in parallel, --parallel-threshold=N
+    size_t started;           // worker threads running
+    pthread_t workers[MAX_POOL_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;      // signals the workers that a job (or stop) is posted
+    pthread_cond_t done;      // signals the caller that the last worker finished
+    unsigned long generation; // incremented for every job
+    size_t busy;              // workers still on the current job
+    int stop;
+    PoolTask task;
+    void *arg;
+    size_t task_count;
+    size_t next_task;         // next unclaimed task, taken with an atomic add
+} ThreadPool;
+
+ThreadPool pool = {0, 1 << 20, 0, {0}, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                   PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL, NULL, 0, 0};
+
+// One reduction task's share of the statistics and grade histogram
+typedef struct {
+    StatsAccumulator stats;
+    size_t grade_counts[GRADE_COUNT];
+} ReducePartial;
+
+#define MAX_RANK_K 1000 // largest K accepted by the top-K / bottom-K query
+
+/*
+ * Bounded heap holding the k best-ranked entries seen so far. The root is
+ * the entry that ranks last, i.e. the one a better candidate replaces.
+ */
+typedef struct {
+    ScoreEntry *entries;
+    size_t count;
+    size_t k;
+    int top; // rank by highest score (1) or lowest score (0)
+} RankHeap;
+
+// A parallel top-K / bottom-K scan: one heap per arena chunk
+typedef struct {
+    RankHeap *heaps;
+} RankJob;
+
+// A parallel reduction: one partial per task
+typedef struct {
+    StatsKernel kernel;
+    ReducePartial *partials;
+    size_t *score_bins; // shared sketch bins (atomic adds), or NULL
+} ReduceJob;
+
+/*
+ * A compaction. The writer takes a picture of the chunk directory and of
+ * the tombstones (row data is never changed in place, so that is all it
+ * needs to copy), and a background thread copies the live rows of the
+ * picture into fresh chunks and builds the ID and score indexes for them
+ * while the writer goes on taking changes. At a later change the writer
+ * replays the deletes and appends made since the picture onto the new
+ * chunks and indexes and swaps them in.
+ */
+typedef struct {
+    StudentChunk *old_chunks; // the picture; each dead bitmap is a private copy
+    size_t old_count;         // chunks in the picture
+    size_t row_count;         // rows in the picture
+    size_t live;              // live rows in the picture
+    size_t *first_row;        // by old chunk: new row of its first live row
+    StudentChunk *chunks;     // the new chunks
+    size_t chunk_count;
+    size_t chunk_capacity;
+    size_t count;             // rows in the new chunks
+    int build_indexes;        // the indexes were current when the picture was taken
+    IdIndex id_index;         // built for the new rows, swapped in with them
+    ScoreIndex score_index;
+    pthread_t thread;
+    int threaded;             // the copy runs on 'thread'
+    int running;              // a picture was taken and not yet swapped in or dropped
+    int done;                 // the copy has finished (written with release order)
+    int cancel;               // asks the thread to stop early
+    int ok;                   // the copy succeeded
+} CompactJob;
+
+CompactJob compact_job = {0};
+
+// Sums a block-level kernel takes over one block's packed scores
+typedef struct {
+    uint64_t sum;    // of the packed values, i.e. centi-points above the base
+    uint64_t sum_sq;
+    size_t at_least[GRADE_COUNT - 1]; // scores of at least 90, 80, 70 and 60
+} BlockTotals;
+
+// Lowest A, B, C and D scores in centi-points, matching get_letter_grade()
+const uint32_t grade_floor_centi[GRADE_COUNT - 1] = {9000, 8000, 7000, 6000};
+
+// Kernel signatures shared by the scalar and AVX2 implementations
+typedef void (*UnpackKernel)(const unsigned char *packed, int bits, size_t count, uint32_t *out);
+typedef void (*BlockStatsKernel)(const unsigned char *packed, int bits, size_t count, uint32_t base,
+                                 BlockTotals *totals);
+
+// A parallel aggregation over the blocks of a mapped compressed snapshot
+typedef struct {
+    const unsigned char *base;
+    const SnapshotBlock *blocks;
+    BlockStatsKernel kernel;
+    StatsKernel stats_kernel; // for blocks with raw scores
+    ReducePartial *partials;  // one per block
+} SnapshotStatsJob;
+
+#define FILTER_BATCH_ROWS 1024 // rows per selection vector; divides REDUCE_TASK_ROWS
+#define FILTER_MAX_DEPTH 16    // nesting limit of filter expressions (each level of the tree keeps
+                               // a few selection vectors on the stack)
+#define FILTER_MAX_TEXT 256    // longest quoted name or pattern in a filter
+
+// Node kinds of a compiled filter expression
+typedef enum {
+    FILTER_FALSE,
+    FILTER_TRUE,
+    FILTER_ID,       // id_low <= id <= id_high
+    FILTER_SCORE,    // score_low <= score <= score_high
+    FILTER_NAME,     // the row's name offset is 'name'
+    FILTER_NAME_SET, // the row's name offset is marked in name_bits
+    FILTER_AND,
+    FILTER_OR,
+    FILTER_NOT
+} FilterKind;
+
+// The columns of one batch of rows; in the AoS layout they are strided
+typedef struct {
+    const int *ids;
+    const double *scores;
+    const unsigned int *names;
+    size_t stride;       // ints between the ids (and name offsets) of neighbouring rows
+    size_t score_stride; // doubles between neighbouring scores
+} FilterBatch;
+
+struct FilterNode;
+
+/*
+ * Filter kernel: keeps the rows of the selection vector sel (offsets into
+ * the batch, ascending) that pass the node, in order, and returns how many
+ * are left.
+ */
+typedef size_t (*FilterKernel)(const struct FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+
+/*
+ * Compiled filter expression. Every comparison becomes a closed range on
+ * one column or a set of interned names, and every node carries the kernel
+ * specialized for its kind.
+ */
+typedef struct FilterNode {
+    FilterKind kind;
+    FilterKernel kernel;
+    long long id_low, id_high;
+    double score_low, score_high;
+    unsigned int name;
+    uint64_t *name_bits;          // one bit per byte of the name arena
+    struct FilterNode **children; // FILTER_AND, FILTER_OR and FILTER_NOT
+    size_t child_count;
+    size_t cost; // estimated work per row, set by filter_order()
+} FilterNode;
+
+// Parser state of filter_compile()
+typedef struct {
+    const char *text;
+    const char *p;
+    int depth;
+    char error[160]; // first error met, empty if none
+} FilterParser;
+
+// A parallel reduction over the rows that pass a filter: one partial per task
+typedef struct {
+    const FilterNode *filter;
+    StatsKernel kernel;
+    ReducePartial *partials;
+} FilterJob;
+
+#define GROUP_MAX_BUCKETS 1000 // score buckets of a group-by (the narrowest is 0.1 points)
+
+// Count and score totals of one group of a group-by
+typedef struct {
+    size_t count;
+    double sum;
+    double min;
+    double max;
+} GroupTotals;
+
+/*
+ * A parallel group-by over the score column: by letter grade (indexed by
+ * grade_index()) when width_centi is 0, otherwise by score buckets
+ * [bounds[k], bounds[k + 1]). Each task fills its own table of group_count
+ * groups in partials.
+ */
+typedef struct {
+    uint32_t width_centi; // bucket width in hundredths of a point, 0 for letter grades
+    int group_count;
+    double width;
+    // bucket k starts at k * width; bounds[0] is -inf and bounds[group_count]
+    // +inf, so out-of-range scores land in the first or last bucket
+    double bounds[GROUP_MAX_BUCKETS + 1];
+    const FilterNode *filter; // NULL: every live student
+    GroupTotals *partials;
+} GroupJob;
+
+StudentRow *student_at(size_t index);
+int student_id(size_t index);
+double student_score(size_t index);
+const char *student_name(size_t index);
+int tombstone_test(const uint64_t *dead, size_t offset);
+size_t tombstone_run(const uint64_t *dead, size_t offset, size_t end);
+int student_dead(size_t index);
+size_t store_live_count();
+size_t store_score_run(size_t start, const double **scores, size_t *stride);
+void store_view_begin(StoreView *view);
+void store_view_end(const StoreView *view);
+int view_student_dead(const StoreView *view, size_t index);
+int view_tombstone_visible(const StoreView *view, const StudentChunk *chunk, size_t offset);
+int view_student_id(const StoreView *view, size_t index);
+double view_student_score(const StoreView *view, size_t index);
+const char *view_student_name(const StoreView *view, size_t index);
+void store_view_stats(const StoreView *view, StatsAccumulator *acc);
+void store_publish();
+unsigned long store_oldest_reader();
+void store_retire(void *block);
+void store_reclaim();
+int store_alloc_chunk(StudentChunk *chunk);
+char *name_arena_tail(size_t len);
+int name_table_reserve(size_t extra);
+int name_table_insert(uint32_t hash, unsigned int offset);
+int name_table_rebuild();
+long name_intern_tail();
+long name_intern(const char *name);
+void name_table_reset();
+unsigned char trie_fold(char c);
+int name_trie_reserve(size_t name_length, size_t row);
+unsigned int name_trie_child(unsigned int node, unsigned char label);
+void name_trie_add(const char *name, size_t row);
+void name_trie_remove(const char *name, size_t row);
+int name_trie_rebuild();
+size_t name_trie_search(const char *prefix, size_t *rows, size_t limit);
+void name_trie_reset();
+size_t id_index_slot(int id, size_t capacity);
+size_t id_index_find(int id);
+IdIndexSlot *id_index_probe(int id);
+void id_index_erase(IdIndexSlot *slot);
+int id_index_reserve(size_t extra);
+void id_index_reset();
+int score_entry_less(const ScoreEntry *a, const ScoreEntry *b);
+ScoreNode *score_node_alloc(int leaf);
+size_t score_node_total(const ScoreNode *node);
+int score_node_route(const ScoreNode *node, const ScoreEntry *entry);
+int score_index_insert(double score, size_t row);
+int score_index_remove(double score, size_t row);
+ScoreNode *score_leaf_next(ScoreNode *leaf);
+size_t score_index_rank(double score);
+double score_index_select(size_t rank);
+ScoreNode *score_index_locate(size_t rank, int *pos);
+size_t score_index_seek(double score, ScoreNode **leaf, int *pos);
+size_t score_index_count(double low, double high);
+void score_node_free(ScoreNode *node);
+void score_index_reset();
+unsigned long long score_sort_key(double score);
+int radix_sort_score_entries(ScoreEntry *entries, size_t n);
+int score_index_load(ScoreIndex *index, const ScoreEntry *entries, size_t count);
+int score_index_rebuild();
+const char *parse_csv_int(const char *p, const char *end, int *value);
+const char *parse_csv_score(const char *p, const char *end, double *value);
+int parse_csv_line(const char *line, const char *line_end, Student *student);
+int import_csv(const char *path, ImportResult *result);
+void checksum_update(uint64_t *a, uint64_t *b, const unsigned char *data, size_t len);
+uint64_t checksum_finish(uint64_t a, uint64_t b, const unsigned char *tail, int tail_len);
+int snapshot_write(SnapshotWriter *w, const void *data, size_t len);
+int snapshot_pad(SnapshotWriter *w);
+int snapshot_commit(SnapshotWriter *w, int ok, const void *header, size_t header_size,
+                    const char *tmp_path, const char *path);
+int save_snapshot(const char *path);
+int load_snapshot(const char *path);
+int section_fits(uint64_t offset, uint64_t length, uint64_t end);
+int snapshot_names_valid(const uint32_t *name_offsets, size_t n, const char *names, uint64_t names_size);
+size_t packed_size(int bits, size_t count);
+int bit_width(uint64_t value);
+void bitpack(unsigned char *out, const uint64_t *values, size_t count, int bits);
+uint64_t bitunpack_one(const unsigned char *packed, int bits, size_t index);
+void unpack_scalar(const unsigned char *packed, int bits, size_t count, uint32_t *out);
+UnpackKernel select_unpack_kernel();
+void block_stats_scalar(const unsigned char *packed, int bits, size_t count, uint32_t base, BlockTotals *totals);
+BlockStatsKernel select_block_stats_kernel();
+size_t varint_put(unsigned char *out, uint32_t value);
+const unsigned char *varint_get(const unsigned char *p, const unsigned char *end, uint32_t *value);
+size_t block_score_size(const SnapshotBlock *block);
+int save_compressed_snapshot(const char *path);
+int compressed_snapshot_check(const unsigned char *base, size_t size);
+int load_compressed_snapshot(unsigned char *base, size_t size);
+void snapshot_block_task(size_t index, void *arg);
+int snapshot_file_stats(const char *path, StatsAccumulator *acc, size_t *grade_counts, size_t *block_count);
+int print_snapshot_stats(const char *path);
+void grade_band_bounds(char grade, double *low, double *high);
+StoreStatus store_append(const Student *student);
+StoreStatus store_insert(int id, unsigned int name, double score);
+StoreStatus store_update(const Student *student);
+StoreStatus store_put(int id, unsigned int name, double score, int replace);
+StoreStatus store_delete(int id);
+int store_reserve_tombstone(size_t row);
+void store_tombstone(size_t row);
+void store_maybe_compact();
+int compact_begin(CompactJob *job);
+void compact_task(size_t index, void *arg);
+void compact_copy(CompactJob *job, int parallel);
+void *compact_main(void *arg);
+int compact_push(CompactJob *job, const StudentChunk *from, size_t offset);
+int compact_finish(CompactJob *job);
+void compact_discard(CompactJob *job);
+void compact_collect(CompactJob *job);
+int store_compact();
+int store_push_row(int id, unsigned int name, double score);
+void store_reset();
+int store_ensure_indexes();
+void stats_init(StatsAccumulator *acc);
+void kahan_add(double *sum, double *c, double value);
+void stats_kernel_scalar(StatsAccumulator *acc, const double *scores, size_t n, size_t stride);
+StatsKernel select_stats_kernel();
+void store_scan_stats(StatsAccumulator *acc);
+ScoreStats stats_finish(const StatsAccumulator *acc);
+ScoreStats store_compute_stats();
+int grade_index(char grade);
+int score_bin(double score);
+void aggregates_reset();
+void aggregates_add(double score);
+void aggregates_remove(double score);
+void totals_write_begin();
+void totals_write_end();
+int store_read_totals(StatsAccumulator *stats, size_t *grade_counts);
+void store_ensure_aggregates();
+int aggregates_match_rescan();
+int pool_start();
+void *pool_worker_main(void *arg);
+void pool_work();
+void pool_run(size_t task_count, PoolTask task, void *arg);
+void pool_stop();
+void stats_merge(StatsAccumulator *acc, const StatsAccumulator *part);
+void reduce_task(size_t index, void *arg);
+void store_reduce(StatsAccumulator *acc, size_t *grade_counts, size_t *score_bins);
+double sketch_select(const size_t *bins, size_t rank);
+double score_quantile(double q, int approximate);
+int ranks_before(const ScoreEntry *a, const ScoreEntry *b, int top);
+void rank_heap_push(RankHeap *heap, double score, size_t row);
+size_t rank_heap_drain(RankHeap *heap, size_t *rows);
+void rank_task(size_t index, void *arg);
+size_t store_rank_students(int top, size_t k, size_t *rows);
+FilterKernel filter_kernel_for(FilterKind kind);
+FilterNode *filter_node(FilterKind kind);
+void filter_free(FilterNode *node);
+int filter_add_child(FilterNode *node, FilterNode *child);
+FilterNode *filter_combine(FilterKind kind, FilterNode *left, FilterNode *right);
+FilterNode *filter_range(FilterKind kind, double low, double high);
+int glob_match(const char *pattern, const char *name);
+FilterNode *filter_name_node(const char *pattern, int glob);
+FilterNode *filter_error(FilterParser *parser, const char *message);
+int filter_word_char(char c);
+void filter_skip_space(FilterParser *parser);
+int filter_accept(FilterParser *parser, const char *token);
+int filter_number(FilterParser *parser, double *value);
+int filter_string(FilterParser *parser, char *out, size_t size);
+FilterNode *filter_parse_comparison(FilterParser *parser);
+FilterNode *filter_parse_not(FilterParser *parser);
+FilterNode *filter_parse_and(FilterParser *parser);
+FilterNode *filter_parse_or(FilterParser *parser);
+void filter_order(FilterNode *node);
+FilterNode *filter_compile(const char *text, char *error, size_t error_size);
+size_t filter_kernel_false(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_true(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_id(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_score(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_name(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_name_set(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_and(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_or(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_kernel_not(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n);
+size_t filter_batch(const FilterNode *filter, size_t start, size_t len, uint32_t *sel);
+size_t filter_list(const FilterNode *filter);
+void filter_task(size_t index, void *arg);
+int filter_reduce(const FilterNode *filter, StatsAccumulator *acc, size_t *grade_counts);
+int group_parse_width(const char *text, uint32_t *width_centi);
+int group_count_for(uint32_t width_centi);
+int group_index(const GroupJob *job, double score);
+void group_scores(const GroupJob *job, GroupTotals *table, const double *scores, size_t n, size_t stride);
+void group_task(size_t index, void *arg);
+int store_group_by(uint32_t width_centi, const FilterNode *filter, GroupTotals *groups);
+void render_group_report(uint32_t width_centi, const GroupTotals *groups, int filtered);
+double now_seconds();
+void run_store_benchmark();
+void *reader_bench_main(void *arg);
+void run_reader_benchmark();
+int bench_parse_options(size_t *sizes, size_t *size_count);
+void bench_open_counters();
+void bench_counters_start();
+void bench_counters_stop(long long *counts);
+void bench_close_counters();
+unsigned int bench_random();
+void bench_name(char *out);
+size_t bench_add_students(size_t calls);
+size_t bench_display(size_t calls);
+size_t bench_average(size_t calls);
+size_t bench_rescan(size_t calls);
+size_t bench_letter_grades(size_t calls);
+void bench_measure(BenchResult *result, BenchBody body, size_t calls);
+void bench_print_result(const BenchResult *result, int last);
+int run_bench_suite();
+void display_menu();
+int get_menu_choice();
+size_t run_script(FILE *in);
+ScriptStatus run_script_command(char *line, size_t line_number);
+void script_error(size_t line_number, const char *format, ...);
+void latency_record(LatencyHistogram *h, uint64_t ns);
+uint64_t latency_percentile(const LatencyHistogram *h, double q);
+void server_on_signal(int sig);
+int run_server(const char *path);
+void server_accept();
+void server_close_client(ServerClient *client);
+int server_read(ServerClient *client);
+size_t server_release_holds(ServerClient *client);
+int server_hold_reply(ServerClient *client, size_t start, unsigned long long sequence);
+void server_release_all();
+int server_write(ServerClient *client);
+int server_process(ServerClient *client);
+int server_update_events(ServerClient *client);
+unsigned char *server_reply_reserve(ServerClient *client, size_t len);
+unsigned char *server_put_record(unsigned char *p, size_t row);
+int server_handle(ServerClient *client, const unsigned char *request, uint32_t len);
+void print_server_latency();
+void stat_add(uint64_t *counter, uint64_t n);
+ThreadStats *thread_stats_get();
+void stats_count_rows(size_t n);
+double command_begin(CommandKind kind);
+void command_kind(CommandKind kind);
+double command_end(double start);
+void stats_sum_threads(ThreadStats *sum);
+int print_command_stats(FILE *out);
+void render_command_stats();
+void show_command_stats();
+int stats_dump_write();
+void *stats_dump_main(void *arg);
+int stats_dump_start();
+void stats_dump_stop();
+void add_student();
+void update_student();
+void delete_student();
+char *render_reserve(size_t len);
+void render_append(const char *text, size_t len);
+void render_close_span(int kind);
+void render_mark(int kind);
+void render_flush();
+void render_printf(const char *format, ...);
+char *format_padded_int(char *out, int value, int width);
+char *format_fixed2(char *out, double value, int width);
+size_t format_student_row(char *out, int id, const char *name, double score);
+void run_render_benchmark();
+void print_table_header();
+void print_table_footer();
+void print_student_row(size_t index);
+void display_all_students();
+void lookup_student();
+void list_grade_band();
+void display_grade_band_counts();
+void import_students();
+void save_snapshot_command();
+void search_by_name_prefix();
+void radix_sort_entries(SortEntry *entries, SortEntry *scratch, size_t n, int digits);
+unsigned int *store_sorted_order(ExportOrder order);
+int export_order_compare(const void *a, const void *b);
+unsigned int *store_sorted_order_qsort(ExportOrder order);
+void run_export_benchmark();
+void export_roster();
+void show_percentiles();
+void show_top_students();
+void query_students();
+void show_group_report();
+int checkpoint_snapshot();
+uint32_t fnv1a(const unsigned char *data, size_t len);
+int wal_open(const char *path);
+size_t wal_replay(const char *path);
+int wal_write_buffer(const unsigned char *data, size_t len);
+void *wal_flusher_main(void *arg);
+int wal_log_record(int type, int id, const char *name, double score);
+int wal_wait_synced(unsigned long long sequence);
+void wal_wait_idle();
+int wal_checkpoint();
+void wal_close();
+void run_wal_benchmark();
+void calculate_average_score();
+char get_letter_grade(double score);
+void clear_input_buffer();
+void read_string(char *str, int max_len);
+
+/**
+ * @brief Main function to run the student management system.
+ *
+ * Contains the main application loop which displays a menu and calls
+ * the appropriate function based on the user's choice. The loop
+ * continues until the user decides to exit.
+ */
+int main(int argc, char *argv[]) {
+    int choice;
+    int script = 0;
+    const char *script_path = NULL; // NULL: the script is read from stdin
+    const char *serve_path = NULL;
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--layout=soa") == 0) {
+            student_database.layout = LAYOUT_SOA;
+        } else if (strcmp(argv[i], "--layout=aos") == 0) {
+            student_database.layout = LAYOUT_AOS;
+        } else if (strcmp(argv[i], "--no-simd") == 0) {
+            use_simd = 0;
+        } else if (strncmp(argv[i], "--snapshot=", 11) == 0) {
+            snapshot_path = argv[i] + 11;
+        } else if (strcmp(argv[i], "--verify-snapshot") == 0) {
+            verify_snapshot = 1;
+        } else if (strcmp(argv[i], "--snapshot-compress") == 0) {
+            compress_snapshot = 1;
+        } else if (strncmp(argv[i], "--snapshot-stats=", 17) == 0) {
+            return print_snapshot_stats(argv[i] + 17) ? 0 : 1;
+        } else if (strncmp(argv[i], "--wal=", 6) == 0) {
+            wal_path = argv[i] + 6;
+        } else if (strncmp(argv[i], "--wal-batch=", 12) == 0) {
+            wal.batch_size = (size_t)atol(argv[i] + 12);
+            if (wal.batch_size == 0) {
+                wal.batch_size = 1;
+            }
+        } else if (strncmp(argv[i], "--wal-interval-ms=", 18) == 0) {
+            wal.flush_interval = atof(argv[i] + 18) / 1000.0;
+        } else if (strcmp(argv[i], "--wal-no-sync") == 0) {
+            wal.sync = 0;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            pool.thread_count = (size_t)atol(argv[i] + 10);
+        } else if (strncmp(argv[i], "--parallel-threshold=", 21) == 0) {
+            pool.threshold = (size_t)atol(argv[i] + 21);
+        } else if (strcmp(argv[i], "--approx-quantiles") == 0) {
+            approx_quantiles = 1;
+        } else if (strncmp(argv[i], "--compact-threshold=", 20) == 0) {
+            compact_threshold = atof(argv[i] + 20);
+        } else if (strcmp(argv[i], "--check-aggregates") == 0) {
+            check_aggregates = 1;
+        } else if (strncmp(argv[i], "--stats-file=", 13) == 0) {
+            stats_registry.dump_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--stats-interval=", 17) == 0) {
+            stats_registry.dump_interval = atof(argv[i] + 17);
+            if (!(stats_registry.dump_interval > 0.0)) {
+                stats_registry.dump_interval = 10.0;
+            }
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serve_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--script") == 0) {
+            script = 1;
+        } else if (strncmp(argv[i], "--script=", 9) == 0) {
+            script = 1;
+            script_path = argv[i] + 9;
+        } else if (strcmp(argv[i], "--bench-export") == 0) {
+            run_export_benchmark();
+            return 0;
+        } else if (strcmp(argv[i], "--bench-render") == 0) {
+            run_render_benchmark();
+            return 0;
+        } else if (strcmp(argv[i], "--bench-wal") == 0) {
+            run_wal_benchmark();
+            return 0;
+        } else if (strcmp(argv[i], "--bench-store") == 0) {
+            run_store_benchmark();
+            return 0;
+        } else if (strcmp(argv[i], "--bench-readers") == 0) {
+            run_reader_benchmark();
+            return 0;
+        } else if (strncmp(argv[i], "--bench-rows=", 13) == 0) {
+            bench_suite.rows = argv[i] + 13;
+        } else if (strncmp(argv[i], "--bench-names=", 14) == 0) {
+            bench_suite.names = argv[i] + 14;
+        } else if (strcmp(argv[i], "--bench-suite") == 0) {
+            return run_bench_suite() ? 0 : 1;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // Restore the roster saved by the previous run
+    if (snapshot_path != NULL) {
+        double start = now_seconds();
+        if (load_snapshot(snapshot_path)) {
+            printf("Loaded %zu student(s) from %s in %.2f ms.\n",
+                   student_count, snapshot_path, (now_seconds() - start) * 1000.0);
+        } else if (errno != ENOENT) {
+            printf("Error: Could not load snapshot '%s' (%s).\n", snapshot_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    // Re-apply changes logged since that snapshot, then keep logging
+    if (wal_path != NULL) {
+        size_t replayed = wal_replay(wal_path);
+        if (replayed > 0) {
+            printf("Replayed %zu record(s) from %s.\n", replayed, wal_path);
+        }
+        if (!wal_open(wal_path)) {
+            printf("Error: Could not open write-ahead log '%s' (%s).\n", wal_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    // Keep the statistics file current while the program runs
+    if (stats_registry.dump_path != NULL && !stats_dump_start()) {
+        printf("Error: Could not write statistics to '%s' (%s).\n", stats_registry.dump_path, strerror(errno));
+        return 1;
+    }
+
+    // Headless modes replace the menu and exit like the menu's Exit choice
+    if (serve_path != NULL) {
+        if (!run_server(serve_path)) {
+            printf("Error: Could not serve on '%s' (%s).\n", serve_path, strerror(errno));
+            status = 1;
+        }
+    } else if (script) {
+        FILE *in = script_path != NULL ? fopen(script_path, "r") : stdin;
+        if (in == NULL) {
+            fprintf(stderr, "Error: Could not open script '%s' (%s).\n", script_path, strerror(errno));
+            status = 1;
+        } else {
+            status = run_script(in) > 0;
+            if (in != stdin) {
+                fclose(in);
+            }
+        }
+    } else {
+        do {
+            display_menu();
+            choice = get_menu_choice();
+
+            // everything the choice does is timed and counted as its command
+            double start = command_begin(choice > CMD_NONE && choice < COMMAND_END ? (CommandKind)choice : CMD_NONE);
+            switch (choice) {
+                case 1:
+                    add_student();
+                    break;
+                case 2:
+                    display_all_students();
+                    break;
+                case 3:
+                    calculate_average_score();
+                    break;
+                case 4:
+                    lookup_student();
+                    break;
+                case 5:
+                    list_grade_band();
+                    break;
+                case 6:
+                    display_grade_band_counts();
+                    break;
+                case 7:
+                    import_students();
+                    break;
+                case 8:
+                    save_snapshot_command();
+                    break;
+                case 9:
+                    search_by_name_prefix();
+                    break;
+                case 10:
+                    show_percentiles();
+                    break;
+                case 11:
+                    show_top_students();
+                    break;
+                case 12:
+                    export_roster();
+                    break;
+                case 13:
+                    update_student();
+                    break;
+                case 14:
+                    delete_student();
+                    break;
+                case 15:
+                    show_command_stats();
+                    break;
+                case 16:
+                    query_students();
+                    break;
+                case 17:
+                    show_group_report();
+                    break;
+                case 18:
+                    if (snapshot_path != NULL && !checkpoint_snapshot()) {
+                        printf("Error: Could not save snapshot '%s'.\n", snapshot_path);
+                    }
+                    printf("Exiting the program. Goodbye!\n");
+                    break;
+                default:
+                    printf("Invalid choice. Please enter a number between 1 and 18.\n");
+                    break;
+            }
+            command_end(start);
+            printf("\nPress Enter to continue...");
+            clear_input_buffer();
+
+        } while (choice != 18);
+    }
+    if ((serve_path != NULL || script) && snapshot_path != NULL && !checkpoint_snapshot()) {
+        fprintf(stderr, "Error: Could not save snapshot '%s'.\n", snapshot_path);
+        status = 1;
+    }
+
+    wal_close();
+    stats_dump_stop();
+    pool_stop();
+    store_reset();
+    return status;
+}
+
+/**
+ * @brief Returns the record stored at the given position (AoS layout only).
+ *
+ * @param index Row position, must be below student_count.
+ * @return Pointer to the record; it stays valid until the next change
+ * to the store or store_reset().
+ */
+StudentRow *student_at(size_t index) {
+    return &student_database.chunks[index >> STUDENT_CHUNK_SHIFT].rows[index & STUDENT_CHUNK_MASK];
+}
+
+/**
+ * @brief Returns the ID of the student at the given position.
+ */
+int student_id(size_t index) {
+    const StudentChunk *chunk = &student_database.chunks[index >> STUDENT_CHUNK_SHIFT];
+    if (student_database.layout == LAYOUT_SOA) {
+        return chunk->ids[index & STUDENT_CHUNK_MASK];
+    }
+    return chunk->rows[index & STUDENT_CHUNK_MASK].id;
+}
+
+/**
+ * @brief Returns the score of the student at the given position.
+ */
+double student_score(size_t index) {
+    const StudentChunk *chunk = &student_database.chunks[index >> STUDENT_CHUNK_SHIFT];
+    if (student_database.layout == LAYOUT_SOA) {
+        return chunk->scores[index & STUDENT_CHUNK_MASK];
+    }
+    return chunk->rows[index & STUDENT_CHUNK_MASK].score;
+}
+
+/**
+ * @brief Returns the name of the student at the given position.
+ */
+const char *student_name(size_t index) {
+    const StudentChunk *chunk = &student_database.chunks[index >> STUDENT_CHUNK_SHIFT];
+    if (student_database.layout == LAYOUT_SOA) {
+        return student_database.names + chunk->name_offsets[index & STUDENT_CHUNK_MASK];
+    }
+    return student_database.names + chunk->rows[index & STUDENT_CHUNK_MASK].name;
+}
+
+/**
+ * @brief Tells whether a row of a chunk carries a tombstone.
+ *
+ * @param dead The chunk's tombstone bitmap, or NULL.
+ * @param offset Position of the row within the chunk.
+ */
+int tombstone_test(const uint64_t *dead, size_t offset) {
+    return dead != NULL && ((__atomic_load_n(&dead[offset >> 6], __ATOMIC_RELAXED) >> (offset & 63)) & 1);
+}
+
+/**
+ * @brief Measures the run of rows from 'offset' that are all deleted or
+ * all live, like the row at 'offset', a bitmap word at a time.
+ *
+ * @param end Offset within the chunk at which the run is cut off.
+ * @return Length of the run (at least 1 if offset < end).
+ */
+size_t tombstone_run(const uint64_t *dead, size_t offset, size_t end) {
+    uint64_t flip = tombstone_test(dead, offset) ? ~0ull : 0; // makes rows in the other state 1 bits
+    uint64_t word = (__atomic_load_n(&dead[offset >> 6], __ATOMIC_RELAXED) ^ flip) >> (offset & 63);
+    size_t i;
+    if (word != 0) {
+        i = offset + (size_t)__builtin_ctzll(word);
+    } else {
+        for (i = (offset | 63) + 1; i < end; i += 64) {
+            word = __atomic_load_n(&dead[i >> 6], __ATOMIC_RELAXED) ^ flip;
+            if (word != 0) {
+                i += (size_t)__builtin_ctzll(word);
+                break;
+            }
+        }
+    }
+    return (i < end ? i : end) - offset;
+}
+
+/**
+ * @brief Tells whether the student at the given position was deleted.
+ */
+int student_dead(size_t index) {
+    return tombstone_test(student_database.chunks[index >> STUDENT_CHUNK_SHIFT].dead, index & STUDENT_CHUNK_MASK);
+}
+
+/**
+ * @brief Returns the number of students, not counting deleted rows.
+ */
+size_t store_live_count() {
+    return student_count - student_database.dead_rows;
+}
+
+/**
+ * @brief Exposes a run of scores that lie in one chunk.
+ *
+ * Lets scans walk the score column without going through per-row accessors.
+ * In the SoA layout the run is contiguous (stride 1); in the AoS layout the
+ * stride skips over the rest of each StudentRow. A run also ends where
+ * deleted rows begin or end; a run of deleted rows has no scores.
+ * @param start First row of the run.
+ * @param scores Set to the address of the score of row 'start', or to NULL
+ * if the run is made of deleted rows.
+ * @param stride Set to the distance between consecutive scores, in doubles.
+ * @return Number of rows in the run (0 once start reaches student_count).
+ */
+size_t store_score_run(size_t start, const double **scores, size_t *stride) {
+    if (start >= student_count) {
+        return 0;
+    }
+    const StudentChunk *chunk = &student_database.chunks[start >> STUDENT_CHUNK_SHIFT];
+    size_t offset = start & STUDENT_CHUNK_MASK;
+    size_t run = STUDENT_CHUNK_SIZE - offset;
+    if (run > student_count - start) {
+        run = student_count - start;
+    }
+    if (chunk->dead != NULL) {
+        run = tombstone_run(chunk->dead, offset, offset + run);
+        if (tombstone_test(chunk->dead, offset)) {
+            *scores = NULL;
+            *stride = 0;
+            return run;
+        }
+    }
+
+    if (student_database.layout == LAYOUT_SOA) {
+        *scores = &chunk->scores[offset];
+        *stride = 1;
+    } else {
+        *scores = &chunk->rows[offset].score;
+        *stride = sizeof(StudentRow) / sizeof(double);
+    }
+    return run;
+}
+
+/**
+ * @brief Opens a view of the store for a thread other than the writer.
+ *
+ * The reader claims a slot and announces the current epoch in it before
+ * loading anything, so no block it can reach is freed until
+ * store_view_end(). Never waits for the writer.
+ */
+void store_view_begin(StoreView *view) {
+    unsigned int slot = reader_slot_hint;
+    for (unsigned int tries = 1;; tries++) {
+        unsigned long epoch = __atomic_load_n(&store_reclaimer.epoch, __ATOMIC_SEQ_CST);
+        unsigned long expected = 0;
+        if (__atomic_compare_exchange_n(&store_reclaimer.slots[slot].epoch, &expected, epoch, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            break;
+        }
+        slot = (slot + 1) % READER_SLOTS;
+        if (tries % READER_SLOTS == 0) {
+            sched_yield(); // more readers than slots
+        }
+    }
+    reader_slot_hint = slot;
+    view->slot = slot;
+    // a compaction publishes a shorter directory with a smaller count, and
+    // an update a new row with the old one's tombstone; retry until all
+    // three were read outside such a change
+    unsigned long before, after;
+    do {
+        before = __atomic_load_n(&directory_sequence, __ATOMIC_ACQUIRE);
+        view->count = __atomic_load_n(&published_count, __ATOMIC_SEQ_CST);
+        view->deletes = __atomic_load_n(&published_deletes, __ATOMIC_SEQ_CST);
+        view->chunks = __atomic_load_n(&student_database.chunks, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&directory_sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) != 0 || before != after);
+    view->names = __atomic_load_n(&student_database.names, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Closes a view; its pointers must not be used afterwards.
+ */
+void store_view_end(const StoreView *view) {
+    __atomic_store_n(&store_reclaimer.slots[view->slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Tells whether a row of a view's chunk whose tombstone bit was
+ * seen set was deleted before the view opened.
+ */
+int view_tombstone_visible(const StoreView *view, const StudentChunk *chunk, size_t offset) {
+    // the bit was set with release order after the row was stamped
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&chunk->dead_at[offset], __ATOMIC_RELAXED) <= view->deletes;
+}
+
+/**
+ * @brief Tells whether the student at a position below view->count was
+ * deleted before the view opened.
+ */
+int view_student_dead(const StoreView *view, size_t index) {
+    const StudentChunk *chunk = &view->chunks[index >> STUDENT_CHUNK_SHIFT];
+    size_t offset = index & STUDENT_CHUNK_MASK;
+    return tombstone_test(chunk->dead, offset) && view_tombstone_visible(view, chunk, offset);
+}
+
+/**
+ * @brief Returns the ID of the student at a position below view->count.
+ */
+int view_student_id(const StoreView *view, size_t index) {
+    const StudentChunk *chunk = &view->chunks[index >> STUDENT_CHUNK_SHIFT];
+    if (student_database.layout == LAYOUT_SOA) {
+        return chunk->ids[index & STUDENT_CHUNK_MASK];
+    }
+    return chunk->rows[index & STUDENT_CHUNK_MASK].id;
+}
+
+/**
+ * @brief Returns the score of the student at a position below view->count.
+ */
+double view_student_score(const StoreView *view, size_t index) {
+    const StudentChunk *chunk = &view->chunks[index >> STUDENT_CHUNK_SHIFT];
+    if (student_database.layout == LAYOUT_SOA) {
+        return chunk->scores[index & STUDENT_CHUNK_MASK];
+    }
+    return chunk->rows[index & STUDENT_CHUNK_MASK].score;
+}
+
+/**
+ * @brief Returns the name of the student at a position below view->count.
+ */
+const char *view_student_name(const StoreView *view, size_t index) {
+    const StudentChunk *chunk = &view->chunks[index >> STUDENT_CHUNK_SHIFT];
+    if (student_database.layout == LAYOUT_SOA) {
+        return view->names + chunk->name_offsets[index & STUDENT_CHUNK_MASK];
+    }
+    return view->names + chunk->rows[index & STUDENT_CHUNK_MASK].name;
+}
+
+/**
+ * @brief Feeds the scores of the live rows in a view through the
+ * statistics kernel, one chunk (or run between deleted rows) at a time.
+ */
+void store_view_stats(const StoreView *view, StatsAccumulator *acc) {
+    StatsKernel kernel = select_stats_kernel();
+    for (size_t start = 0; start < view->count; start += STUDENT_CHUNK_SIZE) {
+        const StudentChunk *chunk = &view->chunks[start >> STUDENT_CHUNK_SHIFT];
+        const uint64_t *dead = chunk->dead;
+        size_t end = view->count - start < STUDENT_CHUNK_SIZE ? view->count - start : STUDENT_CHUNK_SIZE;
+        size_t run;
+        for (size_t i = 0; i < end; i += run) {
+            run = dead != NULL ? tombstone_run(dead, i, end) : end;
+            if (tombstone_test(dead, i)) {
+                // rows deleted since the view opened still count; the run
+                // may have been measured across such a delete, so each row's
+                // bit is tested again
+                for (size_t j = i; j < i + run; j++) {
+                    if (tombstone_test(dead, j) && view_tombstone_visible(view, chunk, j)) {
+                        continue;
+                    }
+                    if (student_database.layout == LAYOUT_SOA) {
+                        kernel(acc, &chunk->scores[j], 1, 1);
+                    } else {
+                        kernel(acc, &chunk->rows[j].score, 1, sizeof(StudentRow) / sizeof(double));
+                    }
+                }
+                continue;
+            }
+            if (student_database.layout == LAYOUT_SOA) {
+                kernel(acc, &chunk->scores[i], run, 1);
+            } else {
+                kernel(acc, &chunk->rows[i].score, run, sizeof(StudentRow) / sizeof(double));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Makes every row stored and every delete made so far visible to
+ * new views, and frees retired blocks whose readers have left.
+ *
+ * Appends alone only move the row count; once there are deletes to
+ * publish, the count and the delete number are changed together under
+ * the sequence lock, so a view never sees half of an update.
+ */
+void store_publish() {
+    if (published_deletes == delete_sequence) {
+        __atomic_store_n(&published_count, student_count, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&directory_sequence, directory_sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&published_count, student_count, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&published_deletes, delete_sequence, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&directory_sequence, directory_sequence + 1, __ATOMIC_RELEASE);
+    }
+    if (store_reclaimer.retired_count > 0) {
+        store_reclaim();
+    }
+}
+
+/**
+ * @brief Returns the oldest epoch announced by an open view, or ULONG_MAX
+ * if there is none.
+ */
+unsigned long store_oldest_reader() {
+    unsigned long oldest = ULONG_MAX;
+    for (size_t i = 0; i < READER_SLOTS; i++) {
+        unsigned long epoch = __atomic_load_n(&store_reclaimer.slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief Hands a block the writer has replaced (and already unpublished)
+ * to the reclaimer.
+ *
+ * Views opened from now on announce a later epoch and cannot reach the
+ * block, so it is freed once every view announcing this epoch or an
+ * earlier one has closed. If the list of retired blocks cannot grow, the
+ * writer waits for those views instead.
+ */
+void store_retire(void *block) {
+    if (block == NULL) {
+        return;
+    }
+    unsigned long epoch = __atomic_fetch_add(&store_reclaimer.epoch, 1, __ATOMIC_SEQ_CST);
+    if (store_reclaimer.retired_count == store_reclaimer.retired_capacity) {
+        size_t new_capacity = store_reclaimer.retired_capacity ? store_reclaimer.retired_capacity * 2 : 16;
+        RetiredBlock *grown = realloc(store_reclaimer.retired, new_capacity * sizeof(RetiredBlock));
+        if (grown == NULL) {
+            while (store_oldest_reader() <= epoch) {
+                sched_yield();
+            }
+            free(block);
+            return;
+        }
+        store_reclaimer.retired = grown;
+        store_reclaimer.retired_capacity = new_capacity;
+    }
+    store_reclaimer.retired[store_reclaimer.retired_count].block = block;
+    store_reclaimer.retired[store_reclaimer.retired_count].epoch = epoch;
+    store_reclaimer.retired_count++;
+    store_reclaim();
+}
+
+/**
+ * @brief Frees the retired blocks no open view can reach any more.
+ */
+void store_reclaim() {
+    unsigned long oldest = store_oldest_reader();
+    size_t kept = 0;
+    for (size_t i = 0; i < store_reclaimer.retired_count; i++) {
+        if (store_reclaimer.retired[i].epoch < oldest) {
+            free(store_reclaimer.retired[i].block);
+        } else {
+            store_reclaimer.retired[kept++] = store_reclaimer.retired[i];
+        }
+    }
+    store_reclaimer.retired_count = kept;
+}
+
+/**
+ * @brief Allocates the arrays of a new chunk for the active layout.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int store_alloc_chunk(StudentChunk *chunk) {
+    memset(chunk, 0, sizeof(*chunk));
+    if (student_database.layout == LAYOUT_AOS) {
+        chunk->rows = malloc(STUDENT_CHUNK_SIZE * sizeof(StudentRow));
+        return chunk->rows != NULL;
+    }
+
+    chunk->ids = malloc(STUDENT_CHUNK_SIZE * sizeof(int));
+    chunk->scores = malloc(STUDENT_CHUNK_SIZE * sizeof(double));
+    chunk->name_offsets = malloc(STUDENT_CHUNK_SIZE * sizeof(unsigned int));
+    if (chunk->ids == NULL || chunk->scores == NULL || chunk->name_offsets == NULL) {
+        free(chunk->ids);
+        free(chunk->scores);
+        free(chunk->name_offsets);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Makes room for len bytes at the end of the name arena.
+ *
+ * @return The free space (a name written there is not stored until
+ * name_intern_tail() is called), or NULL if memory is exhausted.
+ */
+char *name_arena_tail(size_t len) {
+    // A mapped arena cannot grow in place; it is copied to the heap on the
+    // first insert after loading a snapshot
+    if (student_database.names_mapped) {
+        char *copy = malloc(student_database.names_used + len);
+        if (copy == NULL) {
+            return NULL;
+        }
+        memcpy(copy, student_database.names, student_database.names_used);
+        __atomic_store_n(&student_database.names, copy, __ATOMIC_SEQ_CST); // the mapping outlives views
+        student_database.names_capacity = student_database.names_used + len;
+        student_database.names_mapped = 0;
+    }
+
+    if (student_database.names_used + len > student_database.names_capacity) {
+        size_t new_capacity = student_database.names_capacity ? student_database.names_capacity * 2 : 1 << 16;
+        while (new_capacity < student_database.names_used + len) {
+            new_capacity *= 2;
+        }
+        if (new_capacity > 0xFFFFFFFFu) {
+            new_capacity = 0xFFFFFFFFu; // offsets are 32-bit
+            if (student_database.names_used + len > new_capacity) {
+                return NULL;
+            }
+        }
+        // copied and retired like the chunk directory, for open views
+        char *new_names = malloc(new_capacity);
+        if (new_names == NULL) {
+            return NULL;
+        }
+        char *old_names = student_database.names;
+        if (old_names != NULL) {
+            memcpy(new_names, old_names, student_database.names_used);
+        }
+        __atomic_store_n(&student_database.names, new_names, __ATOMIC_SEQ_CST);
+        student_database.names_capacity = new_capacity;
+        store_retire(old_names);
+    }
+    return student_database.names + student_database.names_used;
+}
+
+/**
+ * @brief Grows the intern table so that 'extra' more names fit below the
+ * 70% load limit.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int name_table_reserve(size_t extra) {
+    size_t needed = name_table.used + extra;
+    if (needed * 10 <= name_table.capacity * 7) {
+        return 1;
+    }
+
+    size_t new_capacity = name_table.capacity ? name_table.capacity * 2 : 1024;
+    while (needed * 10 > new_capacity * 7) {
+        new_capacity *= 2;
+    }
+    NameSlot *new_slots = malloc(new_capacity * sizeof(NameSlot));
+    if (new_slots == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < new_capacity; i++) {
+        new_slots[i].offset = NO_NAME;
+    }
+    for (size_t i = 0; i < name_table.capacity; i++) {
+        if (name_table.slots[i].offset != NO_NAME) {
+            size_t j = name_table.slots[i].hash & (new_capacity - 1);
+            while (new_slots[j].offset != NO_NAME) {
+                j = (j + 1) & (new_capacity - 1);
+            }
+            new_slots[j] = name_table.slots[i];
+        }
+    }
+    free(name_table.slots);
+    name_table.slots = new_slots;
+    name_table.capacity = new_capacity;
+    return 1;
+}
+
+/**
+ * @brief Adds an arena offset to the intern table.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int name_table_insert(uint32_t hash, unsigned int offset) {
+    if (!name_table_reserve(1)) {
+        return 0;
+    }
+
+    size_t i = hash & (name_table.capacity - 1);
+    while (name_table.slots[i].offset != NO_NAME) {
+        i = (i + 1) & (name_table.capacity - 1);
+    }
+    name_table.slots[i].hash = hash;
+    name_table.slots[i].offset = offset;
+    name_table.used++;
+    return 1;
+}
+
+/**
+ * @brief Fills the intern table from the names already in the arena.
+ *
+ * Used after a snapshot load. Snapshots written before names were interned
+ * may hold repeats; only the first copy of each name is entered.
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int name_table_rebuild() {
+    name_table_reset();
+    const char *names = student_database.names;
+    size_t offset = 0;
+    while (offset < student_database.names_used) {
+        size_t len = strlen(names + offset);
+        uint32_t hash = fnv1a((const unsigned char *)names + offset, len);
+        int seen = 0;
+        for (size_t i = name_table.capacity ? hash & (name_table.capacity - 1) : 0;
+             name_table.capacity && name_table.slots[i].offset != NO_NAME;
+             i = (i + 1) & (name_table.capacity - 1)) {
+            if (name_table.slots[i].hash == hash &&
+                strcmp(names + name_table.slots[i].offset, names + offset) == 0) {
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen && !name_table_insert(hash, (unsigned int)offset)) {
+            return 0;
+        }
+        offset += len + 1;
+    }
+    name_table.stale = 0;
+    return 1;
+}
+
+/**
+ * @brief Interns the NUL-terminated name written at name_arena_tail().
+ *
+ * If the name is already in the arena the tail is left unused and the
+ * existing copy is returned; otherwise the tail becomes part of the arena.
+ * @return Offset of the interned name, or -1 if memory is exhausted.
+ */
+long name_intern_tail() {
+    if (name_table.stale && !name_table_rebuild()) {
+        return -1;
+    }
+    const char *name = student_database.names + student_database.names_used;
+    size_t len = strlen(name);
+    uint32_t hash = fnv1a((const unsigned char *)name, len);
+    if (name_table.capacity > 0) {
+        for (size_t i = hash & (name_table.capacity - 1); name_table.slots[i].offset != NO_NAME;
+             i = (i + 1) & (name_table.capacity - 1)) {
+            const char *stored = student_database.names + name_table.slots[i].offset;
+            if (name_table.slots[i].hash == hash && memcmp(stored, name, len + 1) == 0) {
+                return (long)name_table.slots[i].offset;
+            }
+        }
+    }
+
+    unsigned int offset = (unsigned int)student_database.names_used;
+    if (!name_table_insert(hash, offset)) {
+        return -1;
+    }
+    student_database.names_used += len + 1;
+    return (long)offset;
+}
+
+/**
+ * @brief Stores a name in the arena unless an identical one is there.
+ *
+ * @return Offset of the interned name, or -1 if memory is exhausted.
+ */
+long name_intern(const char *name) {
+    size_t len = strlen(name) + 1;
+    char *tail = name_arena_tail(len);
+    if (tail == NULL) {
+        return -1;
+    }
+    memcpy(tail, name, len);
+    return name_intern_tail();
+}
+
+/**
+ * @brief Empties the intern table (the arena itself is left alone).
+ */
+void name_table_reset() {
+    free(name_table.slots);
+    name_table.slots = NULL;
+    name_table.capacity = 0;
+    name_table.used = 0;
+    name_table.stale = 0;
+}
+
+/**
+ * @brief Lower-cases an ASCII letter; other bytes are returned unchanged.
+ */
+unsigned char trie_fold(char c) {
+    return (unsigned char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+/**
+ * @brief Makes sure a name of the given length can be added for the given
+ * row without allocating, so the insert itself cannot fail half-way.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int name_trie_reserve(size_t name_length, size_t row) {
+    if (name_trie.nodes == NULL || name_trie.node_count + name_length > name_trie.node_capacity) {
+        size_t new_capacity = name_trie.node_capacity ? name_trie.node_capacity * 2 : 4096;
+        while (new_capacity < name_trie.node_count + name_length + 1) {
+            new_capacity *= 2;
+        }
+        TrieNode *new_nodes = realloc(name_trie.nodes, new_capacity * sizeof(TrieNode));
+        if (new_nodes == NULL) {
+            return 0;
+        }
+        name_trie.nodes = new_nodes;
+        name_trie.node_capacity = new_capacity;
+        if (name_trie.node_count == 0) {
+            memset(&name_trie.nodes[0], 0, sizeof(TrieNode)); // the root
+            name_trie.nodes[0].first_row = NO_TRIE_ROW;
+            name_trie.nodes[0].last_row = NO_TRIE_ROW;
+            name_trie.node_count = 1;
+        }
+    }
+    if (row >= name_trie.row_capacity) {
+        size_t new_capacity = name_trie.row_capacity ? name_trie.row_capacity * 2 : STUDENT_CHUNK_SIZE;
+        while (new_capacity <= row) {
+            new_capacity *= 2;
+        }
+        unsigned int *new_next = realloc(name_trie.next_row, new_capacity * sizeof(unsigned int));
+        if (new_next == NULL) {
+            return 0;
+        }
+        name_trie.next_row = new_next;
+        name_trie.row_capacity = new_capacity;
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns the child of 'node' with the given label, creating it in
+ * label order if needed. Room must have been reserved beforehand.
+ */
+unsigned int name_trie_child(unsigned int node, unsigned char label) {
+    TrieNode *nodes = name_trie.nodes;
+    unsigned int prev = 0;
+    unsigned int next = nodes[node].child;
+    while (next != 0 && nodes[next].label < label) {
+        prev = next;
+        next = nodes[next].sibling;
+    }
+    if (next != 0 && nodes[next].label == label) {
+        return next;
+    }
+
+    unsigned int created = (unsigned int)name_trie.node_count++;
+    nodes[created].child = 0;
+    nodes[created].sibling = next;
+    nodes[created].first_row = NO_TRIE_ROW;
+    nodes[created].last_row = NO_TRIE_ROW;
+    nodes[created].label = label;
+    if (prev == 0) {
+        nodes[node].child = created;
+    } else {
+        nodes[prev].sibling = created;
+    }
+    return created;
+}
+
+/**
+ * @brief Adds a row under its name. name_trie_reserve() must have
+ * succeeded for this name and row.
+ */
+void name_trie_add(const char *name, size_t row) {
+    unsigned int node = 0;
+    for (size_t i = 0; name[i] != '\0' && i < MAX_NAME_LENGTH - 1; i++) {
+        node = name_trie_child(node, trie_fold(name[i]));
+    }
+    TrieNode *end = &name_trie.nodes[node];
+    name_trie.next_row[row] = NO_TRIE_ROW;
+    if (end->first_row == NO_TRIE_ROW) {
+        end->first_row = (unsigned int)row;
+    } else {
+        name_trie.next_row[end->last_row] = (unsigned int)row;
+    }
+    end->last_row = (unsigned int)row;
+}
+
+/**
+ * @brief Unlinks a (deleted or replaced) row from the chain of its name.
+ * Rows sharing a name are few, so the chain is simply walked.
+ */
+void name_trie_remove(const char *name, size_t row) {
+    TrieNode *nodes = name_trie.nodes;
+    unsigned int node = 0;
+    for (size_t i = 0; name[i] != '\0' && i < MAX_NAME_LENGTH - 1; i++) {
+        unsigned char label = trie_fold(name[i]);
+        node = nodes[node].child;
+        while (node != 0 && nodes[node].label != label) {
+            node = nodes[node].sibling;
+        }
+        if (node == 0) {
+            return;
+        }
+    }
+    TrieNode *end = &nodes[node];
+    unsigned int prev = NO_TRIE_ROW;
+    for (unsigned int r = end->first_row; r != NO_TRIE_ROW; prev = r, r = name_trie.next_row[r]) {
+        if (r != row) {
+            continue;
+        }
+        if (prev == NO_TRIE_ROW) {
+            end->first_row = name_trie.next_row[r];
+        } else {
+            name_trie.next_row[prev] = name_trie.next_row[r];
+        }
+        if (end->last_row == r) {
+            end->last_row = prev;
+        }
+        return;
+    }
+}
+
+/**
+ * @brief Builds the trie from every row in the store (after a snapshot
+ * load).
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int name_trie_rebuild() {
+    name_trie_reset();
+    for (size_t i = 0; i < student_count; i++) {
+        if (student_dead(i)) {
+            continue;
+        }
+        const char *name = student_name(i);
+        size_t len = strlen(name);
+        if (!name_trie_reserve(len, i)) {
+            name_trie.stale = 1;
+            return 0;
+        }
+        name_trie_add(name, i);
+    }
+    return 1;
+}
+
+/**
+ * @brief Finds up to 'limit' rows whose name starts with 'prefix'
+ * (ignoring ASCII case), in name order and, for equal names, insertion
+ * order.
+ *
+ * @return Number of rows written to 'rows'.
+ */
+size_t name_trie_search(const char *prefix, size_t *rows, size_t limit) {
+    if (name_trie.node_count == 0 || limit == 0) {
+        return 0;
+    }
+    const TrieNode *nodes = name_trie.nodes;
+    unsigned int start = 0;
+    for (size_t i = 0; prefix[i] != '\0'; i++) {
+        unsigned char label = trie_fold(prefix[i]);
+        unsigned int next = nodes[start].child;
+        while (next != 0 && nodes[next].label < label) {
+            next = nodes[next].sibling;
+        }
+        if (next == 0 || nodes[next].label != label) {
+            return 0;
+        }
+        start = next;
+    }
+
+    // Pre-order walk; each level leaves at most one sibling on the stack
+    unsigned int stack[MAX_NAME_LENGTH + 2];
+    size_t depth = 0, found = 0;
+    stack[depth++] = start;
+    while (depth > 0 && found < limit) {
+        unsigned int node = stack[--depth];
+        for (unsigned int row = nodes[node].first_row; row != NO_TRIE_ROW && found < limit;
+             row = name_trie.next_row[row]) {
+            rows[found++] = row;
+        }
+        if (node != start && nodes[node].sibling != 0) {
+            stack[depth++] = nodes[node].sibling;
+        }
+        if (nodes[node].child != 0) {
+            stack[depth++] = nodes[node].child;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Frees the name trie.
+ */
+void name_trie_reset() {
+    free(name_trie.nodes);
+    free(name_trie.next_row);
+    name_trie.nodes = NULL;
+    name_trie.node_count = 0;
+    name_trie.node_capacity = 0;
+    name_trie.next_row = NULL;
+    name_trie.row_capacity = 0;
+    name_trie.stale = 0;
+}
+
+/**
+ * @brief Copies a record into the next free row of the store.
+ *
+ * The name is interned first; see store_insert() for the rest.
+ * @param student The record to store.
+ * @return STORE_OK, STORE_DUPLICATE_ID, STORE_NO_MEMORY or STORE_IO_ERROR.
+ */
+StoreStatus store_append(const Student *student) {
+    if (!store_ensure_indexes() || !id_index_reserve(1)) {
+        return STORE_NO_MEMORY;
+    }
+    if (id_index_find(student->id) != NO_ROW) {
+        return STORE_DUPLICATE_ID; // checked first so a rejected name is not interned
+    }
+    long name = name_intern(student->name);
+    if (name < 0) {
+        return STORE_NO_MEMORY;
+    }
+    return store_insert(student->id, (unsigned int)name, student->score);
+}
+
+/**
+ * @brief Stores a record whose name is already interned.
+ *
+ * A new arena chunk is allocated only when the last one is full, so the
+ * cost of growing is one allocation per STUDENT_CHUNK_SIZE records and
+ * existing records are never copied. The ID and score indexes are updated
+ * as part of the insert, and a record whose ID is already present is
+ * rejected. When a write-ahead log is open the record is logged before it
+ * becomes visible, and refused if the log fails.
+ * @param name Offset of the name in the arena, from name_intern().
+ * @return STORE_OK, STORE_DUPLICATE_ID, STORE_NO_MEMORY or STORE_IO_ERROR.
+ */
+StoreStatus store_insert(int id, unsigned int name, double score) {
+    return store_put(id, name, score, 0);
+}
+
+/**
+ * @brief Replaces the name and score of an existing student.
+ *
+ * The new version is appended as a fresh row and the old row is
+ * tombstoned; store_publish() then makes the row and the tombstone visible
+ * to views together, so a view sees exactly one of the two versions.
+ * @return STORE_OK, STORE_NOT_FOUND, STORE_NO_MEMORY or STORE_IO_ERROR.
+ */
+StoreStatus store_update(const Student *student) {
+    if (!store_ensure_indexes()) {
+        return STORE_NO_MEMORY;
+    }
+    if (id_index_find(student->id) == NO_ROW) {
+        return STORE_NOT_FOUND; // checked first so a rejected name is not interned
+    }
+    long name = name_intern(student->name);
+    if (name < 0) {
+        return STORE_NO_MEMORY;
+    }
+    return store_put(student->id, (unsigned int)name, student->score, 1);
+}
+
+/**
+ * @brief Does the work of store_insert() and store_update().
+ *
+ * Everything that can fail, logging the change included, is done before
+ * the old row is tombstoned, so running out of memory or a failed log
+ * leaves the student as it was.
+ * @param replace Nonzero to replace the row holding 'id', zero to add one.
+ * @return STORE_OK, STORE_DUPLICATE_ID, STORE_NOT_FOUND, STORE_NO_MEMORY or
+ * STORE_IO_ERROR.
+ */
+StoreStatus store_put(int id, unsigned int name, double score, int replace) {
+    if (!store_ensure_indexes() || !id_index_reserve(1)) {
+        return STORE_NO_MEMORY;
+    }
+    // one probe both checks the ID and finds its slot
+    IdIndexSlot *id_slot = id_index_probe(id);
+    size_t old_row = id_slot->row;
+    if (!replace && old_row != NO_ROW) {
+        return STORE_DUPLICATE_ID;
+    }
+    if (replace && old_row == NO_ROW) {
+        return STORE_NOT_FOUND;
+    }
+    if (replace && !store_reserve_tombstone(old_row)) {
+        return STORE_NO_MEMORY;
+    }
+    const char *name_text = student_database.names + name;
+    if (!name_trie.stale && !name_trie_reserve(strlen(name_text), student_count)) {
+        return STORE_NO_MEMORY;
+    }
+
+    if (!store_push_row(id, name, score)) {
+        return STORE_NO_MEMORY;
+    }
+    size_t row = student_count - 1;
+    if (!score_index_deferred && !score_index_insert(score, row)) {
+        student_count--;
+        return STORE_NO_MEMORY;
+    }
+    // the row is not published yet, so a refused record can still be undone
+    if (wal.fd >= 0 && !wal_replaying &&
+        !wal_log_record(replace ? WAL_RECORD_UPDATE : WAL_RECORD_ADD, id, name_text, score)) {
+        if (!score_index_deferred) {
+            score_index_remove(score, row);
+        }
+        student_count--;
+        return STORE_IO_ERROR;
+    }
+    // the totals take the new score first so they match the index again
+    // when the old row leaves both
+    aggregates_add(score);
+    if (replace) {
+        // views ignore this tombstone until it is published with the new row
+        store_tombstone(old_row);
+    } else {
+        student_id_index.used++;
+    }
+    id_slot->id = id;
+    id_slot->row = row;
+    if (!name_trie.stale) {
+        name_trie_add(name_text, row);
+    }
+    ThreadStats *ts = thread_stats_get();
+    if (ts != NULL) {
+        stat_add(replace ? &ts->records_updated : &ts->records_added, 1);
+    }
+    store_publish();
+    if (replace) {
+        store_maybe_compact();
+    }
+    return STORE_OK;
+}
+
+/**
+ * @brief Deletes a student by ID.
+ *
+ * The row is tombstoned in place and dropped from every index; its space
+ * is reclaimed by a later compaction. With a write-ahead log open the
+ * delete is logged first and refused if the log fails.
+ * @return STORE_OK, STORE_NOT_FOUND, STORE_NO_MEMORY or STORE_IO_ERROR.
+ */
+StoreStatus store_delete(int id) {
+    if (!store_ensure_indexes()) {
+        return STORE_NO_MEMORY;
+    }
+    size_t row = id_index_find(id);
+    if (row == NO_ROW) {
+        return STORE_NOT_FOUND;
+    }
+    if (!store_reserve_tombstone(row)) {
+        return STORE_NO_MEMORY;
+    }
+    if (wal.fd >= 0 && !wal_replaying && !wal_log_record(WAL_RECORD_DELETE, id, NULL, 0.0)) {
+        return STORE_IO_ERROR;
+    }
+    store_tombstone(row);
+    id_index_erase(id_index_probe(id));
+    ThreadStats *ts = thread_stats_get();
+    if (ts != NULL) {
+        stat_add(&ts->records_deleted, 1);
+    }
+    store_publish();
+    store_maybe_compact();
+    return STORE_OK;
+}
+
+/**
+ * @brief Allocates the tombstone bitmap of a row's chunk if it has none.
+ *
+ * Views keep using the directory they opened with, so the bitmap and its
+ * stamps are attached to a copy of the directory that is then published,
+ * and the old one is retired. Only the pointers of a published entry are
+ * fixed: store_tombstone() still sets bits, stamps and dead_count through
+ * it, and views ignore the tombstones numbered above their horizon (see
+ * StoreView). This happens at most once per chunk between compactions.
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int store_reserve_tombstone(size_t row) {
+    size_t index = row >> STUDENT_CHUNK_SHIFT;
+    if (student_database.chunks[index].dead != NULL) {
+        return 1;
+    }
+    uint64_t *dead = calloc(STUDENT_CHUNK_SIZE / 64, sizeof(uint64_t));
+    unsigned long long *dead_at = malloc(STUDENT_CHUNK_SIZE * sizeof(unsigned long long));
+    StudentChunk *new_chunks = malloc(student_database.chunk_capacity * sizeof(StudentChunk));
+    if (dead == NULL || dead_at == NULL || new_chunks == NULL) {
+        free(dead);
+        free(dead_at);
+        free(new_chunks);
+        return 0;
+    }
+    StudentChunk *old_chunks = student_database.chunks;
+    memcpy(new_chunks, old_chunks, student_database.chunk_count * sizeof(StudentChunk));
+    new_chunks[index].dead = dead;
+    new_chunks[index].dead_at = dead_at;
+    __atomic_store_n(&student_database.chunks, new_chunks, __ATOMIC_SEQ_CST);
+    store_retire(old_chunks);
+    return 1;
+}
+
+/**
+ * @brief Marks a row as deleted and takes it out of the score index, the
+ * name trie and the running totals. The ID index is left to the caller;
+ * store_reserve_tombstone() must have succeeded for the row.
+ */
+void store_tombstone(size_t row) {
+    StudentChunk *chunk = &student_database.chunks[row >> STUDENT_CHUNK_SHIFT];
+    size_t offset = row & STUDENT_CHUNK_MASK;
+    double score = student_score(row);
+    score_index_remove(score, row);
+    if (!name_trie.stale) {
+        name_trie_remove(student_name(row), row);
+    }
+    aggregates_remove(score);
+    // the stamp is stored before the bit, so a view that sees the bit sees it
+    __atomic_store_n(&chunk->dead_at[offset], ++delete_sequence, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&chunk->dead[offset >> 6], 1ull << (offset & 63), __ATOMIC_RELEASE);
+    chunk->dead_count++;
+    student_database.dead_rows++;
+}
+
+/**
+ * @brief Starts a background compaction once deleted rows make up
+ * compact_threshold of the store, and swaps a finished one in.
+ *
+ * Called after each change, so the writer never waits for the copy: a
+ * compaction that is still copying is left alone, and one that ran out of
+ * memory is dropped and simply started again later. A compaction that
+ * cannot get a thread is done in place, as before.
+ */
+void store_maybe_compact() {
+    if (compact_job.running) {
+        if (__atomic_load_n(&compact_job.done, __ATOMIC_ACQUIRE)) {
+            compact_collect(&compact_job);
+        }
+        return;
+    }
+    if (student_database.dead_rows == 0 || student_database.dead_rows < compact_threshold * student_count ||
+        !compact_begin(&compact_job)) {
+        return;
+    }
+    if (pthread_create(&compact_job.thread, NULL, compact_main, &compact_job) == 0) {
+        compact_job.threaded = 1;
+    } else {
+        compact_copy(&compact_job, 1);
+        compact_collect(&compact_job);
+    }
+}
+
+/**
+ * @brief Takes the writer's picture of the store for a compaction: a copy
+ * of the chunk directory and of every tombstone bitmap, and where the live
+ * rows of each chunk will land.
+ *
+ * @return 1 on success, 0 if memory is exhausted (no job is started).
+ */
+int compact_begin(CompactJob *job) {
+    size_t old_count = student_database.chunk_count;
+    memset(job, 0, sizeof(*job));
+    job->old_chunks = malloc((old_count ? old_count : 1) * sizeof(StudentChunk));
+    job->first_row = malloc((old_count ? old_count : 1) * sizeof(size_t));
+    if (job->old_chunks == NULL || job->first_row == NULL) {
+        free(job->old_chunks);
+        free(job->first_row);
+        return 0;
+    }
+    job->running = 1;
+    job->old_count = old_count;
+    job->row_count = student_count;
+    job->build_indexes = !indexes_stale && !score_index_deferred;
+
+    size_t next = 0;
+    for (size_t c = 0; c < old_count; c++) {
+        const StudentChunk *chunk = &student_database.chunks[c];
+        size_t rows = student_count - (c << STUDENT_CHUNK_SHIFT);
+        job->old_chunks[c] = *chunk;
+        job->old_chunks[c].dead = NULL;
+        job->old_chunks[c].dead_at = NULL;
+        job->first_row[c] = next;
+        next += (rows < STUDENT_CHUNK_SIZE ? rows : STUDENT_CHUNK_SIZE) - chunk->dead_count;
+        if (chunk->dead != NULL) {
+            job->old_chunks[c].dead = malloc(STUDENT_CHUNK_SIZE / 64 * sizeof(uint64_t));
+            if (job->old_chunks[c].dead == NULL) {
+                job->old_count = c;
+                compact_discard(job);
+                return 0;
+            }
+            memcpy(job->old_chunks[c].dead, chunk->dead, STUDENT_CHUNK_SIZE / 64 * sizeof(uint64_t));
+        }
+    }
+    job->live = next;
+    return 1;
+}
+
+/**
+ * @brief Copies the live rows of old chunk 'index' of the picture to their
+ * place in the job's new chunks, a run of live rows at a time.
+ */
+void compact_task(size_t index, void *arg) {
+    const CompactJob *job = arg;
+    const StudentChunk *from = &job->old_chunks[index];
+    size_t start = index << STUDENT_CHUNK_SHIFT;
+    size_t end = job->row_count - start < STUDENT_CHUNK_SIZE ? job->row_count - start : STUDENT_CHUNK_SIZE;
+    size_t to = job->first_row[index];
+    size_t run;
+    for (size_t i = 0; i < end; i += run) {
+        run = from->dead != NULL ? tombstone_run(from->dead, i, end) : end;
+        if (tombstone_test(from->dead, i)) {
+            continue;
+        }
+        // the run may straddle two new chunks
+        for (size_t done = 0; done < run;) {
+            StudentChunk *dest = &job->chunks[to >> STUDENT_CHUNK_SHIFT];
+            size_t at = to & STUDENT_CHUNK_MASK;
+            size_t n = run - done < STUDENT_CHUNK_SIZE - at ? run - done : STUDENT_CHUNK_SIZE - at;
+            size_t src = i + done;
+            if (student_database.layout == LAYOUT_SOA) {
+                memcpy(&dest->ids[at], &from->ids[src], n * sizeof(int));
+                memcpy(&dest->scores[at], &from->scores[src], n * sizeof(double));
+                memcpy(&dest->name_offsets[at], &from->name_offsets[src], n * sizeof(unsigned int));
+            } else {
+                memcpy(&dest->rows[at], &from->rows[src], n * sizeof(StudentRow));
+            }
+            done += n;
+            to += n;
+        }
+    }
+}
+
+/**
+ * @brief Copies the live rows of the picture into fresh chunks and, if the
+ * indexes were current, builds an ID and a score index for them. Sets
+ * job->ok, then job->done.
+ *
+ * Reads only the picture and the row data it points to, which the writer
+ * never changes, so it may run beside the writer. 'parallel' spreads the
+ * copy over the thread pool; only the writer may ask for that.
+ */
+void compact_copy(CompactJob *job, int parallel) {
+    size_t chunk_count = (job->live + STUDENT_CHUNK_SIZE - 1) >> STUDENT_CHUNK_SHIFT;
+    size_t capacity = 16;
+    while (capacity < chunk_count) {
+        capacity *= 2;
+    }
+    job->chunks = calloc(capacity, sizeof(StudentChunk));
+    job->chunk_capacity = job->chunks != NULL ? capacity : 0;
+    while (job->chunks != NULL && job->chunk_count < chunk_count && store_alloc_chunk(&job->chunks[job->chunk_count])) {
+        job->chunk_count++;
+    }
+    int ok = job->chunks != NULL && job->chunk_count == chunk_count;
+    job->count = job->live;
+
+    if (ok && parallel && job->row_count >= pool.threshold && pool.thread_count != 1) {
+        pool_run(job->old_count, compact_task, job);
+    } else {
+        for (size_t c = 0; ok && c < job->old_count; c++) {
+            if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+                ok = 0;
+            } else {
+                compact_task(c, job);
+            }
+        }
+    }
+
+    if (ok && job->build_indexes && job->live > 0) {
+        // IDs of live rows are unique, so each goes into its first free slot
+        size_t id_capacity = 1024;
+        while (job->live * 10 > id_capacity * 7) {
+            id_capacity *= 2;
+        }
+        IdIndexSlot *slots = malloc(id_capacity * sizeof(IdIndexSlot));
+        ScoreEntry *entries = malloc(job->live * sizeof(ScoreEntry));
+        ok = slots != NULL && entries != NULL;
+        for (size_t i = 0; ok && i < id_capacity; i++) {
+            slots[i].row = NO_ROW;
+        }
+        for (size_t row = 0; ok && row < job->live; row++) {
+            const StudentChunk *chunk = &job->chunks[row >> STUDENT_CHUNK_SHIFT];
+            size_t at = row & STUDENT_CHUNK_MASK;
+            int id = student_database.layout == LAYOUT_SOA ? chunk->ids[at] : chunk->rows[at].id;
+            size_t j = id_index_slot(id, id_capacity);
+            while (slots[j].row != NO_ROW) {
+                j = (j + 1) & (id_capacity - 1);
+            }
+            slots[j].id = id;
+            slots[j].row = row;
+            entries[row].score = student_database.layout == LAYOUT_SOA ? chunk->scores[at] : chunk->rows[at].score;
+            entries[row].row = row;
+        }
+        ok = ok && radix_sort_score_entries(entries, job->live) &&
+             score_index_load(&job->score_index, entries, job->live);
+        free(entries);
+        if (ok) {
+            job->id_index.slots = slots;
+            job->id_index.capacity = id_capacity;
+            job->id_index.used = job->live;
+        } else {
+            free(slots);
+        }
+    }
+    job->ok = ok;
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Body of the compaction thread.
+ */
+void *compact_main(void *arg) {
+    compact_copy(arg, 0);
+    return NULL;
+}
+
+/**
+ * @brief Appends a row of the live store to the end of the job's new
+ * chunks, allocating a chunk when the last one is full.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int compact_push(CompactJob *job, const StudentChunk *from, size_t offset) {
+    size_t chunk_index = job->count >> STUDENT_CHUNK_SHIFT;
+    if (chunk_index == job->chunk_count) {
+        if (job->chunk_count == job->chunk_capacity) {
+            // the new directory is not published yet, so it may be reallocated
+            size_t new_capacity = job->chunk_capacity ? job->chunk_capacity * 2 : 16;
+            StudentChunk *chunks = realloc(job->chunks, new_capacity * sizeof(StudentChunk));
+            if (chunks == NULL) {
+                return 0;
+            }
+            job->chunks = chunks;
+            job->chunk_capacity = new_capacity;
+        }
+        if (!store_alloc_chunk(&job->chunks[job->chunk_count])) {
+            return 0;
+        }
+        job->chunk_count++;
+    }
+
+    StudentChunk *dest = &job->chunks[chunk_index];
+    size_t at = job->count & STUDENT_CHUNK_MASK;
+    if (student_database.layout == LAYOUT_SOA) {
+        dest->ids[at] = from->ids[offset];
+        dest->scores[at] = from->scores[offset];
+        dest->name_offsets[at] = from->name_offsets[offset];
+    } else {
+        dest->rows[at] = from->rows[offset];
+    }
+    job->count++;
+    return 1;
+}
+
+/**
+ * @brief Swaps a finished compaction in.
+ *
+ * Rows of the picture deleted since it was taken are tombstoned again at
+ * their new place, and rows appended since are copied after the picture's
+ * live rows, skipping those already deleted. The new directory and row
+ * count are then swapped in under the sequence lock views check, and the
+ * old chunks are retired, so readers are never made to wait. The indexes
+ * built with the copy take the same deletes and appends and replace the
+ * old ones; if they were not built, or an update to them runs out of
+ * memory, the indexes are rebuilt on their next use instead. The name
+ * trie is always rebuilt by the next name search, and the running totals
+ * are unaffected. The writer's pause here grows with the changes made
+ * during the copy, not with the size of the store.
+ * @return 1 on success, 0 if memory is exhausted (the job is dropped and
+ * the store is unchanged).
+ */
+int compact_finish(CompactJob *job) {
+    // deletes since the picture: set bits the picture's copy does not have,
+    // keeping their numbers
+    size_t carried = 0;
+    for (size_t c = 0; c < job->old_count; c++) {
+        const uint64_t *now = student_database.chunks[c].dead;
+        const unsigned long long *now_at = student_database.chunks[c].dead_at;
+        const uint64_t *then = job->old_chunks[c].dead;
+        if (now == NULL) {
+            continue;
+        }
+        size_t rows = job->row_count - (c << STUDENT_CHUNK_SHIFT);
+        rows = rows < STUDENT_CHUNK_SIZE ? rows : STUDENT_CHUNK_SIZE;
+        size_t to = job->first_row[c];
+        for (size_t w = 0; w < (rows + 63) / 64; w++) {
+            uint64_t in_picture = rows - w * 64 >= 64 ? ~0ull : (1ull << (rows - w * 64)) - 1;
+            uint64_t was_dead = then != NULL ? then[w] : 0;
+            uint64_t fresh = now[w] & ~was_dead & in_picture;
+            for (; fresh != 0; fresh &= fresh - 1) {
+                int bit = __builtin_ctzll(fresh);
+                size_t row = to + (size_t)__builtin_popcountll(~was_dead & ((1ull << bit) - 1));
+                StudentChunk *dest = &job->chunks[row >> STUDENT_CHUNK_SHIFT];
+                if (dest->dead == NULL) {
+                    dest->dead = calloc(STUDENT_CHUNK_SIZE / 64, sizeof(uint64_t));
+                    dest->dead_at = malloc(STUDENT_CHUNK_SIZE * sizeof(unsigned long long));
+                    if (dest->dead == NULL || dest->dead_at == NULL) {
+                        compact_discard(job);
+                        return 0;
+                    }
+                }
+                dest->dead[(row & STUDENT_CHUNK_MASK) >> 6] |= 1ull << (row & 63);
+                dest->dead_at[row & STUDENT_CHUNK_MASK] = now_at[w * 64 + (size_t)bit];
+                dest->dead_count++;
+                carried++;
+            }
+            to += (size_t)__builtin_popcountll(~was_dead & in_picture);
+        }
+    }
+    // appends since the picture
+    for (size_t row = job->row_count; row < student_count; row++) {
+        if (!student_dead(row) &&
+            !compact_push(job, &student_database.chunks[row >> STUDENT_CHUNK_SHIFT], row & STUDENT_CHUNK_MASK)) {
+            compact_discard(job);
+            return 0;
+        }
+    }
+
+    // Swap the directory and count under the sequence lock views check
+    StudentChunk *old_chunks = student_database.chunks;
+    size_t old_count = student_database.chunk_count;
+    __atomic_store_n(&directory_sequence, directory_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    student_count = job->count;
+    __atomic_store_n(&published_count, job->count, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&student_database.chunks, job->chunks, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&directory_sequence, directory_sequence + 1, __ATOMIC_RELEASE);
+    student_database.chunk_count = job->chunk_count;
+    student_database.chunk_capacity = job->chunk_capacity;
+    student_database.dead_rows = carried;
+    job->chunks = NULL;
+    job->chunk_count = 0;
+
+    for (size_t c = 0; c < old_count; c++) {
+        if (!old_chunks[c].mapped) {
+            store_retire(old_chunks[c].rows);
+            store_retire(old_chunks[c].ids);
+            store_retire(old_chunks[c].scores);
+            store_retire(old_chunks[c].name_offsets);
+        }
+        store_retire(old_chunks[c].dead);
+        store_retire(old_chunks[c].dead_at);
+    }
+    store_retire(old_chunks);
+    name_trie.stale = 1;
+
+    if (!job->build_indexes || indexes_stale || score_index_deferred) {
+        indexes_stale = 1;
+        compact_discard(job);
+        return 1;
+    }
+    id_index_reset();
+    score_index_reset();
+    student_id_index = job->id_index;
+    student_score_index = job->score_index;
+    job->id_index.slots = NULL;
+    job->score_index.root = NULL;
+    // the only tombstones in the new chunks are the deletes replayed above
+    for (size_t c = 0; c < student_database.chunk_count; c++) {
+        const uint64_t *dead = student_database.chunks[c].dead;
+        for (size_t w = 0; dead != NULL && w < STUDENT_CHUNK_SIZE / 64; w++) {
+            for (uint64_t bits = dead[w]; bits != 0; bits &= bits - 1) {
+                size_t row = (c << STUDENT_CHUNK_SHIFT) + w * 64 + (size_t)__builtin_ctzll(bits);
+                IdIndexSlot *slot = id_index_probe(student_id(row));
+                if (slot->row == row) {
+                    id_index_erase(slot);
+                }
+                score_index_remove(student_score(row), row);
+            }
+        }
+    }
+    for (size_t row = job->live; row < student_count; row++) {
+        if (!id_index_reserve(1) || !score_index_insert(student_score(row), row)) {
+            indexes_stale = 1;
+            break;
+        }
+        IdIndexSlot *slot = id_index_probe(student_id(row));
+        if (slot->row == NO_ROW) {
+            student_id_index.used++;
+        }
+        slot->id = student_id(row);
+        slot->row = row;
+    }
+    compact_discard(job);
+    return 1;
+}
+
+/**
+ * @brief Frees everything a compaction job still owns and marks it idle.
+ */
+void compact_discard(CompactJob *job) {
+    for (size_t c = 0; c < job->old_count; c++) {
+        free(job->old_chunks[c].dead);
+    }
+    for (size_t c = 0; c < job->chunk_count; c++) {
+        free(job->chunks[c].rows);
+        free(job->chunks[c].ids);
+        free(job->chunks[c].scores);
+        free(job->chunks[c].name_offsets);
+        free(job->chunks[c].dead);
+        free(job->chunks[c].dead_at);
+    }
+    free(job->chunks);
+    free(job->old_chunks);
+    free(job->first_row);
+    free(job->id_index.slots);
+    score_node_free(job->score_index.root);
+    memset(job, 0, sizeof(*job));
+}
+
+/**
+ * @brief Waits for a compaction's copy to finish, then swaps it in, or
+ * drops it if the copy ran out of memory or was cancelled.
+ */
+void compact_collect(CompactJob *job) {
+    if (job->threaded) {
+        pthread_join(job->thread, NULL);
+    }
+    if (job->ok) {
+        compact_finish(job);
+    } else {
+        compact_discard(job);
+    }
+}
+
+/**
+ * @brief Reclaims the space of every deleted row now, copying the live
+ * rows, in order, into fresh chunks.
+ *
+ * Used before a snapshot is saved. A background compaction still copying
+ * is waited for and swapped in first; the rest is copied on this thread
+ * and the thread pool.
+ * @return 1 on success, 0 if memory is exhausted (the store is unchanged).
+ */
+int store_compact() {
+    if (compact_job.running) {
+        compact_collect(&compact_job);
+    }
+    if (student_database.dead_rows == 0) {
+        return 1;
+    }
+    if (!compact_begin(&compact_job)) {
+        return 0;
+    }
+    compact_copy(&compact_job, 1);
+    if (!compact_job.ok) {
+        compact_discard(&compact_job);
+        return 0;
+    }
+    return compact_finish(&compact_job);
+}
+
+/**
+ * @brief Writes a record into the next free row, allocating a new chunk
+ * when the last one is full. Indexes are not touched.
+ *
+ * @param name Offset of the (interned) name in the arena.
+ * @return 1 on success (student_count is incremented), 0 if memory is
+ * exhausted.
+ */
+int store_push_row(int id, unsigned int name, double score) {
+    size_t chunk_index = student_count >> STUDENT_CHUNK_SHIFT;
+
+    if (chunk_index == student_database.chunk_count) {
+        if (student_database.chunk_count == student_database.chunk_capacity) {
+            // Views may be reading the old directory, so it is copied and
+            // retired rather than reallocated
+            size_t new_capacity = student_database.chunk_capacity ? student_database.chunk_capacity * 2 : 16;
+            StudentChunk *new_chunks = malloc(new_capacity * sizeof(StudentChunk));
+            if (new_chunks == NULL) {
+                return 0;
+            }
+            StudentChunk *old_chunks = student_database.chunks;
+            if (old_chunks != NULL) {
+                memcpy(new_chunks, old_chunks, student_database.chunk_count * sizeof(StudentChunk));
+            }
+            __atomic_store_n(&student_database.chunks, new_chunks, __ATOMIC_SEQ_CST);
+            student_database.chunk_capacity = new_capacity;
+            store_retire(old_chunks);
+        }
+        if (!store_alloc_chunk(&student_database.chunks[student_database.chunk_count])) {
+            return 0;
+        }
+        student_database.chunk_count++;
+    }
+
+    StudentChunk *chunk = &student_database.chunks[chunk_index];
+    size_t row = student_count & STUDENT_CHUNK_MASK;
+    if (student_database.layout == LAYOUT_SOA) {
+        chunk->ids[row] = id;
+        chunk->scores[row] = score;
+        chunk->name_offsets[row] = name;
+    } else {
+        chunk->rows[row].id = id;
+        chunk->rows[row].name = name;
+        chunk->rows[row].score = score;
+    }
+    student_count++;
+    return 1;
+}
+
+/**
+ * @brief Releases every arena chunk and empties the store.
+ *
+ * The layout is kept so the store can be refilled in the same mode. A
+ * compaction still copying is cancelled first.
+ */
+void store_reset() {
+    if (compact_job.running) {
+        __atomic_store_n(&compact_job.cancel, 1, __ATOMIC_RELAXED);
+        if (compact_job.threaded) {
+            pthread_join(compact_job.thread, NULL);
+        }
+        compact_discard(&compact_job);
+    }
+    for (size_t i = 0; i < student_database.chunk_count; i++) {
+        free(student_database.chunks[i].dead);
+        free(student_database.chunks[i].dead_at);
+        if (student_database.chunks[i].mapped) {
+            continue;
+        }
+        free(student_database.chunks[i].rows);
+        free(student_database.chunks[i].ids);
+        free(student_database.chunks[i].scores);
+        free(student_database.chunks[i].name_offsets);
+    }
+    free(student_database.chunks);
+    if (!student_database.names_mapped) {
+        free(student_database.names);
+    }
+    if (student_database.mapping != NULL) {
+        munmap(student_database.mapping, student_database.mapping_size);
+    }
+    student_database.mapping = NULL;
+    student_database.mapping_size = 0;
+    student_database.names_mapped = 0;
+    indexes_stale = 0;
+    student_database.chunks = NULL;
+    student_database.chunk_count = 0;
+    student_database.chunk_capacity = 0;
+    student_database.names = NULL;
+    student_database.names_used = 0;
+    student_database.names_capacity = 0;
+    student_database.dead_rows = 0;
+    student_count = 0;
+    store_publish(); // no views are open, so every retired block is freed
+    id_index_reset();
+    score_index_reset();
+    name_table_reset();
+    name_trie_reset();
+    aggregates_reset();
+}
+
+/**
+ * @brief Builds the ID and score indexes if rows were loaded without them.
+ *
+ * Loading a snapshot leaves the indexes to be built here, on the first
+ * operation that needs them, so display and average queries can be served
+ * straight after startup.
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int store_ensure_indexes() {
+    if (!indexes_stale) {
+        return 1;
+    }
+    id_index_reset();
+    if (!id_index_reserve(student_count)) {
+        return 0;
+    }
+    for (size_t i = 0; i < student_count; i++) {
+        if (student_dead(i)) {
+            continue;
+        }
+        IdIndexSlot *slot = id_index_probe(student_id(i));
+        if (slot->row == NO_ROW) {
+            slot->id = student_id(i);
+            slot->row = i;
+            student_id_index.used++;
+        }
+    }
+    if (!score_index_rebuild()) {
+        return 0;
+    }
+    indexes_stale = 0;
+    return 1;
+}
+
+/**
+ * @brief Returns the home slot of an ID (Fibonacci hashing).
+ */
+size_t id_index_slot(int id, size_t capacity) {
+    unsigned long long h = (unsigned int)id * 11400714819323198485ull;
+    return (size_t)(h >> 32) & (capacity - 1);
+}
+
+/**
+ * @brief Finds the row holding a student ID.
+ *
+ * @param id The student ID to look up.
+ * @return The row index, or NO_ROW if no student has this ID.
+ */
+size_t id_index_find(int id) {
+    if (student_id_index.capacity == 0) {
+        return NO_ROW;
+    }
+    return id_index_probe(id)->row;
+}
+
+/**
+ * @brief Returns the slot holding an ID, or the empty slot where it would
+ * be inserted. The table must not be empty.
+ */
+IdIndexSlot *id_index_probe(int id) {
+    size_t mask = student_id_index.capacity - 1;
+    for (size_t i = id_index_slot(id, student_id_index.capacity);; i = (i + 1) & mask) {
+        IdIndexSlot *slot = &student_id_index.slots[i];
+        if (slot->row == NO_ROW || slot->id == id) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * @brief Empties a slot, shifting later entries of its probe run back so
+ * lookups never stop early at the hole (no tombstones are needed).
+ */
+void id_index_erase(IdIndexSlot *slot) {
+    IdIndexSlot *slots = student_id_index.slots;
+    size_t mask = student_id_index.capacity - 1;
+    size_t hole = (size_t)(slot - slots);
+    for (size_t i = (hole + 1) & mask; slots[i].row != NO_ROW; i = (i + 1) & mask) {
+        // an entry may fill the hole if the hole lies between its home and it
+        size_t home = id_index_slot(slots[i].id, student_id_index.capacity);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole].row = NO_ROW;
+    student_id_index.used--;
+}
+
+/**
+ * @brief Makes room for 'extra' more entries, rehashing into a larger
+ * table (doubling until it fits) when the load factor would pass 70%.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int id_index_reserve(size_t extra) {
+    size_t needed = student_id_index.used + extra;
+    if (needed * 10 <= student_id_index.capacity * 7) {
+        return 1;
+    }
+
+    size_t new_capacity = student_id_index.capacity ? student_id_index.capacity * 2 : 1024;
+    while (needed * 10 > new_capacity * 7) {
+        new_capacity *= 2;
+    }
+    IdIndexSlot *new_slots = malloc(new_capacity * sizeof(IdIndexSlot));
+    if (new_slots == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < new_capacity; i++) {
+        new_slots[i].row = NO_ROW;
+    }
+    for (size_t i = 0; i < student_id_index.capacity; i++) {
+        const IdIndexSlot *old = &student_id_index.slots[i];
+        if (old->row == NO_ROW) {
+            continue;
+        }
+        size_t j = id_index_slot(old->id, new_capacity);
+        while (new_slots[j].row != NO_ROW) {
+            j = (j + 1) & (new_capacity - 1);
+        }
+        new_slots[j] = *old;
+    }
+
+    free(student_id_index.slots);
+    student_id_index.slots = new_slots;
+    student_id_index.capacity = new_capacity;
+    return 1;
+}
+
+/**
+ * @brief Frees the ID index.
+ */
+void id_index_reset() {
+    free(student_id_index.slots);
+    student_id_index.slots = NULL;
+    student_id_index.capacity = 0;
+    student_id_index.used = 0;
+}
+
+/**
+ * @brief Orders two score index entries by score, then by row.
+ *
+ * @return Non-zero if a sorts before b.
+ */
+int score_entry_less(const ScoreEntry *a, const ScoreEntry *b) {
+    return a->score < b->score || (a->score == b->score && a->row < b->row);
+}
+
+/**
+ * @brief Allocates an empty B+-tree node.
+ *
+ * @return The node, or NULL if memory is exhausted.
+ */
+ScoreNode *score_node_alloc(int leaf) {
+    ScoreNode *node = malloc(leaf ? sizeof(ScoreNode) : sizeof(ScoreInner));
+    if (node != NULL) {
+        node->leaf = leaf;
+        node->count = 0;
+        node->next = NULL;
+    }
+    return node;
+}
+
+/**
+ * @brief Returns the number of entries stored beneath a node.
+ */
+size_t score_node_total(const ScoreNode *node) {
+    if (node->leaf) {
+        return (size_t)node->count;
+    }
+    size_t total = 0;
+    for (int i = 0; i < node->count; i++) {
+        total += SCORE_INNER(node)->sizes[i];
+    }
+    return total;
+}
+
+/**
+ * @brief Picks the child of an inner node that covers an entry: the last
+ * child whose smallest entry is not greater than it.
+ */
+int score_node_route(const ScoreNode *node, const ScoreEntry *entry) {
+    int lo = 1, hi = node->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (score_entry_less(entry, &node->keys[mid])) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo - 1;
+}
+
+/**
+ * @brief Adds a row to the ordered score index in O(log n).
+ *
+ * The path to the target leaf is recorded first and every node that the
+ * insert will need to split is allocated up front, so running out of
+ * memory leaves the tree untouched.
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int score_index_insert(double score, size_t row) {
+    ScoreIndex *index = &student_score_index;
+    ScoreEntry entry = {score, row};
+
+    if (index->root == NULL) {
+        index->root = score_node_alloc(1);
+        if (index->root == NULL) {
+            return 0;
+        }
+        index->height = 1;
+    }
+
+    // Walk down, remembering the path
+    ScoreNode *path[SCORE_BTREE_MAX_HEIGHT];
+    int slot[SCORE_BTREE_MAX_HEIGHT];
+    int depth = 0;
+    ScoreNode *node = index->root;
+    while (!node->leaf) {
+        path[depth] = node;
+        slot[depth] = score_node_route(node, &entry);
+        node = SCORE_INNER(node)->children[slot[depth]];
+        depth++;
+    }
+    path[depth] = node;
+
+    // Full nodes from the leaf upwards will split; a full root also needs
+    // a new root above it
+    ScoreNode *spare[SCORE_BTREE_MAX_HEIGHT + 1];
+    int splits = 0;
+    while (splits <= depth && path[depth - splits]->count == SCORE_BTREE_FANOUT) {
+        splits++;
+    }
+    int needed = splits + (splits > depth ? 1 : 0);
+    if (index->height + (splits > depth ? 1 : 0) > SCORE_BTREE_MAX_HEIGHT) {
+        return 0;
+    }
+    for (int i = 0; i < needed; i++) {
+        spare[i] = score_node_alloc(i == 0 && splits > 0);
+        if (spare[i] == NULL) {
+            while (i-- > 0) {
+                free(spare[i]);
+            }
+            return 0;
+        }
+    }
+
+    for (int d = 0; d < depth; d++) {
+        SCORE_INNER(path[d])->sizes[slot[d]]++;
+    }
+
+    // Insert into the leaf, splitting it in half if it is full
+    ScoreNode *leaf = path[depth];
+    ScoreNode *target = leaf;
+    ScoreNode *carry = NULL; // new right sibling to hook into the parent
+    if (leaf->count == SCORE_BTREE_FANOUT) {
+        carry = spare[0];
+        int half = SCORE_BTREE_FANOUT / 2;
+        memcpy(carry->keys, &leaf->keys[half], (SCORE_BTREE_FANOUT - half) * sizeof(ScoreEntry));
+        carry->count = SCORE_BTREE_FANOUT - half;
+        leaf->count = half;
+        carry->next = leaf->next;
+        leaf->next = carry;
+        if (!score_entry_less(&entry, &carry->keys[0])) {
+            target = carry;
+        }
+    }
+    int pos = target->count;
+    while (pos > 0 && score_entry_less(&entry, &target->keys[pos - 1])) {
+        target->keys[pos] = target->keys[pos - 1];
+        pos--;
+    }
+    target->keys[pos] = entry;
+    target->count++;
+
+    // Hook split siblings into their parents, splitting upwards as needed
+    int used = 1;
+    ScoreNode *left = leaf;
+    for (int d = depth - 1; d >= 0 && carry != NULL; d--) {
+        ScoreNode *parent = path[d];
+        int at = slot[d] + 1;
+        ScoreNode *right = carry;
+        ScoreEntry right_key = right->keys[0];
+        size_t left_size = score_node_total(left);
+        size_t right_size = score_node_total(right);
+
+        carry = NULL;
+        ScoreNode *dest = parent;
+        if (parent->count == SCORE_BTREE_FANOUT) {
+            carry = spare[used++];
+            int half = SCORE_BTREE_FANOUT / 2;
+            carry->count = SCORE_BTREE_FANOUT - half;
+            memcpy(carry->keys, &parent->keys[half], carry->count * sizeof(ScoreEntry));
+            memcpy(SCORE_INNER(carry)->sizes, &SCORE_INNER(parent)->sizes[half], carry->count * sizeof(size_t));
+            memcpy(SCORE_INNER(carry)->children, &SCORE_INNER(parent)->children[half], carry->count * sizeof(ScoreNode *));
+            parent->count = half;
+            if (at > half) {
+                dest = carry;
+                at -= half;
+            }
+        }
+        for (int i = dest->count; i > at; i--) {
+            dest->keys[i] = dest->keys[i - 1];
+            SCORE_INNER(dest)->sizes[i] = SCORE_INNER(dest)->sizes[i - 1];
+            SCORE_INNER(dest)->children[i] = SCORE_INNER(dest)->children[i - 1];
+        }
+        dest->keys[at] = right_key;
+        SCORE_INNER(dest)->sizes[at] = right_size;
+        SCORE_INNER(dest)->children[at] = right;
+        dest->count++;
+        SCORE_INNER(dest)->sizes[at - 1] = left_size;
+        left = parent;
+    }
+
+    // The root itself split: grow the tree by one level
+    if (carry != NULL) {
+        ScoreNode *root = spare[used];
+        root->count = 2;
+        root->keys[0] = left->keys[0];
+        root->keys[1] = carry->keys[0];
+        SCORE_INNER(root)->children[0] = left;
+        SCORE_INNER(root)->children[1] = carry;
+        SCORE_INNER(root)->sizes[0] = score_node_total(left);
+        SCORE_INNER(root)->sizes[1] = score_node_total(carry);
+        index->root = root;
+        index->height++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Removes a row from the ordered score index in O(log n).
+ *
+ * The entry is taken out of its leaf and the entry counts along the path
+ * are lowered; nodes are never merged, and the routing keys stay valid
+ * lower bounds of their subtrees.
+ * @return 1 if the entry was found, 0 otherwise.
+ */
+int score_index_remove(double score, size_t row) {
+    ScoreEntry entry = {score, row};
+    ScoreNode *path[SCORE_BTREE_MAX_HEIGHT];
+    int slot[SCORE_BTREE_MAX_HEIGHT];
+    int depth = 0;
+    ScoreNode *node = student_score_index.root;
+    if (node == NULL) {
+        return 0;
+    }
+    while (!node->leaf) {
+        path[depth] = node;
+        slot[depth] = score_node_route(node, &entry);
+        node = SCORE_INNER(node)->children[slot[depth]];
+        depth++;
+    }
+
+    int pos = 0;
+    while (pos < node->count && score_entry_less(&node->keys[pos], &entry)) {
+        pos++;
+    }
+    if (pos == node->count || node->keys[pos].row != row || node->keys[pos].score != score) {
+        return 0;
+    }
+    memmove(&node->keys[pos], &node->keys[pos + 1], (size_t)(node->count - pos - 1) * sizeof(ScoreEntry));
+    node->count--;
+    for (int d = 0; d < depth; d++) {
+        SCORE_INNER(path[d])->sizes[slot[d]]--;
+    }
+    return 1;
+}
+
+/**
+ * @brief Returns the next leaf in the chain that holds any entries, or
+ * NULL at the end.
+ */
+ScoreNode *score_leaf_next(ScoreNode *leaf) {
+    do {
+        leaf = leaf->next;
+    } while (leaf != NULL && leaf->count == 0);
+    return leaf;
+}
+
+/**
+ * @brief Returns how many students have a score strictly below the given
+ * score, in one root-to-leaf descent.
+ */
+size_t score_index_rank(double score) {
+    ScoreNode *leaf;
+    int pos;
+    return score_index_seek(score, &leaf, &pos);
+}
+
+/**
+ * @brief Positions a cursor on the first entry with a score >= the given
+ * score.
+ *
+ * @param leaf Set to the leaf holding that entry (NULL if there is none).
+ * @param pos Set to the entry's position within the leaf.
+ * @return The number of entries before the cursor (the rank of score).
+ */
+size_t score_index_seek(double score, ScoreNode **leaf, int *pos) {
+    size_t rank = 0;
+    ScoreNode *node = student_score_index.root;
+    *leaf = NULL;
+    *pos = 0;
+    if (node == NULL) {
+        return 0;
+    }
+
+    while (!node->leaf) {
+        // last child whose smallest score is below the key; every child
+        // before it lies entirely below the key
+        int lo = 1, hi = node->count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (node->keys[mid].score < score) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        int child = lo - 1;
+        for (int i = 0; i < child; i++) {
+            rank += SCORE_INNER(node)->sizes[i];
+        }
+        node = SCORE_INNER(node)->children[child];
+    }
+
+    int i = 0;
+    while (i < node->count && node->keys[i].score < score) {
+        i++;
+    }
+    rank += (size_t)i;
+    if (i == node->count) {
+        node = score_leaf_next(node);
+        i = 0;
+    }
+    *leaf = node;
+    *pos = i;
+    return rank;
+}
+
+/**
+ * @brief Returns the score with the given rank (0 = lowest).
+ *
+ * @param rank Must be below the number of indexed students.
+ */
+double score_index_select(size_t rank) {
+    int pos;
+    return score_index_locate(rank, &pos)->keys[pos].score;
+}
+
+/**
+ * @brief Finds the entry with the given rank in one root-to-leaf descent,
+ * steering by the per-child entry counts.
+ *
+ * @param rank Must be below the number of indexed students.
+ * @param pos Set to the entry's position within the returned leaf.
+ * @return The leaf holding the entry.
+ */
+ScoreNode *score_index_locate(size_t rank, int *pos) {
+    ScoreNode *node = student_score_index.root;
+    while (!node->leaf) {
+        int child = 0;
+        while (rank >= SCORE_INNER(node)->sizes[child]) {
+            rank -= SCORE_INNER(node)->sizes[child];
+            child++;
+        }
+        node = SCORE_INNER(node)->children[child];
+    }
+    *pos = (int)rank;
+    return node;
+}
+
+/**
+ * @brief Counts students with low <= score < high in O(log n).
+ */
+size_t score_index_count(double low, double high) {
+    if (!(low < high)) {
+        return 0;
+    }
+    return score_index_rank(high) - score_index_rank(low);
+}
+
+/**
+ * @brief Frees a B+-tree node and everything beneath it.
+ */
+void score_node_free(ScoreNode *node) {
+    if (node == NULL) {
+        return;
+    }
+    if (!node->leaf) {
+        for (int i = 0; i < node->count; i++) {
+            score_node_free(SCORE_INNER(node)->children[i]);
+        }
+    }
+    free(node);
+}
+
+/**
+ * @brief Frees the ordered score index.
+ */
+void score_index_reset() {
+    score_node_free(student_score_index.root);
+    student_score_index.root = NULL;
+    student_score_index.height = 0;
+}
+
+/**
+ * @brief Maps a score to an unsigned key with the same ordering, so doubles
+ * can be radix sorted (negative values have all bits flipped, others only
+ * the sign bit).
+ */
+unsigned long long score_sort_key(double score) {
+    unsigned long long bits;
+    memcpy(&bits, &score, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | (1ull << 63);
+}
+
+/**
+ * @brief Stable LSD radix sort of score index entries by score.
+ *
+ * Uses six 11-bit digits. All digit histograms are built in one read pass,
+ * and passes whose digit is the same for every entry are skipped, which
+ * for 0-100 scores removes most of the exponent passes. Stability keeps
+ * entries with equal scores in their original (row) order.
+ * @return 1 on success, 0 if the scratch buffer cannot be allocated.
+ */
+int radix_sort_score_entries(ScoreEntry *entries, size_t n) {
+    enum { DIGIT_BITS = 11, DIGITS = 6, BUCKETS = 1 << DIGIT_BITS };
+    if (n < 2) {
+        return 1;
+    }
+    ScoreEntry *scratch = malloc(n * sizeof(ScoreEntry));
+    size_t (*counts)[BUCKETS] = calloc(DIGITS, sizeof(*counts));
+    if (scratch == NULL || counts == NULL) {
+        free(scratch);
+        free(counts);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned long long key = score_sort_key(entries[i].score);
+        for (int d = 0; d < DIGITS; d++) {
+            counts[d][(key >> (d * DIGIT_BITS)) & (BUCKETS - 1)]++;
+        }
+    }
+
+    ScoreEntry *from = entries, *to = scratch;
+    for (int d = 0; d < DIGITS; d++) {
+        size_t *count = counts[d];
+        unsigned first = (score_sort_key(from[0].score) >> (d * DIGIT_BITS)) & (BUCKETS - 1);
+        if (count[first] == n) {
+            continue; // every entry has the same digit here
+        }
+        size_t offset = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            size_t c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            unsigned digit = (score_sort_key(from[i].score) >> (d * DIGIT_BITS)) & (BUCKETS - 1);
+            to[count[digit]++] = from[i];
+        }
+        ScoreEntry *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != entries) {
+        memcpy(entries, from, n * sizeof(ScoreEntry));
+    }
+    free(scratch);
+    free(counts);
+    return 1;
+}
+
+/**
+ * @brief Stable LSD radix sort of sort entries by the low 'digits' 11-bit
+ * digits of their key.
+ *
+ * Works like radix_sort_score_entries(): histograms for all digits come
+ * from one read pass and passes with a constant digit are skipped.
+ * @param scratch Buffer of n entries.
+ */
+void radix_sort_entries(SortEntry *entries, SortEntry *scratch, size_t n, int digits) {
+    enum { DIGIT_BITS = 11, MAX_DIGITS = 6, BUCKETS = 1 << DIGIT_BITS };
+    size_t counts[MAX_DIGITS][BUCKETS];
+    if (n < 2) {
+        return;
+    }
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        for (int d = 0; d < digits; d++) {
+            counts[d][(entries[i].key >> (d * DIGIT_BITS)) & (BUCKETS - 1)]++;
+        }
+    }
+
+    SortEntry *from = entries, *to = scratch;
+    for (int d = 0; d < digits; d++) {
+        size_t *count = counts[d];
+        if (count[(from[0].key >> (d * DIGIT_BITS)) & (BUCKETS - 1)] == n) {
+            continue; // every entry has the same digit here
+        }
+        size_t offset = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            size_t c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            to[count[(from[i].key >> (d * DIGIT_BITS)) & (BUCKETS - 1)]++] = from[i];
+        }
+        SortEntry *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != entries) {
+        memcpy(entries, from, n * sizeof(SortEntry));
+    }
+}
+
+/**
+ * @brief Returns the rows of the store in export order, as a permutation
+ * (records are not moved).
+ *
+ * Scores entered with at most two decimals (all of them, normally) are
+ * exact in fixed point, so for the score order each row gets one 46-bit key
+ * - inverted hundredths above the ID - and a single five-digit sort does.
+ * Otherwise two stable sorts are used: by ID, then by the inverted score
+ * key, so equal scores stay in ID order.
+ * @return The permutation of the live rows (store_live_count() entries, to
+ * be freed), or NULL if memory is exhausted.
+ */
+unsigned int *store_sorted_order(ExportOrder order) {
+    size_t n = store_live_count();
+    SortEntry *entries = malloc((n ? n : 1) * sizeof(SortEntry));
+    SortEntry *scratch = malloc((n ? n : 1) * sizeof(SortEntry));
+    unsigned int *rows = malloc((n ? n : 1) * sizeof(unsigned int));
+    if (entries == NULL || scratch == NULL || rows == NULL) {
+        free(entries);
+        free(scratch);
+        free(rows);
+        return NULL;
+    }
+
+    int fixed_point = order == EXPORT_BY_SCORE;
+    for (size_t row = 0, i = 0; i < n; row++) {
+        if (student_dead(row)) {
+            continue;
+        }
+        entries[i].key = (unsigned int)student_id(row) ^ 0x80000000u; // signed order as unsigned
+        entries[i].row = (unsigned int)row;
+        if (fixed_point) {
+            double score = student_score(row);
+            double cents = floor(score * 100.0 + 0.5);
+            if (cents >= 0.0 && cents <= 10000.0 && cents / 100.0 == score) {
+                entries[i].key |= (unsigned long long)(10000 - (unsigned int)cents) << 32;
+            } else {
+                fixed_point = 0;
+            }
+        }
+        i++;
+    }
+
+    if (fixed_point) {
+        radix_sort_entries(entries, scratch, n, 5);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            entries[i].key &= 0xFFFFFFFFu;
+        }
+        radix_sort_entries(entries, scratch, n, 3);
+        if (order == EXPORT_BY_SCORE) {
+            for (size_t i = 0; i < n; i++) {
+                entries[i].key = ~score_sort_key(student_score(entries[i].row));
+            }
+            radix_sort_entries(entries, scratch, n, 6);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        rows[i] = entries[i].row;
+    }
+    free(entries);
+    free(scratch);
+    return rows;
+}
+
+ExportOrder qsort_export_order; // order used by export_order_compare()
+
+/**
+ * @brief qsort comparator over rows, used to benchmark the radix sort.
+ */
+int export_order_compare(const void *a, const void *b) {
+    size_t x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    if (qsort_export_order == EXPORT_BY_SCORE) {
+        double sx = student_score(x), sy = student_score(y);
+        if (sx != sy) {
+            return sx > sy ? -1 : 1;
+        }
+    }
+    int ix = student_id(x), iy = student_id(y);
+    return (ix > iy) - (ix < iy);
+}
+
+/**
+ * @brief Same result as store_sorted_order(), computed with qsort.
+ */
+unsigned int *store_sorted_order_qsort(ExportOrder order) {
+    size_t n = store_live_count();
+    unsigned int *rows = malloc((n ? n : 1) * sizeof(unsigned int));
+    if (rows == NULL) {
+        return NULL;
+    }
+    for (size_t row = 0, i = 0; i < n; row++) {
+        if (!student_dead(row)) {
+            rows[i++] = (unsigned int)row;
+        }
+    }
+    qsort_export_order = order;
+    qsort(rows, n, sizeof(unsigned int), export_order_compare);
+    return rows;
+}
+
+/**
+ * @brief Compares the radix export order with qsort on 10M rows.
+ *
+ * Run with "--bench-export" (optionally after --layout=soa). Checks that
+ * both give the same permutation and prints the time of each.
+ */
+void run_export_benchmark() {
+    const size_t n = 10000000;
+    Student s;
+    memset(&s, 0, sizeof(s));
+    unsigned long long state = 88172645463325252ull;
+    for (size_t i = 0; i < n; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        s.id = (int)(state >> 33) - (1 << 30); // random IDs, some negative
+        snprintf(s.name, MAX_NAME_LENGTH, "Student %zu", i % 50000);
+        s.score = (double)(state % 10001) / 100.0;
+        StoreStatus status = store_append(&s);
+        if (status == STORE_NO_MEMORY) {
+            printf("Out of memory.\n");
+            store_reset();
+            return;
+        }
+    }
+
+    printf("%-8s | %-12s | %-12s | %-8s\n", "Order", "Radix sec", "qsort sec", "Match");
+    for (int order = EXPORT_BY_SCORE; order <= EXPORT_BY_ID; order++) {
+        double start = now_seconds();
+        unsigned int *radix = store_sorted_order((ExportOrder)order);
+        double radix_time = now_seconds() - start;
+        start = now_seconds();
+        unsigned int *reference = store_sorted_order_qsort((ExportOrder)order);
+        double qsort_time = now_seconds() - start;
+        int match = radix != NULL && reference != NULL &&
+                    memcmp(radix, reference, store_live_count() * sizeof(unsigned int)) == 0;
+        printf("%-8s | %-12.3f | %-12.3f | %-8s\n", order == EXPORT_BY_SCORE ? "score" : "id",
+               radix_time, qsort_time, match ? "yes" : "NO");
+        free(radix);
+        free(reference);
+    }
+    printf("%zu students.\n", student_count);
+    store_reset();
+}
+
+/**
+ * @brief Rebuilds the score index bottom-up from every row in the store.
+ *
+ * Used after bulk loads: one radix sort and packing full nodes level by
+ * level is much cheaper than one tree insert per row. Entries are
+ * generated in row order and the sort is stable, so ties stay ordered by
+ * row.
+ * @return 1 on success, 0 if memory is exhausted (the index is then empty).
+ */
+int score_index_rebuild() {
+    score_index_reset();
+    size_t live = store_live_count();
+    if (live == 0) {
+        return 1;
+    }
+
+    ScoreEntry *entries = malloc(live * sizeof(ScoreEntry));
+    if (entries == NULL) {
+        return 0;
+    }
+    for (size_t i = 0, n = 0; i < student_count; i++) {
+        if (!student_dead(i)) {
+            entries[n].score = student_score(i);
+            entries[n].row = i;
+            n++;
+        }
+    }
+    int ok = radix_sort_score_entries(entries, live) && score_index_load(&student_score_index, entries, live);
+    free(entries);
+    return ok;
+}
+
+/**
+ * @brief Fills an empty score index from sorted entries, packing full,
+ * chained leaves and then each inner level until one node remains.
+ *
+ * Touches no global state, so a compaction builds its index with it off
+ * the writer thread.
+ * @return 1 on success, 0 if memory is exhausted (the index stays empty).
+ */
+int score_index_load(ScoreIndex *index, const ScoreEntry *entries, size_t count) {
+    if (count == 0) {
+        return 1;
+    }
+    size_t level_count = (count + SCORE_BTREE_FANOUT - 1) / SCORE_BTREE_FANOUT;
+    ScoreNode **level = malloc(level_count * sizeof(ScoreNode *));
+    if (level == NULL) {
+        return 0;
+    }
+
+    int ok = 1;
+    for (size_t n = 0; n < level_count; n++) {
+        ScoreNode *leaf = score_node_alloc(1);
+        if (leaf == NULL) {
+            level_count = n;
+            ok = 0;
+            break;
+        }
+        size_t first = n * SCORE_BTREE_FANOUT;
+        size_t take = count - first < SCORE_BTREE_FANOUT ? count - first : SCORE_BTREE_FANOUT;
+        memcpy(leaf->keys, &entries[first], take * sizeof(ScoreEntry));
+        leaf->count = (int)take;
+        if (n > 0) {
+            level[n - 1]->next = leaf;
+        }
+        level[n] = leaf;
+    }
+
+    // Build inner levels until one node remains; the level array is reused
+    int height = 1;
+    while (ok && level_count > 1) {
+        size_t parent_count = (level_count + SCORE_BTREE_FANOUT - 1) / SCORE_BTREE_FANOUT;
+        for (size_t n = 0; n < parent_count; n++) {
+            ScoreNode *parent = score_node_alloc(0);
+            if (parent == NULL) {
+                // free the rest of this level's children and the parents built so far
+                for (size_t k = n * SCORE_BTREE_FANOUT; k < level_count; k++) {
+                    score_node_free(level[k]);
+                }
+                level_count = n;
+                ok = 0;
+                break;
+            }
+            size_t first = n * SCORE_BTREE_FANOUT;
+            for (size_t k = first; k < level_count && k < first + SCORE_BTREE_FANOUT; k++) {
+                ScoreNode *child = level[k];
+                parent->keys[parent->count] = child->keys[0];
+                SCORE_INNER(parent)->sizes[parent->count] = score_node_total(child);
+                SCORE_INNER(parent)->children[parent->count] = child;
+                parent->count++;
+            }
+            level[n] = parent;
+        }
+        if (ok) {
+            level_count = parent_count;
+            height++;
+        }
+    }
+
+    if (!ok) {
+        for (size_t k = 0; k < level_count; k++) {
+            score_node_free(level[k]);
+        }
+        free(level);
+        return 0;
+    }
+    index->root = level[0];
+    index->height = height;
+    free(level);
+    return 1;
+}
+
+/**
+ * @brief Returns the score range [low, high) that maps to a letter grade,
+ * matching the thresholds in get_letter_grade().
+ */
+void grade_band_bounds(char grade, double *low, double *high) {
+    switch (grade) {
+        case 'A': *low = 90.0;      *high = INFINITY; break;
+        case 'B': *low = 80.0;      *high = 90.0;     break;
+        case 'C': *low = 70.0;      *high = 80.0;     break;
+        case 'D': *low = 60.0;      *high = 70.0;     break;
+        default:  *low = -INFINITY; *high = 60.0;     break;
+    }
+}
+
+/**
+ * @brief Parses an optionally signed decimal integer at the start of a field.
+ *
+ * @return Pointer just past the digits, or NULL if there are none or the
+ * value does not fit in an int.
+ */
+const char *parse_csv_int(const char *p, const char *end, int *value) {
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        if (v > 2147483648LL) {
+            return NULL;
+        }
+    }
+    if (negative) {
+        v = -v;
+    }
+    if (v > 2147483647LL) {
+        return NULL;
+    }
+    *value = (int)v;
+    return p;
+}
+
+/**
+ * @brief Parses a plain decimal score such as "87" or "91.25".
+ *
+ * All digits are collected into one integer and divided by a power of ten
+ * once, which rounds the same way as strtod for up to 15 significant
+ * digits. Extra fraction digits beyond that are ignored.
+ * @return Pointer just past the number, or NULL if it is malformed.
+ */
+const char *parse_csv_score(const char *p, const char *end, double *value) {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    unsigned long long digits = 0;
+    int significant = 0, fraction = 0, seen = 0;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (significant < 15) {
+            digits = digits * 10 + (unsigned)(*p - '0');
+            significant += digits != 0;
+        } else {
+            return NULL; // no valid score has this many integer digits
+        }
+        p++;
+        seen = 1;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (significant < 15) {
+                digits = digits * 10 + (unsigned)(*p - '0');
+                significant += digits != 0;
+                fraction++;
+            }
+            p++;
+            seen = 1;
+        }
+    }
+    if (!seen) {
+        return NULL;
+    }
+    *value = (double)digits / powers[fraction];
+    return p;
+}
+
+/**
+ * @brief Parses one id,name,score CSV line into a Student.
+ *
+ * The name is everything between the first and the last comma, truncated
+ * to fit. The score must lie in 0-100, the same rule as add_student.
+ * @return 1 if the line is valid, 0 otherwise.
+ */
+int parse_csv_line(const char *line, const char *line_end, Student *student) {
+    const char *q = parse_csv_int(line, line_end, &student->id);
+    if (q == NULL || q == line_end || *q != ',') {
+        return 0;
+    }
+    const char *name_start = q + 1;
+    const char *name_end = line_end;
+    while (name_end > name_start && name_end[-1] != ',') {
+        name_end--;
+    }
+    if (name_end == name_start) {
+        return 0;
+    }
+    name_end--; // back onto the last comma
+
+    double score;
+    q = parse_csv_score(name_end + 1, line_end, &score);
+    if (q != line_end || score < 0 || score > 100) {
+        return 0;
+    }
+    student->score = score;
+
+    size_t len = (size_t)(name_end - name_start);
+    if (len > MAX_NAME_LENGTH - 1) {
+        len = MAX_NAME_LENGTH - 1;
+    }
+    memcpy(student->name, name_start, len);
+    student->name[len] = '\0';
+    return 1;
+}
+
+/**
+ * @brief Bulk-loads students from a CSV file of id,name,score lines.
+ *
+ * The file is mapped into memory and parsed in place without allocating;
+ * each row is validated like add_student (score 0-100, unique ID) and
+ * appended straight into the store. A first line that does not start with
+ * a number is treated as a header.
+ *
+ * Lines are parsed in batches of IMPORT_BATCH so the ID index slots of a
+ * whole batch can be prefetched before the rows are inserted; the index is
+ * sized for the whole file first so those slots cannot move. The score
+ * index is rebuilt once at the end instead of being updated per row, and
+ * the name trie is left for the next name search to rebuild.
+ * @param path The CSV file to read.
+ * @param result Receives counts of imported and rejected rows.
+ * @return 1 if the file was read, 0 if it could not be opened or mapped,
+ * or memory ran out or the log failed (rows imported so far are kept).
+ */
+int import_csv(const char *path, ImportResult *result) {
+    memset(result, 0, sizeof(*result));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    const char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    const char *end = data + st.st_size;
+    posix_madvise((void *)data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    size_t lines = 1;
+    for (const char *c = data; (c = memchr(c, '\n', (size_t)(end - c))) != NULL; c++) {
+        lines++;
+    }
+    if (!id_index_reserve(lines) || (name_table.stale && !name_table_rebuild()) || !name_table_reserve(lines)) {
+        munmap((void *)data, (size_t)st.st_size);
+        return 0;
+    }
+
+    Student batch[IMPORT_BATCH];
+    size_t batch_lines[IMPORT_BATCH];
+    const char *p = data;
+    size_t line_number = 0;
+    int ok = 1;
+    score_index_deferred = 1;
+    name_trie.stale = 1; // rebuilt in one pass by the next name search
+
+    while (ok && p < end) {
+        // Parse up to a batch of valid lines
+        int count = 0;
+        while (count < IMPORT_BATCH && p < end) {
+            const char *eol = memchr(p, '\n', (size_t)(end - p));
+            if (eol == NULL) {
+                eol = end;
+            }
+            const char *line = p;
+            const char *line_end = eol > p && eol[-1] == '\r' ? eol - 1 : eol;
+            p = eol < end ? eol + 1 : end;
+            line_number++;
+
+            if (line == line_end) {
+                continue; // blank line
+            }
+            if (line_number == 1 && !((*line >= '0' && *line <= '9') || *line == '-' || *line == '+')) {
+                continue; // header
+            }
+            if (parse_csv_line(line, line_end, &batch[count])) {
+                batch_lines[count++] = line_number;
+            } else {
+                result->rejected++;
+                if (result->first_bad_line == 0 || line_number < result->first_bad_line) {
+                    result->first_bad_line = line_number;
+                }
+            }
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint32_t name_hash = fnv1a((const unsigned char *)batch[i].name, strlen(batch[i].name));
+            __builtin_prefetch(&student_id_index.slots[id_index_slot(batch[i].id, student_id_index.capacity)]);
+            __builtin_prefetch(&name_table.slots[name_hash & (name_table.capacity - 1)]);
+        }
+        for (int i = 0; i < count; i++) {
+            StoreStatus status = store_append(&batch[i]);
+            if (status == STORE_OK) {
+                result->imported++;
+                continue;
+            }
+            if (status == STORE_NO_MEMORY || status == STORE_IO_ERROR) {
+                result->log_failed = status == STORE_IO_ERROR;
+                ok = 0;
+                break;
+            }
+            result->rejected++;
+            if (result->first_bad_line == 0 || batch_lines[i] < result->first_bad_line) {
+                result->first_bad_line = batch_lines[i];
+            }
+        }
+    }
+
+    result->bytes = (size_t)(p - data);
+    munmap((void *)data, (size_t)st.st_size);
+    score_index_deferred = 0;
+    if (!score_index_rebuild()) {
+        ok = 0;
+    }
+    return ok;
+}
+
+/**
+ * @brief Feeds whole little-endian 64-bit words into a Fletcher-style
+ * checksum. len must be a multiple of 8.
+ */
+void checksum_update(uint64_t *a, uint64_t *b, const unsigned char *data, size_t len) {
+    uint64_t sa = *a, sb = *b;
+    for (size_t i = 0; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        sa += word;
+        sb += sa;
+    }
+    *a = sa;
+    *b = sb;
+}
+
+/**
+ * @brief Folds the trailing partial word (zero padded) and mixes both sums
+ * into the final checksum.
+ */
+uint64_t checksum_finish(uint64_t a, uint64_t b, const unsigned char *tail, int tail_len) {
+    if (tail_len > 0) {
+        unsigned char word[8] = {0};
+        memcpy(word, tail, (size_t)tail_len);
+        checksum_update(&a, &b, word, sizeof(word));
+    }
+    return a ^ (b * 0x9E3779B97F4A7C15ull);
+}
+
+/**
+ * @brief Writes bytes to a snapshot, checksumming them on the way.
+ *
+ * @return 1 on success, 0 on a write error.
+ */
+int snapshot_write(SnapshotWriter *w, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    if (len > 0 && fwrite(bytes, 1, len, w->file) != len) {
+        return 0;
+    }
+    w->written += len;
+
+    if (w->tail_len > 0) {
+        size_t take = (size_t)(8 - w->tail_len) < len ? (size_t)(8 - w->tail_len) : len;
+        memcpy(w->tail + w->tail_len, bytes, take);
+        w->tail_len += (int)take;
+        bytes += take;
+        len -= take;
+        if (w->tail_len < 8) {
+            return 1;
+        }
+        checksum_update(&w->sum_a, &w->sum_b, w->tail, 8);
+        w->tail_len = 0;
+    }
+    size_t whole = len & ~(size_t)7;
+    checksum_update(&w->sum_a, &w->sum_b, bytes, whole);
+    memcpy(w->tail, bytes + whole, len - whole);
+    w->tail_len = (int)(len - whole);
+    return 1;
+}
+
+/**
+ * @brief Pads the snapshot with zeros up to the next 8-byte boundary.
+ */
+int snapshot_pad(SnapshotWriter *w) {
+    static const unsigned char zeros[8] = {0};
+    size_t pad = (8 - (w->written & 7)) & 7;
+    return snapshot_write(w, zeros, pad);
+}
+
+/**
+ * @brief Finishes a snapshot written to tmp_path: writes the final header
+ * over the placeholder, flushes the file to disk and renames it to path.
+ *
+ * @param ok Whether everything before succeeded; if not (or if any step
+ * here fails) the temporary file is removed.
+ * @return 1 if the snapshot is in place, 0 otherwise.
+ */
+int snapshot_commit(SnapshotWriter *w, int ok, const void *header, size_t header_size,
+                    const char *tmp_path, const char *path) {
+    ok = ok && fseek(w->file, 0, SEEK_SET) == 0 && fwrite(header, header_size, 1, w->file) == 1;
+    ok = ok && fflush(w->file) == 0 && fsync(fileno(w->file)) == 0;
+    if (w->file != NULL && fclose(w->file) != 0) {
+        ok = 0;
+    }
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        remove(tmp_path);
+    }
+    return ok;
+}
+
+/**
+ * @brief Writes the whole store to a binary snapshot file.
+ *
+ * The snapshot is written to "<path>.tmp", flushed to disk and then
+ * renamed over the old file, so a crash never leaves a half-written
+ * snapshot behind (and a mapping of the old file stays valid). Deleted
+ * rows are compacted away first, so the file holds live rows only.
+ * @return 1 on success, 0 on an I/O or memory error.
+ */
+int save_snapshot(const char *path) {
+    if (student_database.dead_rows > 0 && !store_compact()) {
+        return 0;
+    }
+    if (compress_snapshot) {
+        return save_compressed_snapshot(path);
+    }
+    size_t n = student_count;
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    void *buffer = malloc(STUDENT_CHUNK_SIZE * sizeof(double));
+    if (tmp_path == NULL || buffer == NULL) {
+        free(tmp_path);
+        free(buffer);
+        return 0;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    uint64_t names_size = student_database.names_used; // the name arena is written as is
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.row_count = n;
+    header.names_size = names_size;
+    header.ids_offset = (sizeof(SnapshotHeader) + 7) & ~(uint64_t)7;
+    header.scores_offset = (header.ids_offset + n * sizeof(int32_t) + 7) & ~(uint64_t)7;
+    header.name_offsets_offset = header.scores_offset + n * sizeof(double);
+    header.names_offset = (header.name_offsets_offset + n * sizeof(uint32_t) + 7) & ~(uint64_t)7;
+    header.file_size = (header.names_offset + names_size + 7) & ~(uint64_t)7;
+
+    SnapshotWriter w;
+    memset(&w, 0, sizeof(w));
+    w.file = fopen(tmp_path, "wb");
+    int ok = w.file != NULL && fwrite(&header, sizeof(header), 1, w.file) == 1;
+    w.written = sizeof(header);
+    ok = ok && snapshot_pad(&w);
+    w.sum_a = w.sum_b = 0; // the data checksum starts after the header
+    w.tail_len = 0;
+
+    // Column by column, one chunk-sized run at a time
+    for (int column = 0; ok && column < 3; column++) {
+        for (size_t start = 0; ok && start < n; start += STUDENT_CHUNK_SIZE) {
+            size_t run = n - start < STUDENT_CHUNK_SIZE ? n - start : STUDENT_CHUNK_SIZE;
+            const StudentChunk *chunk = &student_database.chunks[start >> STUDENT_CHUNK_SHIFT];
+            const void *src = buffer;
+            size_t width = column == 1 ? sizeof(double) : sizeof(uint32_t);
+
+            if (student_database.layout == LAYOUT_SOA) {
+                src = column == 0 ? (const void *)chunk->ids
+                    : column == 1 ? (const void *)chunk->scores
+                                  : (const void *)chunk->name_offsets;
+            } else {
+                for (size_t i = 0; i < run; i++) {
+                    const StudentRow *row = &chunk->rows[i];
+                    if (column == 0) {
+                        ((int32_t *)buffer)[i] = row->id;
+                    } else if (column == 1) {
+                        ((double *)buffer)[i] = row->score;
+                    } else {
+                        ((uint32_t *)buffer)[i] = row->name;
+                    }
+                }
+            }
+            ok = snapshot_write(&w, src, run * width);
+        }
+        ok = ok && snapshot_pad(&w);
+    }
+
+    ok = ok && snapshot_write(&w, student_database.names, names_size);
+    ok = ok && snapshot_pad(&w);
+
+    header.data_checksum = checksum_finish(w.sum_a, w.sum_b, w.tail, w.tail_len);
+    uint64_t a = 0, b = 0;
+    checksum_update(&a, &b, (const unsigned char *)&header, sizeof(header));
+    header.header_checksum = checksum_finish(a, b, NULL, 0);
+
+    ok = snapshot_commit(&w, ok, &header, sizeof(header), tmp_path, path);
+    free(tmp_path);
+    free(buffer);
+    return ok;
+}
+
+/**
+ * @brief Tells whether the section [offset, offset + length) ends at or
+ * before 'end', without overflowing on hostile offsets.
+ */
+int section_fits(uint64_t offset, uint64_t length, uint64_t end) {
+    return offset <= end && length <= end - offset;
+}
+
+/**
+ * @brief Checks that every name offset points into the name buffer and
+ * that the buffer ends with a NUL, so every name is terminated inside it.
+ *
+ * Reads the whole name offset column, but as a branch-free maximum.
+ */
+int snapshot_names_valid(const uint32_t *name_offsets, size_t n, const char *names, uint64_t names_size) {
+    if (n == 0) {
+        return 1;
+    }
+    if (names_size == 0 || names[names_size - 1] != '\0') {
+        return 0;
+    }
+    uint32_t highest = 0;
+    for (size_t i = 0; i < n; i++) {
+        highest = name_offsets[i] > highest ? name_offsets[i] : highest;
+    }
+    return highest < names_size;
+}
+
+/**
+ * @brief Loads a snapshot into the (empty) store.
+ *
+ * In the SoA layout the file is mapped copy-on-write and every full chunk
+ * points straight into the mapping, so startup cost does not grow with
+ * the roster; only the last, partly filled chunk is copied so appends have
+ * room. In the AoS layout rows and names are copied out of the mapping.
+ * Indexes and the name intern table are built later, on first use (see
+ * store_ensure_indexes() and name_intern_tail()).
+ * @return 1 on success, 0 if the file is missing, invalid or fails its
+ * checksum (errno is ENOENT only when the file does not exist).
+ */
+int load_snapshot(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CompressedSnapshotHeader) || student_count != 0) {
+        close(fd);
+        errno = EINVAL;
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    unsigned char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return 0;
+    }
+
+    uint32_t version;
+    memcpy(&version, base + offsetof(SnapshotHeader, version), sizeof(version));
+    if (version == SNAPSHOT_COMPRESSED_VERSION) {
+        return load_compressed_snapshot(base, size);
+    }
+    if (size < sizeof(SnapshotHeader)) {
+        munmap(base, size);
+        errno = EINVAL;
+        return 0;
+    }
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    uint64_t stored = header.header_checksum;
+    header.header_checksum = 0;
+    uint64_t a = 0, b = 0;
+    checksum_update(&a, &b, (const unsigned char *)&header, sizeof(header));
+    uint64_t n = header.row_count;
+
+    int valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == SNAPSHOT_VERSION &&
+                header.byte_order == SNAPSHOT_BYTE_ORDER &&
+                checksum_finish(a, b, NULL, 0) == stored &&
+                header.file_size == size &&
+                n <= 0xFFFFFFFFull &&
+                header.ids_offset >= sizeof(SnapshotHeader) &&
+                header.ids_offset % 4 == 0 &&
+                header.scores_offset % 8 == 0 &&
+                header.name_offsets_offset % 4 == 0 &&
+                section_fits(header.ids_offset, n * sizeof(int32_t), header.scores_offset) &&
+                section_fits(header.scores_offset, n * sizeof(double), header.name_offsets_offset) &&
+                section_fits(header.name_offsets_offset, n * sizeof(uint32_t), header.names_offset) &&
+                section_fits(header.names_offset, header.names_size, size) &&
+                header.names_size <= 0xFFFFFFFFull;
+    if (valid && verify_snapshot) {
+        a = b = 0;
+        size_t data_start = (sizeof(SnapshotHeader) + 7) & ~(size_t)7;
+        checksum_update(&a, &b, base + data_start, size - data_start);
+        valid = checksum_finish(a, b, NULL, 0) == header.data_checksum;
+    }
+    if (!valid) {
+        munmap(base, size);
+        errno = EINVAL;
+        return 0;
+    }
+
+    const int32_t *ids = (const int32_t *)(base + header.ids_offset);
+    double *scores = (double *)(base + header.scores_offset);
+    uint32_t *name_offsets = (uint32_t *)(base + header.name_offsets_offset);
+    char *names = (char *)(base + header.names_offset);
+    if (!snapshot_names_valid(name_offsets, n, names, header.names_size)) {
+        munmap(base, size);
+        errno = EINVAL;
+        return 0;
+    }
+    int ok = 1;
+
+    if (student_database.layout == LAYOUT_SOA) {
+        size_t full_chunks = n >> STUDENT_CHUNK_SHIFT;
+        size_t chunk_total = full_chunks + ((n & STUDENT_CHUNK_MASK) != 0);
+        student_database.chunks = calloc(chunk_total > 16 ? chunk_total : 16, sizeof(StudentChunk));
+        ok = student_database.chunks != NULL;
+        if (ok) {
+            student_database.chunk_capacity = chunk_total > 16 ? chunk_total : 16;
+        }
+        for (size_t c = 0; ok && c < full_chunks; c++) {
+            StudentChunk *chunk = &student_database.chunks[c];
+            chunk->ids = (int *)(ids + c * STUDENT_CHUNK_SIZE);
+            chunk->scores = scores + c * STUDENT_CHUNK_SIZE;
+            chunk->name_offsets = name_offsets + c * STUDENT_CHUNK_SIZE;
+            chunk->mapped = 1;
+            student_database.chunk_count++;
+        }
+        if (ok && full_chunks < chunk_total) {
+            StudentChunk *chunk = &student_database.chunks[full_chunks];
+            size_t start = full_chunks * STUDENT_CHUNK_SIZE, rest = n - start;
+            ok = store_alloc_chunk(chunk);
+            if (ok) {
+                memcpy(chunk->ids, ids + start, rest * sizeof(int32_t));
+                memcpy(chunk->scores, scores + start, rest * sizeof(double));
+                memcpy(chunk->name_offsets, name_offsets + start, rest * sizeof(uint32_t));
+                student_database.chunk_count++;
+            }
+        }
+        if (ok) {
+            student_database.names = names;
+            student_database.names_used = header.names_size;
+            student_database.names_capacity = header.names_size;
+            student_database.names_mapped = 1;
+            student_database.mapping = base;
+            student_database.mapping_size = size;
+            student_count = n;
+        }
+    } else {
+        char *arena = name_arena_tail(header.names_size);
+        ok = arena != NULL;
+        if (ok) {
+            memcpy(arena, names, header.names_size);
+            student_database.names_used = header.names_size;
+        }
+        for (size_t i = 0; ok && i < n; i++) {
+            ok = store_push_row(ids[i], name_offsets[i], scores[i]);
+        }
+        munmap(base, size);
+    }
+
+    if (!ok) {
+        if (student_database.mapping == NULL && student_database.layout == LAYOUT_SOA) {
+            munmap(base, size);
+        }
+        store_reset();
+        errno = ENOMEM;
+        return 0;
+    }
+    indexes_stale = 1;
+    score_totals.stale = 1;
+    name_table.stale = 1;
+    name_trie.stale = 1;
+    store_publish();
+    return 1;
+}
+
+/**
+ * @brief Bytes taken by count values of the given width once bit-packed,
+ * with the 8 bytes of slack and the padding to an 8-byte boundary.
+ */
+size_t packed_size(int bits, size_t count) {
+    return (((size_t)bits * count + 7) / 8 + 8 + 7) & ~(size_t)7;
+}
+
+/**
+ * @brief Returns the number of bits needed to hold a value (0 for 0).
+ */
+int bit_width(uint64_t value) {
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+/**
+ * @brief Bit-packs values into a zeroed buffer of packed_size(bits, count)
+ * bytes.
+ *
+ * @param bits Width of every value, at most 57.
+ */
+void bitpack(unsigned char *out, const uint64_t *values, size_t count, int bits) {
+    if (bits == 0) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t bit = i * (size_t)bits;
+        uint64_t word;
+        memcpy(&word, out + bit / 8, sizeof(word));
+        word |= values[i] << (bit & 7);
+        memcpy(out + bit / 8, &word, sizeof(word));
+    }
+}
+
+/**
+ * @brief Reads value number index from a bit-packed section.
+ */
+uint64_t bitunpack_one(const unsigned char *packed, int bits, size_t index) {
+    if (bits == 0) {
+        return 0;
+    }
+    size_t bit = index * (size_t)bits;
+    uint64_t word;
+    memcpy(&word, packed + bit / 8, sizeof(word));
+    return (word >> (bit & 7)) & ((1ull << bits) - 1);
+}
+
+/**
+ * @brief Unpacks count values of at most 32 bits, one at a time.
+ */
+void unpack_scalar(const unsigned char *packed, int bits, size_t count, uint32_t *out) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (uint32_t)bitunpack_one(packed, bits, i);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * @brief AVX2 unpacker: eight values per step.
+ *
+ * Each lane gathers the 32-bit word that starts at its value's first byte
+ * and shifts the value down, which covers widths up to 25 bits; wider
+ * values go to the scalar unpacker.
+ */
+__attribute__((target("avx2")))
+void unpack_avx2(const unsigned char *packed, int bits, size_t count, uint32_t *out) {
+    if (bits == 0 || bits > 25) {
+        unpack_scalar(packed, bits, count, out);
+        return;
+    }
+    const __m256i mask = _mm256_set1_epi32((int)((1u << bits) - 1));
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256i step = _mm256_set1_epi32(8 * bits);
+    __m256i bit = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(bits));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i words = _mm256_i32gather_epi32((const int *)packed, _mm256_srli_epi32(bit, 3), 1);
+        __m256i values = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(bit, seven)), mask);
+        _mm256_storeu_si256((__m256i *)(out + i), values);
+        bit = _mm256_add_epi32(bit, step);
+    }
+    unpack_scalar(packed + i * (size_t)bits / 8, bits, count - i, out + i); // i * bits is a whole number of bytes
+}
+#endif
+
+/**
+ * @brief Picks the fastest unpacker the running CPU supports.
+ */
+UnpackKernel select_unpack_kernel() {
+#ifdef HAVE_X86_SIMD
+    if (use_simd && __builtin_cpu_supports("avx2")) {
+        return unpack_avx2;
+    }
+#endif
+    return unpack_scalar;
+}
+
+/**
+ * @brief Sums a block's packed scores and counts them per grade floor
+ * without unpacking them to memory.
+ *
+ * @param base The block's lowest score in centi-points; a packed value v
+ * stands for base + v.
+ */
+void block_stats_scalar(const unsigned char *packed, int bits, size_t count, uint32_t base, BlockTotals *totals) {
+    memset(totals, 0, sizeof(*totals));
+    for (size_t i = 0; i < count; i++) {
+        uint64_t v = bitunpack_one(packed, bits, i);
+        totals->sum += v;
+        totals->sum_sq += v * v;
+        for (int g = 0; g < GRADE_COUNT - 1; g++) {
+            totals->at_least[g] += base + v >= grade_floor_centi[g];
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * @brief AVX2 version of block_stats_scalar(), fused with the gather
+ * unpacker.
+ *
+ * Sums stay in 32-bit lanes, exact for a block of up to 16-bit values;
+ * squares go to 64-bit lanes. Grade floors are compared branch-free and
+ * the all-ones masks subtracted from per-lane counters.
+ */
+__attribute__((target("avx2")))
+void block_stats_avx2(const unsigned char *packed, int bits, size_t count, uint32_t base, BlockTotals *totals) {
+    if (bits == 0 || bits > 16 || count > SNAPSHOT_BLOCK_ROWS) {
+        block_stats_scalar(packed, bits, count, base, totals);
+        return;
+    }
+    const __m256i mask = _mm256_set1_epi32((int)((1u << bits) - 1));
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256i step = _mm256_set1_epi32(8 * bits);
+    __m256i bit = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(bits));
+    __m256i sum = _mm256_setzero_si256();
+    __m256i sq_even = _mm256_setzero_si256(), sq_odd = _mm256_setzero_si256();
+    __m256i floors[GRADE_COUNT - 1], at_least[GRADE_COUNT - 1];
+    for (int g = 0; g < GRADE_COUNT - 1; g++) {
+        // v >= floor - base, as a signed compare; the floor may lie below the base
+        floors[g] = _mm256_set1_epi32((int)grade_floor_centi[g] - (int)base - 1);
+        at_least[g] = _mm256_setzero_si256();
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i words = _mm256_i32gather_epi32((const int *)packed, _mm256_srli_epi32(bit, 3), 1);
+        __m256i v = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(bit, seven)), mask);
+        bit = _mm256_add_epi32(bit, step);
+        sum = _mm256_add_epi32(sum, v);
+        sq_even = _mm256_add_epi64(sq_even, _mm256_mul_epu32(v, v));
+        __m256i odd = _mm256_srli_epi64(v, 32);
+        sq_odd = _mm256_add_epi64(sq_odd, _mm256_mul_epu32(odd, odd));
+        for (int g = 0; g < GRADE_COUNT - 1; g++) {
+            at_least[g] = _mm256_sub_epi32(at_least[g], _mm256_cmpgt_epi32(v, floors[g]));
+        }
+    }
+
+    block_stats_scalar(packed + i * (size_t)bits / 8, bits, count - i, base, totals);
+    uint32_t lanes32[8];
+    uint64_t lanes64[4];
+    _mm256_storeu_si256((__m256i *)lanes32, sum);
+    for (int k = 0; k < 8; k++) {
+        totals->sum += lanes32[k];
+    }
+    _mm256_storeu_si256((__m256i *)lanes64, _mm256_add_epi64(sq_even, sq_odd));
+    for (int k = 0; k < 4; k++) {
+        totals->sum_sq += lanes64[k];
+    }
+    for (int g = 0; g < GRADE_COUNT - 1; g++) {
+        _mm256_storeu_si256((__m256i *)lanes32, at_least[g]);
+        for (int k = 0; k < 8; k++) {
+            totals->at_least[g] += lanes32[k];
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Picks the fastest block statistics kernel the running CPU
+ * supports.
+ */
+BlockStatsKernel select_block_stats_kernel() {
+#ifdef HAVE_X86_SIMD
+    if (use_simd && __builtin_cpu_supports("avx2")) {
+        return block_stats_avx2;
+    }
+#endif
+    return block_stats_scalar;
+}
+
+/**
+ * @brief Writes a value as a little-endian base-128 varint.
+ *
+ * @return The number of bytes written (1 to 5).
+ */
+size_t varint_put(unsigned char *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+/**
+ * @brief Reads a varint written by varint_put().
+ *
+ * @return Pointer just past it, or NULL if it runs past end.
+ */
+const unsigned char *varint_get(const unsigned char *p, const unsigned char *end, uint32_t *value) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        unsigned char byte = *p++;
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Bytes taken by a compressed block's score section.
+ */
+size_t block_score_size(const SnapshotBlock *block) {
+    if (block->score_bits == SCORE_BITS_RAW) {
+        return block->rows * sizeof(double);
+    }
+    return packed_size(block->score_bits, block->rows);
+}
+
+/**
+ * @brief Writes the whole store as a compressed snapshot (see
+ * CompressedSnapshotHeader); called by save_snapshot() with
+ * --snapshot-compress, after deleted rows are compacted away.
+ *
+ * @return 1 on success, 0 on an I/O or memory error or a name longer than
+ * MAX_CODED_NAME.
+ */
+int save_compressed_snapshot(const char *path) {
+    size_t n = student_count;
+    size_t block_count = (n + SNAPSHOT_BLOCK_ROWS - 1) / SNAPSHOT_BLOCK_ROWS;
+    size_t tmp_len = strlen(path) + 5;
+    // room for the widest block: 33-bit gaps, raw scores and the longest names
+    size_t buffer_size = packed_size(33, SNAPSHOT_BLOCK_ROWS) + SNAPSHOT_BLOCK_ROWS * sizeof(double) +
+                         SNAPSHOT_BLOCK_ROWS * (MAX_CODED_NAME + 4);
+    char *tmp_path = malloc(tmp_len);
+    SnapshotBlock *blocks = calloc(block_count > 0 ? block_count : 1, sizeof(SnapshotBlock));
+    uint64_t *values = malloc(SNAPSHOT_BLOCK_ROWS * sizeof(uint64_t));
+    unsigned char *buffer = malloc(buffer_size);
+    if (tmp_path == NULL || blocks == NULL || values == NULL || buffer == NULL) {
+        free(tmp_path);
+        free(blocks);
+        free(values);
+        free(buffer);
+        return 0;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    CompressedSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_COMPRESSED_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.row_count = n;
+    header.block_count = block_count;
+
+    SnapshotWriter w;
+    memset(&w, 0, sizeof(w));
+    w.file = fopen(tmp_path, "wb");
+    int ok = w.file != NULL && fwrite(&header, sizeof(header), 1, w.file) == 1;
+    w.written = sizeof(header); // a multiple of 8, so the data checksum starts here
+
+    for (size_t b = 0; ok && b < block_count; b++) {
+        SnapshotBlock *block = &blocks[b];
+        size_t first = b * SNAPSHOT_BLOCK_ROWS;
+        size_t rows = n - first < SNAPSHOT_BLOCK_ROWS ? n - first : SNAPSHOT_BLOCK_ROWS;
+        block->offset = w.written;
+        block->rows = (uint32_t)rows;
+        block->first_id = student_id(first);
+
+        // IDs: the gaps between neighbours, less the smallest gap
+        int64_t low = 0, high = 0;
+        for (size_t i = 1; i < rows; i++) {
+            int64_t gap = (int64_t)student_id(first + i) - student_id(first + i - 1);
+            low = i == 1 || gap < low ? gap : low;
+            high = i == 1 || gap > high ? gap : high;
+        }
+        for (size_t i = 1; i < rows; i++) {
+            values[i - 1] = (uint64_t)((int64_t)student_id(first + i) - student_id(first + i - 1) - low);
+        }
+        block->gap_base = low;
+        block->id_bits = (uint8_t)bit_width((uint64_t)(high - low));
+        size_t used = packed_size(block->id_bits, rows - 1);
+        memset(buffer, 0, used);
+        bitpack(buffer, values, rows - 1, block->id_bits);
+
+        // Scores: centi-points above the lowest, unless one is not a whole
+        // number of centi-points
+        uint32_t low_centi = 10000, high_centi = 0;
+        int exact = 1;
+        for (size_t i = 0; exact && i < rows; i++) {
+            double score = student_score(first + i);
+            exact = score >= 0.0 && score <= 100.0;
+            long centi = exact ? lround(score * 100.0) : 0;
+            exact = exact && centi / 100.0 == score;
+            values[i] = (uint64_t)centi;
+            low_centi = (uint32_t)centi < low_centi ? (uint32_t)centi : low_centi;
+            high_centi = (uint32_t)centi > high_centi ? (uint32_t)centi : high_centi;
+        }
+        if (exact) {
+            block->score_base = low_centi;
+            block->score_max = high_centi;
+            block->score_bits = (uint8_t)bit_width(high_centi - low_centi);
+            for (size_t i = 0; i < rows; i++) {
+                values[i] -= low_centi;
+            }
+            memset(buffer + used, 0, block_score_size(block));
+            bitpack(buffer + used, values, rows, block->score_bits);
+        } else {
+            block->score_base = 0;
+            block->score_max = 10000;
+            block->score_bits = SCORE_BITS_RAW;
+            for (size_t i = 0; i < rows; i++) {
+                double score = student_score(first + i);
+                memcpy(buffer + used + i * sizeof(double), &score, sizeof(double));
+            }
+        }
+        used += block_score_size(block);
+
+        // Names: front-coded against the previous name of the block
+        size_t names_start = used;
+        const char *previous = "";
+        size_t previous_len = 0;
+        for (size_t i = 0; ok && i < rows; i++) {
+            const char *name = student_name(first + i);
+            size_t len = strlen(name);
+            if (len > MAX_CODED_NAME) {
+                ok = 0;
+                break;
+            }
+            size_t shared = 0;
+            while (shared < len && shared < previous_len && name[shared] == previous[shared]) {
+                shared++;
+            }
+            used += varint_put(buffer + used, (uint32_t)shared);
+            used += varint_put(buffer + used, (uint32_t)(len - shared));
+            memcpy(buffer + used, name + shared, len - shared);
+            used += len - shared;
+            previous = name;
+            previous_len = len;
+        }
+        block->names_size = (uint32_t)(used - names_start);
+        ok = ok && snapshot_write(&w, buffer, used) && snapshot_pad(&w);
+    }
+
+    header.directory_offset = w.written;
+    ok = ok && snapshot_write(&w, blocks, block_count * sizeof(SnapshotBlock));
+    header.file_size = w.written;
+    header.data_checksum = checksum_finish(w.sum_a, w.sum_b, w.tail, w.tail_len);
+    uint64_t a = 0, b = 0;
+    checksum_update(&a, &b, (const unsigned char *)&header, sizeof(header));
+    header.header_checksum = checksum_finish(a, b, NULL, 0);
+    ok = snapshot_commit(&w, ok, &header, sizeof(header), tmp_path, path);
+
+    free(tmp_path);
+    free(blocks);
+    free(values);
+    free(buffer);
+    return ok;
+}
+
+/**
+ * @brief Checks the header, directory and (with --verify-snapshot) data
+ * checksum of a mapped compressed snapshot.
+ *
+ * The directory is checked on every load, as it costs O(blocks): each
+ * block's sections must lie before the directory, compared without
+ * overflow, however the data checksum is handled.
+ * @return 1 if every block lies inside the file and the row counts add
+ * up, 0 otherwise (errno is EINVAL).
+ */
+int compressed_snapshot_check(const unsigned char *base, size_t size) {
+    CompressedSnapshotHeader header;
+    if (size < sizeof(header)) {
+        errno = EINVAL;
+        return 0;
+    }
+    memcpy(&header, base, sizeof(header));
+    uint64_t stored = header.header_checksum;
+    header.header_checksum = 0;
+    uint64_t a = 0, b = 0;
+    checksum_update(&a, &b, (const unsigned char *)&header, sizeof(header));
+
+    int valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                header.version == SNAPSHOT_COMPRESSED_VERSION &&
+                header.byte_order == SNAPSHOT_BYTE_ORDER &&
+                checksum_finish(a, b, NULL, 0) == stored &&
+                header.file_size == size &&
+                header.row_count <= 0xFFFFFFFFull &&
+                header.directory_offset >= sizeof(header) &&
+                header.directory_offset % 8 == 0 &&
+                header.directory_offset <= size &&
+                (size - header.directory_offset) % sizeof(SnapshotBlock) == 0 &&
+                header.block_count == (size - header.directory_offset) / sizeof(SnapshotBlock);
+    if (valid && verify_snapshot) {
+        a = b = 0;
+        checksum_update(&a, &b, base + sizeof(header), size - sizeof(header));
+        valid = checksum_finish(a, b, NULL, 0) == header.data_checksum;
+    }
+
+    const SnapshotBlock *blocks = (const SnapshotBlock *)(base + header.directory_offset);
+    uint64_t rows = 0;
+    for (size_t i = 0; valid && i < header.block_count; i++) {
+        const SnapshotBlock *block = &blocks[i];
+        valid = block->rows >= 1 && block->rows <= SNAPSHOT_BLOCK_ROWS &&
+                block->offset >= sizeof(header) && block->offset % 8 == 0 &&
+                block->id_bits <= 33 &&
+                (block->score_bits == SCORE_BITS_RAW ||
+                 (block->score_bits <= 14 && block->score_base <= block->score_max && block->score_max <= 10000)) &&
+                // the sizes are bounded by rows and names_size, but the offset is not
+                section_fits(block->offset,
+                             packed_size(block->id_bits, block->rows - 1) + block_score_size(block) +
+                                 block->names_size,
+                             header.directory_offset);
+        rows += block->rows;
+    }
+    if (!valid || rows != header.row_count) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Decodes a mapped compressed snapshot into the (empty) store and
+ * unmaps it.
+ *
+ * Unlike the plain format the rows cannot be used in place; each block is
+ * unpacked in turn, its names are interned again (so repeated names share
+ * one copy), and the rows are appended. Indexes are built on first use,
+ * as after a plain load.
+ * @return 1 on success, 0 if the file is invalid (errno EINVAL) or memory
+ * runs out (ENOMEM).
+ */
+int load_compressed_snapshot(unsigned char *base, size_t size) {
+    if (!compressed_snapshot_check(base, size)) {
+        munmap(base, size);
+        return 0;
+    }
+    CompressedSnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    const SnapshotBlock *blocks = (const SnapshotBlock *)(base + header.directory_offset);
+    UnpackKernel unpack = select_unpack_kernel();
+    uint32_t *gaps = malloc(SNAPSHOT_BLOCK_ROWS * sizeof(uint32_t));
+    uint32_t *centis = malloc(SNAPSHOT_BLOCK_ROWS * sizeof(uint32_t));
+    int ok = gaps != NULL && centis != NULL;
+    int error = ENOMEM;
+
+    for (size_t b = 0; ok && b < header.block_count; b++) {
+        const SnapshotBlock *block = &blocks[b];
+        const unsigned char *ids = base + block->offset;
+        const unsigned char *scores = ids + packed_size(block->id_bits, block->rows - 1);
+        const unsigned char *names = scores + block_score_size(block);
+        const unsigned char *names_end = names + block->names_size;
+        int raw = block->score_bits == SCORE_BITS_RAW;
+        if (block->id_bits <= 32) {
+            unpack(ids, block->id_bits, block->rows - 1, gaps);
+        }
+        if (!raw) {
+            unpack(scores, block->score_bits, block->rows, centis);
+        }
+
+        char name[MAX_CODED_NAME + 1];
+        size_t name_len = 0;
+        int64_t id = block->first_id;
+        for (size_t i = 0; ok && i < block->rows; i++) {
+            if (i > 0) {
+                id += block->gap_base + (int64_t)(block->id_bits <= 32 ? gaps[i - 1]
+                                                                         : bitunpack_one(ids, block->id_bits, i - 1));
+            }
+            double score;
+            if (raw) {
+                memcpy(&score, scores + i * sizeof(double), sizeof(double));
+            } else {
+                score = (block->score_base + centis[i]) / 100.0;
+            }
+            uint32_t shared = 0, suffix = 0;
+            names = varint_get(names, names_end, &shared);
+            names = names != NULL ? varint_get(names, names_end, &suffix) : NULL;
+            if (names == NULL || shared > name_len || suffix > MAX_CODED_NAME - shared ||
+                suffix > (size_t)(names_end - names) || id < INT_MIN || id > INT_MAX ||
+                (!raw && centis[i] > block->score_max - block->score_base)) {
+                error = EINVAL;
+                ok = 0;
+                break;
+            }
+            memcpy(name + shared, names, suffix);
+            names += suffix;
+            name_len = shared + suffix;
+            name[name_len] = '\0';
+
+            long name_offset = name_intern(name);
+            ok = name_offset >= 0 && store_push_row((int)id, (unsigned int)name_offset, score);
+        }
+    }
+
+    free(gaps);
+    free(centis);
+    munmap(base, size);
+    if (!ok) {
+        store_reset();
+        errno = error;
+        return 0;
+    }
+    indexes_stale = 1;
+    score_totals.stale = 1;
+    name_trie.stale = 1;
+    store_publish();
+    return 1;
+}
+
+/**
+ * @brief Aggregates block number index of a SnapshotStatsJob into its
+ * partial, straight from the packed scores.
+ *
+ * The packed values are the scores' distances from the block's lowest
+ * score, which is exactly the shift the accumulator takes its deviations
+ * around, so the partial is built from integer sums without rounding.
+ */
+void snapshot_block_task(size_t index, void *arg) {
+    const SnapshotStatsJob *job = arg;
+    const SnapshotBlock *block = &job->blocks[index];
+    ReducePartial *part = &job->partials[index];
+    const unsigned char *scores = job->base + block->offset + packed_size(block->id_bits, block->rows - 1);
+    stats_init(&part->stats);
+    memset(part->grade_counts, 0, sizeof(part->grade_counts));
+
+    if (block->score_bits == SCORE_BITS_RAW) {
+        const double *raw = (const double *)scores; // 8-byte aligned within the mapping
+        job->stats_kernel(&part->stats, raw, block->rows, 1);
+        for (size_t i = 0; i < block->rows; i++) {
+            part->grade_counts[grade_index(get_letter_grade(raw[i]))]++;
+        }
+        return;
+    }
+
+    BlockTotals totals;
+    job->kernel(scores, block->score_bits, block->rows, block->score_base, &totals);
+    part->stats.count = block->rows;
+    part->stats.shift = block->score_base / 100.0;
+    part->stats.sum = ((double)totals.sum + (double)block->rows * block->score_base) / 100.0;
+    part->stats.dev = totals.sum / 100.0;
+    part->stats.dev_sq = totals.sum_sq / 10000.0;
+    part->stats.min = block->score_base / 100.0;
+    part->stats.max = block->score_max / 100.0;
+    const char grades[] = "ABCD";
+    size_t above = 0;
+    for (int g = 0; g < GRADE_COUNT - 1; g++) {
+        part->grade_counts[grade_index(grades[g])] = totals.at_least[g] - above;
+        above = totals.at_least[g];
+    }
+    part->grade_counts[grade_index('F')] = block->rows - above;
+}
+
+/**
+ * @brief Computes the statistics and grade histogram of a compressed
+ * snapshot file without loading it into the store.
+ *
+ * Only the directory and the score sections are read. Files of at least
+ * pool.threshold rows are aggregated one block per task on the thread
+ * pool; the partials are merged in block order, as in store_reduce().
+ * @param grade_counts GRADE_COUNT counters to add to, by grade_index().
+ * @param block_count Receives the number of blocks.
+ * @return 1 on success, 0 if the file cannot be read or is not a valid
+ * compressed snapshot (errno is set).
+ */
+int snapshot_file_stats(const char *path, StatsAccumulator *acc, size_t *grade_counts, size_t *block_count) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CompressedSnapshotHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    unsigned char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return 0;
+    }
+    if (!compressed_snapshot_check(base, size)) {
+        munmap(base, size);
+        errno = EINVAL;
+        return 0;
+    }
+
+    CompressedSnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    size_t k = header.block_count;
+    ReducePartial *partials = malloc((k > 0 ? k : 1) * sizeof(ReducePartial));
+    if (partials == NULL) {
+        munmap(base, size);
+        errno = ENOMEM;
+        return 0;
+    }
+    SnapshotStatsJob job = {base, (const SnapshotBlock *)(base + header.directory_offset),
+                            select_block_stats_kernel(), select_stats_kernel(), partials};
+    if (header.row_count >= pool.threshold && pool.thread_count != 1) {
+        pool_run(k, snapshot_block_task, &job);
+    } else {
+        for (size_t i = 0; i < k; i++) {
+            snapshot_block_task(i, &job);
+        }
+    }
+    for (size_t i = 0; i < k; i++) {
+        stats_merge(acc, &partials[i].stats);
+        for (int g = 0; g < GRADE_COUNT; g++) {
+            grade_counts[g] += partials[i].grade_counts[g];
+        }
+    }
+    free(partials);
+    munmap(base, size);
+    *block_count = k;
+    return 1;
+}
+
+/**
+ * @brief Prints the average, spread and grade distribution of a compressed
+ * snapshot file.
+ *
+ * Run with "--snapshot-stats=FILE" (after any --threads,
+ * --parallel-threshold or --no-simd options).
+ * @return 1 on success, 0 if the file could not be read.
+ */
+int print_snapshot_stats(const char *path) {
+    StatsAccumulator acc;
+    size_t grade_counts[GRADE_COUNT] = {0};
+    size_t blocks = 0;
+    stats_init(&acc);
+    double start = now_seconds();
+    if (!snapshot_file_stats(path, &acc, grade_counts, &blocks)) {
+        printf("Error: Could not read compressed snapshot '%s' (%s).\n", path, strerror(errno));
+        if (errno == EINVAL) {
+            printf("Only snapshots saved with --snapshot-compress can be aggregated in place.\n");
+        }
+        return 0;
+    }
+    double elapsed = now_seconds() - start;
+
+    ScoreStats stats = stats_finish(&acc);
+    printf("Aggregated %zu block(s) of %s in %.2f ms.\n", blocks, path, elapsed * 1000.0);
+    if (stats.count == 0) {
+        printf("Cannot calculate average. No students in the snapshot.\n");
+        return 1;
+    }
+    printf("The average score for %zu student(s) is: %.2f\n", stats.count, stats.mean);
+    printf("Minimum: %.2f  Maximum: %.2f  Std. deviation: %.2f\n",
+           stats.min, stats.max, sqrt(stats.variance));
+    const char grades[] = "ABCDF";
+    for (int g = 0; grades[g] != '\0'; g++) {
+        printf("%c: %zu\n", grades[g], grade_counts[grade_index(grades[g])]);
+    }
+    return 1;
+}
+
+/**
+ * @brief 32-bit FNV-1a hash, used to checksum write-ahead log records.
+ */
+uint32_t fnv1a(const unsigned char *data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Re-applies the records of a write-ahead log to the store.
+ *
+ * Reading stops at the first torn or corrupt record (the tail of a write
+ * interrupted by a crash) and the file is truncated there. Records that no
+ * longer apply, e.g. because a snapshot captured them, are skipped: an ADD
+ * whose ID is already in the store, or an UPDATE or DELETE whose ID is
+ * not.
+ * @return The number of records applied.
+ */
+size_t wal_replay(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    posix_madvise((void *)data, size, POSIX_MADV_SEQUENTIAL);
+
+    size_t pos = 0, applied = 0;
+    Student student;
+    memset(&student, 0, sizeof(student));
+    wal_replaying = 1;
+    while (pos + WAL_HEADER_SIZE <= size) {
+        uint32_t len, checksum;
+        memcpy(&len, data + pos, sizeof(len));
+        memcpy(&checksum, data + pos + 4, sizeof(checksum));
+        const unsigned char *payload = data + pos + WAL_HEADER_SIZE;
+        if (len < 5 || len > WAL_MAX_PAYLOAD || pos + WAL_HEADER_SIZE + len > size ||
+            fnv1a(payload, len) != checksum) {
+            break;
+        }
+        int type = payload[0];
+        if (type == WAL_RECORD_DELETE ? len != 5
+                                      : (type != WAL_RECORD_ADD && type != WAL_RECORD_UPDATE) || len < 13) {
+            break;
+        }
+
+        int32_t id;
+        memcpy(&id, payload + 1, sizeof(id));
+        StoreStatus status;
+        if (type == WAL_RECORD_DELETE) {
+            status = store_delete(id);
+        } else {
+            memcpy(&student.score, payload + 5, sizeof(student.score));
+            size_t name_len = len - 13 < MAX_NAME_LENGTH - 1 ? len - 13 : MAX_NAME_LENGTH - 1;
+            memcpy(student.name, payload + 13, name_len);
+            student.name[name_len] = '\0';
+            student.id = id;
+            status = type == WAL_RECORD_ADD ? store_append(&student) : store_update(&student);
+        }
+        if (status == STORE_OK) {
+            applied++;
+        }
+        pos += WAL_HEADER_SIZE + len;
+    }
+    wal_replaying = 0;
+
+    munmap((void *)data, size);
+    if (pos < size && ftruncate(fd, (off_t)pos) == 0) {
+        fsync(fd);
+    }
+    close(fd);
+    return applied;
+}
+
+/**
+ * @brief Opens (or creates) the write-ahead log for appending and starts
+ * the flusher thread.
+ *
+ * @return 1 on success, 0 on failure (errno is set).
+ */
+int wal_open(const char *path) {
+    wal.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal.fd < 0) {
+        return 0;
+    }
+    wal.stop = 0;
+    wal.failed = 0;
+    wal.synced = wal.sequence;
+    if (pthread_create(&wal.flusher, NULL, wal_flusher_main, NULL) != 0) {
+        close(wal.fd);
+        wal.fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Writes a buffer of records to the log and syncs it if configured.
+ *
+ * @return 1 on success, 0 on an I/O error.
+ */
+int wal_write_buffer(const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(wal.fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    if (wal.sync) {
+        if (fdatasync(wal.fd) != 0) {
+            return 0;
+        }
+        wal.syncs++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Body of the flusher thread: commits the active buffer as a group
+ * whenever it holds batch_size records or has waited flush_interval.
+ */
+void *wal_flusher_main(void *arg) {
+    (void)arg;
+    unsigned char *spare = NULL;
+    size_t spare_capacity = 0;
+
+    pthread_mutex_lock(&wal.lock);
+    for (;;) {
+        while (!wal.stop && wal.pending < wal.batch_size &&
+               !(wal.pending > 0 && now_seconds() - wal.oldest_pending >= wal.flush_interval)) {
+            if (wal.pending == 0) {
+                pthread_cond_wait(&wal.wake, &wal.lock);
+            } else {
+                // sleep until the oldest waiting record reaches the interval
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                double wait = wal.oldest_pending + wal.flush_interval - now_seconds();
+                long long ns = deadline.tv_nsec + (long long)(wait > 0 ? wait * 1e9 : 0);
+                deadline.tv_sec += (time_t)(ns / 1000000000LL);
+                deadline.tv_nsec = (long)(ns % 1000000000LL);
+                pthread_cond_timedwait(&wal.wake, &wal.lock, &deadline);
+            }
+        }
+        if (wal.pending == 0 && wal.stop) {
+            break;
+        }
+
+        // Swap buffers so appends can continue while this group is written
+        unsigned char *group = wal.active;
+        size_t group_len = wal.active_used;
+        size_t group_capacity = wal.active_capacity;
+        size_t group_records = wal.pending;
+        unsigned long long group_last = wal.sequence;
+        int failed = wal.failed;
+        wal.active = spare;
+        wal.active_capacity = spare_capacity;
+        wal.active_used = 0;
+        wal.pending = 0;
+        wal.flushing = 1;
+        pthread_mutex_unlock(&wal.lock);
+
+        int ok = !failed && wal_write_buffer(group, group_len);
+
+        pthread_mutex_lock(&wal.lock);
+        spare = group;
+        spare_capacity = group_capacity;
+        wal.flushing = 0;
+        if (ok) {
+            wal.records += group_records;
+            __atomic_store_n(&wal.synced, group_last, __ATOMIC_RELEASE);
+        } else {
+            wal.failed = 1;
+        }
+        pthread_cond_broadcast(&wal.idle);
+        if (wal.notify_fd >= 0) {
+            char byte = 0;
+            ssize_t n = write(wal.notify_fd, &byte, 1);
+            (void)n; // a full pipe already holds a wakeup
+        }
+    }
+    pthread_mutex_unlock(&wal.lock);
+    free(spare);
+    return NULL;
+}
+
+/**
+ * @brief Appends a record of a change to the store to the log and waits
+ * until it is durable.
+ *
+ * While wal_deferred is set the record is only queued; the caller then
+ * waits for wal.synced to reach wal.sequence itself.
+ * @param type WAL_RECORD_ADD or WAL_RECORD_UPDATE with the student's new
+ * name and score, or WAL_RECORD_DELETE (name and score are then ignored).
+ * @return 1 if the record was made durable (or queued, if deferred), 0 on
+ * a memory or I/O error.
+ */
+int wal_log_record(int type, int id, const char *name, double score) {
+    unsigned char record[WAL_HEADER_SIZE + WAL_MAX_PAYLOAD];
+    unsigned char *payload = record + WAL_HEADER_SIZE;
+    int32_t id32 = id;
+    uint32_t len = 5;
+
+    payload[0] = (unsigned char)type;
+    memcpy(payload + 1, &id32, sizeof(id32));
+    if (type != WAL_RECORD_DELETE) {
+        size_t name_len = strlen(name);
+        len = (uint32_t)(13 + name_len);
+        memcpy(payload + 5, &score, sizeof(score));
+        memcpy(payload + 13, name, name_len);
+    }
+    uint32_t checksum = fnv1a(payload, len);
+    memcpy(record, &len, sizeof(len));
+    memcpy(record + 4, &checksum, sizeof(checksum));
+    size_t record_len = WAL_HEADER_SIZE + len;
+
+    pthread_mutex_lock(&wal.lock);
+    if (wal.failed) {
+        pthread_mutex_unlock(&wal.lock);
+        return 0;
+    }
+    if (wal.batch_size == 1) {
+        // Synchronous commit: this record is on disk before we return
+        while (wal.flushing) {
+            pthread_cond_wait(&wal.idle, &wal.lock);
+        }
+        int ok = wal_write_buffer(record, record_len);
+        if (ok) {
+            wal.records++;
+            __atomic_store_n(&wal.synced, ++wal.sequence, __ATOMIC_RELEASE);
+        } else {
+            wal.failed = 1;
+        }
+        pthread_mutex_unlock(&wal.lock);
+        return ok;
+    }
+
+    if (wal.active_used + record_len > wal.active_capacity) {
+        size_t new_capacity = wal.active_capacity ? wal.active_capacity * 2 : 64 * 1024;
+        while (new_capacity < wal.active_used + record_len) {
+            new_capacity *= 2;
+        }
+        unsigned char *grown = realloc(wal.active, new_capacity);
+        if (grown == NULL) {
+            pthread_mutex_unlock(&wal.lock);
+            return 0;
+        }
+        wal.active = grown;
+        wal.active_capacity = new_capacity;
+    }
+    memcpy(wal.active + wal.active_used, record, record_len);
+    wal.active_used += record_len;
+    if (wal.pending++ == 0) {
+        wal.oldest_pending = now_seconds();
+        pthread_cond_signal(&wal.wake);
+    } else if (wal.pending >= wal.batch_size) {
+        pthread_cond_signal(&wal.wake);
+    }
+    unsigned long long sequence = ++wal.sequence;
+    pthread_mutex_unlock(&wal.lock);
+    return wal_deferred || wal_wait_synced(sequence);
+}
+
+/**
+ * @brief Waits until the record with the given sequence number is durable.
+ *
+ * Only the writer appends, so once it waits no more records can join the
+ * group: the group is committed at once rather than at batch_size or
+ * flush_interval.
+ * @return 1 once the record is durable, 0 if the log failed first.
+ */
+int wal_wait_synced(unsigned long long sequence) {
+    pthread_mutex_lock(&wal.lock);
+    while (!wal.failed && wal.synced < sequence) {
+        wal.oldest_pending = now_seconds() - wal.flush_interval; // flush now
+        pthread_cond_signal(&wal.wake);
+        pthread_cond_wait(&wal.idle, &wal.lock);
+    }
+    int ok = wal.synced >= sequence;
+    pthread_mutex_unlock(&wal.lock);
+    return ok;
+}
+
+/**
+ * @brief Waits until every queued record has been written.
+ */
+void wal_wait_idle() {
+    pthread_mutex_lock(&wal.lock);
+    while (wal.pending > 0 || wal.flushing) {
+        wal.oldest_pending = now_seconds() - wal.flush_interval; // flush now
+        pthread_cond_signal(&wal.wake);
+        pthread_cond_wait(&wal.idle, &wal.lock);
+    }
+    pthread_mutex_unlock(&wal.lock);
+}
+
+/**
+ * @brief Empties the log after a snapshot has captured its records.
+ *
+ * @return 1 on success, 0 if the file could not be truncated.
+ */
+int wal_checkpoint() {
+    wal_wait_idle();
+    pthread_mutex_lock(&wal.lock);
+    int ok = ftruncate(wal.fd, 0) == 0 && fsync(wal.fd) == 0;
+    pthread_mutex_unlock(&wal.lock);
+    return ok;
+}
+
+/**
+ * @brief Commits any queued records, stops the flusher and closes the log.
+ */
+void wal_close() {
+    if (wal.fd < 0) {
+        return;
+    }
+    pthread_mutex_lock(&wal.lock);
+    wal.stop = 1;
+    pthread_cond_signal(&wal.wake);
+    pthread_mutex_unlock(&wal.lock);
+    pthread_join(wal.flusher, NULL);
+
+    close(wal.fd);
+    wal.fd = -1;
+    free(wal.active);
+    wal.active = NULL;
+    wal.active_used = 0;
+    wal.active_capacity = 0;
+}
+
+/**
+ * @brief Measures acknowledged inserts per second under each durability
+ * setting.
+ *
+ * Run with "--bench-wal". Writes to "bench.wal" in the current directory
+ * and removes it afterwards. An insert counts once its record is durable,
+ * as the server acknowledges it. Committers are modelled like server
+ * clients that each wait for their reply: at most that many inserts are
+ * unacknowledged at a time. The "no fsync" row only waits for the write
+ * to reach the OS, so it is not durable across a power loss.
+ */
+void run_wal_benchmark() {
+    struct {
+        const char *name;
+        size_t batch_size;
+        int sync;
+        size_t committers;
+        size_t inserts;
+    } settings[] = {
+        {"fsync per record", 1, 1, 1, 2000},
+        {"group commit", 64, 1, 64, 50000},
+        {"group commit", 1024, 1, 1024, 200000},
+        {"no fsync (async)", 1024, 0, 1024, 200000},
+    };
+    const char *path = "bench.wal";
+
+    printf("%-20s | %-10s | %-10s | %-14s | %-10s\n", "Durability", "Committers", "Inserts", "Acked/sec", "fsyncs");
+    wal_deferred = 1;
+    for (size_t k = 0; k < sizeof(settings) / sizeof(settings[0]); k++) {
+        remove(path);
+        wal.batch_size = settings[k].batch_size;
+        wal.sync = settings[k].sync;
+        wal.records = 0;
+        wal.syncs = 0;
+        if (!wal_open(path)) {
+            printf("Could not open %s.\n", path);
+            break;
+        }
+
+        Student s;
+        memset(&s, 0, sizeof(s));
+        size_t acked = 0;
+        double start = now_seconds();
+        for (size_t i = 0; i < settings[k].inserts; i++) {
+            // a committer is free again once its insert is acknowledged
+            unsigned long long first = __atomic_load_n(&wal.synced, __ATOMIC_ACQUIRE) + 1;
+            if (wal.sequence - first + 1 >= settings[k].committers && !wal_wait_synced(first)) {
+                break;
+            }
+            s.id = (int)i;
+            snprintf(s.name, MAX_NAME_LENGTH, "Student %zu", i);
+            s.score = (double)(i % 10001) / 100.0;
+            if (store_append(&s) != STORE_OK) {
+                break;
+            }
+        }
+        if (wal_wait_synced(wal.sequence)) {
+            acked = wal.records;
+        }
+        double elapsed = now_seconds() - start;
+        wal_close();
+
+        printf("%-20s | %-10zu | %-10zu | %-14.0f | %-10zu\n", settings[k].name, settings[k].committers,
+               acked, acked / elapsed, wal.syncs);
+        store_reset();
+    }
+    wal_deferred = 0;
+    remove(path);
+}
+
+/**
+ * @brief Returns space for len more bytes in the render buffer, writing the
+ * buffer out first if it is too full. The caller advances table_output.used.
+ */
+char *render_reserve(size_t len) {
+    if (table_output.used + len > RENDER_BUFFER_SIZE) {
+        render_flush();
+    }
+    return table_output.data + table_output.used;
+}
+
+/**
+ * @brief Appends text to the render buffer.
+ */
+void render_append(const char *text, size_t len) {
+    memcpy(render_reserve(len), text, len);
+    table_output.used += len;
+}
+
+/**
+ * @brief Ends the buffered output of command 'kind' (a CommandKind) at the
+ * current end of the buffer and charges its bytes to that command.
+ *
+ * Needs a free span unless the last span is the same command's.
+ */
+void render_close_span(int kind) {
+    int n = table_output.span_count;
+    size_t start = n > 0 ? table_output.span_end[n - 1] : 0;
+    if (table_output.used == start || thread_stats == NULL) {
+        return;
+    }
+    stat_add(&thread_stats->commands[kind].bytes, table_output.used - start);
+    if (n > 0 && table_output.span_kind[n - 1] == kind) {
+        table_output.span_end[n - 1] = table_output.used;
+        return;
+    }
+    table_output.span_end[n] = table_output.used;
+    table_output.span_kind[n] = kind;
+    table_output.span_count++;
+}
+
+/**
+ * @brief Called at command boundaries: the output buffered since the last
+ * boundary belongs to command 'kind'.
+ *
+ * Writes the buffer out once every span is taken, so render_flush() always
+ * has one left for the running command.
+ */
+void render_mark(int kind) {
+    render_close_span(kind);
+    if (table_output.span_count == RENDER_MAX_SPANS) {
+        render_flush();
+    }
+}
+
+/**
+ * @brief Writes the render buffer to its destination (normally stdout) with
+ * as few write(2) calls as possible. Pending stdio output is flushed first
+ * so ordering is kept.
+ *
+ * The write time is shared among the commands whose spans are in the
+ * buffer, in proportion to their bytes; the bytes after the last span are
+ * the running command's.
+ */
+void render_flush() {
+    if (table_output.fd == STDOUT_FILENO) {
+        fflush(stdout);
+    }
+    const char *p = table_output.data;
+    size_t left = table_output.used;
+    if (left == 0) {
+        table_output.span_count = 0;
+        return;
+    }
+    if (thread_stats != NULL) {
+        render_close_span(thread_stats->current);
+    }
+    double start = now_seconds();
+    while (left > 0) {
+        ssize_t n = write(table_output.fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            table_output.failed = 1; // stdout drops the output like printf would
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    if (thread_stats != NULL) {
+        uint64_t ns = (uint64_t)((now_seconds() - start) * 1e9);
+        size_t span_start = 0;
+        for (int k = 0; k < table_output.span_count; k++) {
+            size_t bytes = table_output.span_end[k] - span_start;
+            stat_add(&thread_stats->commands[table_output.span_kind[k]].write_ns, ns * bytes / table_output.used);
+            span_start = table_output.span_end[k];
+        }
+    }
+    table_output.used = 0;
+    table_output.span_count = 0;
+}
+
+/**
+ * @brief Formats a line like printf() into the render buffer, so it stays
+ * in order with the tables around it.
+ */
+void render_printf(const char *format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len > 0) {
+        render_append(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+/**
+ * @brief Formats an int like printf("%-*d"): left-justified, padded with
+ * spaces to at least width characters.
+ *
+ * @return Pointer just past the written characters.
+ */
+char *format_padded_int(char *out, int value, int width) {
+    char digits[12];
+    int n = 0;
+    unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+
+    char *start = out;
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    while (out - start < width) {
+        *out++ = ' ';
+    }
+    return out;
+}
+
+/**
+ * @brief Formats a double like printf("%-*.2f").
+ *
+ * The value is scaled to hundredths and rounded exactly as printf does
+ * (round half to even on the exact binary value): fma() recovers the
+ * rounding error of the scaling, which decides the rare cases where the
+ * scaled value lands on .5. Values too large for this, NaN and infinities
+ * go through snprintf.
+ * @return Pointer just past the written characters.
+ */
+char *format_fixed2(char *out, double value, int width) {
+    double magnitude = fabs(value);
+    if (!(magnitude < 4e13)) { // beyond this, scaled values lose the fraction bits
+        return out + snprintf(out, ROW_FORMAT_SLACK, "%-*.2f", width, value);
+    }
+
+    double scaled = magnitude * 100.0;
+    double error = fma(magnitude, 100.0, -scaled); // exact: magnitude*100 == scaled + error
+    double whole = floor(scaled);
+    double fraction = scaled - whole;
+    unsigned long long cents = (unsigned long long)whole;
+    if (fraction > 0.5 || (fraction == 0.5 && (error > 0 || (error == 0 && (cents & 1))))) {
+        cents++;
+    }
+
+    char *start = out;
+    if (signbit(value)) {
+        *out++ = '-';
+    }
+    char digits[24];
+    int n = 0;
+    unsigned long long units = cents / 100;
+    do {
+        digits[n++] = (char)('0' + units % 10);
+        units /= 10;
+    } while (units != 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    *out++ = '.';
+    *out++ = (char)('0' + (cents / 10) % 10);
+    *out++ = (char)('0' + cents % 10);
+    while (out - start < width) {
+        *out++ = ' ';
+    }
+    return out;
+}
+
+/**
+ * @brief Formats one table row exactly like
+ * printf("| %-5d | %-25s | %-10.2f | %-5c |\n", ...).
+ *
+ * @param out Destination; needs strlen(name) + ROW_FORMAT_SLACK bytes.
+ * @return Number of bytes written.
+ */
+size_t format_student_row(char *out, int id, const char *name, double score) {
+    char *p = out;
+    *p++ = '|';
+    *p++ = ' ';
+    p = format_padded_int(p, id, 5);
+    *p++ = ' ';
+    *p++ = '|';
+    *p++ = ' ';
+    size_t len = strlen(name);
+    memcpy(p, name, len);
+    p += len;
+    for (size_t i = len; i < 25; i++) {
+        *p++ = ' ';
+    }
+    *p++ = ' ';
+    *p++ = '|';
+    *p++ = ' ';
+    p = format_fixed2(p, score, 10);
+    memcpy(p, " | ", 3);
+    p += 3;
+    *p++ = get_letter_grade(score);
+    memcpy(p, "     |\n", 7);
+    p += 7;
+    return (size_t)(p - out);
+}
+
+/**
+ * @brief Compares the buffered renderer with per-row printf.
+ *
+ * Run with "--bench-render". Checks that both produce the same bytes for a
+ * synthetic roster (plus awkward rounding cases) and reports rows/sec for
+ * each, writing to /dev/null.
+ */
+void run_render_benchmark() {
+    const size_t n = 2000000;
+    Student s;
+    memset(&s, 0, sizeof(s));
+    for (size_t i = 0; i < n; i++) {
+        s.id = (int)i - 1000;
+        snprintf(s.name, MAX_NAME_LENGTH, "Student %zu", i * 7919 % 100000);
+        s.score = (double)(i % 1000001) / 10000.0; // exercises half-way rounding
+        if (i % 97 == 0) {
+            s.score = (double)(i % 201) * 0.005;
+        }
+        if (store_append(&s) != STORE_OK) {
+            printf("Out of memory.\n");
+            return;
+        }
+    }
+
+    size_t mismatches = 0;
+    char expected[512], actual[512];
+    for (size_t i = 0; i < n; i++) {
+        int len = snprintf(expected, sizeof(expected), "| %-5d | %-25s | %-10.2f | %-5c |\n",
+                           student_id(i), student_name(i), student_score(i), get_letter_grade(student_score(i)));
+        size_t got = format_student_row(actual, student_id(i), student_name(i), student_score(i));
+        if (got != (size_t)len || memcmp(expected, actual, got) != 0) {
+            if (mismatches++ == 0) {
+                printf("First mismatch at row %zu:\n%s%.*s", i, expected, (int)got, actual);
+            }
+        }
+    }
+    printf("Byte-identical rows: %zu of %zu\n", n - mismatches, n);
+
+    FILE *null_out = fopen("/dev/null", "w");
+    if (null_out == NULL) {
+        store_reset();
+        return;
+    }
+    double start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        double score = student_score(i);
+        fprintf(null_out, "| %-5d | %-25s | %-10.2f | %-5c |\n",
+                student_id(i), student_name(i), score, get_letter_grade(score));
+    }
+    fflush(null_out);
+    double printf_time = now_seconds() - start;
+    fclose(null_out);
+
+    // Point stdout at /dev/null for the buffered path
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    start = now_seconds();
+    for (size_t i = 0; i < n; i++) {
+        print_student_row(i);
+    }
+    render_flush();
+    double render_time = now_seconds() - start;
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null_fd);
+
+    printf("%-10s | %-14s\n", "Renderer", "Rows/sec");
+    printf("%-10s | %-14.0f\n", "printf", n / printf_time);
+    printf("%-10s | %-14.0f\n", "buffered", n / render_time);
+    store_reset();
+}
+
+/**
+ * @brief Prepares an empty statistics accumulator.
+ */
+void stats_init(StatsAccumulator *acc) {
+    memset(acc, 0, sizeof(*acc));
+    acc->min = INFINITY;
+    acc->max = -INFINITY;
+}
+
+/**
+ * @brief Adds a value to a Kahan-compensated sum.
+ *
+ * @param sum The running sum.
+ * @param c The running compensation (lost low-order bits).
+ * @param value The value to add.
+ */
+void kahan_add(double *sum, double *c, double value) {
+    double y = value - *c;
+    double t = *sum + y;
+    *c = (t - *sum) - y;
+    *sum = t;
+}
+
+/**
+ * @brief Portable statistics kernel, used when AVX2 is unavailable.
+ */
+void stats_kernel_scalar(StatsAccumulator *acc, const double *scores, size_t n, size_t stride) {
+    if (n == 0) {
+        return;
+    }
+    if (acc->count == 0) {
+        acc->shift = scores[0];
+    }
+    for (size_t i = 0; i < n; i++) {
+        double x = scores[i * stride];
+        double d = x - acc->shift;
+        kahan_add(&acc->sum, &acc->sum_c, x);
+        kahan_add(&acc->dev, &acc->dev_c, d);
+        kahan_add(&acc->dev_sq, &acc->dev_sq_c, d * d);
+        if (x < acc->min) acc->min = x;
+        if (x > acc->max) acc->max = x;
+    }
+    acc->count += n;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * @brief AVX2 statistics kernel.
+ *
+ * Keeps four independent compensated lanes per sum and folds them into the
+ * accumulator at the end of the run. Strided (AoS) runs are loaded with a
+ * gather; the tail is handed to the scalar kernel.
+ */
+__attribute__((target("avx2")))
+void stats_kernel_avx2(StatsAccumulator *acc, const double *scores, size_t n, size_t stride) {
+    if (n < 4) {
+        stats_kernel_scalar(acc, scores, n, stride);
+        return;
+    }
+    if (acc->count == 0) {
+        acc->shift = scores[0];
+    }
+
+    __m256d shift = _mm256_set1_pd(acc->shift);
+    __m256d sum = _mm256_setzero_pd(), sum_c = _mm256_setzero_pd();
+    __m256d dev = _mm256_setzero_pd(), dev_c = _mm256_setzero_pd();
+    __m256d sq = _mm256_setzero_pd(), sq_c = _mm256_setzero_pd();
+    __m256d vmin = _mm256_set1_pd(INFINITY), vmax = _mm256_set1_pd(-INFINITY);
+    __m256i index = _mm256_set_epi64x(3 * (long long)stride, 2 * (long long)stride, (long long)stride, 0);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = stride == 1 ? _mm256_loadu_pd(scores + i)
+                                : _mm256_i64gather_pd(scores + i * stride, index, 8);
+        __m256d d = _mm256_sub_pd(x, shift);
+        __m256d y, t;
+
+        y = _mm256_sub_pd(x, sum_c);
+        t = _mm256_add_pd(sum, y);
+        sum_c = _mm256_sub_pd(_mm256_sub_pd(t, sum), y);
+        sum = t;
+
+        y = _mm256_sub_pd(d, dev_c);
+        t = _mm256_add_pd(dev, y);
+        dev_c = _mm256_sub_pd(_mm256_sub_pd(t, dev), y);
+        dev = t;
+
+        y = _mm256_sub_pd(_mm256_mul_pd(d, d), sq_c);
+        t = _mm256_add_pd(sq, y);
+        sq_c = _mm256_sub_pd(_mm256_sub_pd(t, sq), y);
+        sq = t;
+
+        vmin = _mm256_min_pd(vmin, x);
+        vmax = _mm256_max_pd(vmax, x);
+    }
+
+    double lanes[6][4];
+    _mm256_storeu_pd(lanes[0], sum);
+    _mm256_storeu_pd(lanes[1], sum_c);
+    _mm256_storeu_pd(lanes[2], dev);
+    _mm256_storeu_pd(lanes[3], dev_c);
+    _mm256_storeu_pd(lanes[4], sq);
+    _mm256_storeu_pd(lanes[5], sq_c);
+    double mins[4], maxs[4];
+    _mm256_storeu_pd(mins, vmin);
+    _mm256_storeu_pd(maxs, vmax);
+    for (int k = 0; k < 4; k++) {
+        kahan_add(&acc->sum, &acc->sum_c, lanes[0][k] - lanes[1][k]);
+        kahan_add(&acc->dev, &acc->dev_c, lanes[2][k] - lanes[3][k]);
+        kahan_add(&acc->dev_sq, &acc->dev_sq_c, lanes[4][k] - lanes[5][k]);
+        if (mins[k] < acc->min) acc->min = mins[k];
+        if (maxs[k] > acc->max) acc->max = maxs[k];
+    }
+    acc->count += i;
+
+    stats_kernel_scalar(acc, scores + i * stride, n - i, stride);
+}
+#endif
+
+/**
+ * @brief Picks the fastest statistics kernel the running CPU supports.
+ */
+StatsKernel select_stats_kernel() {
+#ifdef HAVE_X86_SIMD
+    if (use_simd && __builtin_cpu_supports("avx2")) {
+        return stats_kernel_avx2;
+    }
+#endif
+    return stats_kernel_scalar;
+}
+
+/**
+ * @brief Feeds the whole score column through the statistics kernel.
+ */
+void store_scan_stats(StatsAccumulator *acc) {
+    static StatsKernel kernel = NULL;
+    if (kernel == NULL) {
+        kernel = select_stats_kernel();
+    }
+
+    const double *scores;
+    size_t stride;
+    size_t run;
+    for (size_t start = 0; (run = store_score_run(start, &scores, &stride)) > 0; start += run) {
+        if (scores != NULL) {
+            kernel(acc, scores, run, stride);
+        }
+    }
+}
+
+/**
+ * @brief Turns an accumulator into count, sum, mean, min, max and variance.
+ */
+ScoreStats stats_finish(const StatsAccumulator *acc) {
+    ScoreStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.count = acc->count;
+    if (acc->count == 0) {
+        return stats;
+    }
+    double mean_dev = acc->dev / acc->count;
+    stats.sum = acc->sum;
+    stats.mean = acc->sum / acc->count;
+    stats.min = acc->min;
+    stats.max = acc->max;
+    stats.variance = acc->dev_sq / acc->count - mean_dev * mean_dev;
+    if (stats.variance < 0.0) {
+        stats.variance = 0.0;
+    }
+    return stats;
+}
+
+/**
+ * @brief Computes count, sum, mean, min, max and variance in one pass over
+ * the score column.
+ */
+ScoreStats store_compute_stats() {
+    StatsAccumulator acc;
+    stats_init(&acc);
+    store_reduce(&acc, NULL, NULL);
+    return stats_finish(&acc);
+}
+
+/**
+ * @brief Maps a letter grade to its slot in ScoreAggregates.grade_counts.
+ */
+int grade_index(char grade) {
+    switch (grade) {
+        case 'A': return 0;
+        case 'B': return 1;
+        case 'C': return 2;
+        case 'D': return 3;
+        default: return 4;
+    }
+}
+
+/**
+ * @brief Maps a score to its bin in ScoreAggregates.score_bins (the
+ * nearest multiple of 0.01, clamped to 0-100).
+ */
+int score_bin(double score) {
+    if (!(score > 0.0)) {
+        return 0;
+    }
+    if (score >= 100.0) {
+        return SCORE_SKETCH_BINS - 1;
+    }
+    return (int)(score * 100.0 + 0.5);
+}
+
+/**
+ * @brief Empties the running totals.
+ */
+void aggregates_reset() {
+    memset(&score_totals, 0, sizeof(score_totals));
+    stats_init(&score_totals.stats);
+}
+
+/**
+ * @brief Folds one newly stored score into the running totals.
+ */
+void aggregates_add(double score) {
+    totals_write_begin();
+    stats_kernel_scalar(&score_totals.stats, &score, 1, 1);
+    score_totals.grade_counts[grade_index(get_letter_grade(score))]++;
+    totals_write_end();
+    score_totals.score_bins[score_bin(score)]++;
+}
+
+/**
+ * @brief Takes the score of a deleted (or replaced) row out of the running
+ * totals.
+ *
+ * The sums are compensated, so subtracting is as exact as adding. The
+ * minimum or maximum may go with the row, in which case the new one is
+ * read from the score index (the row must already be out of it). Skipped
+ * while the totals are stale; they are then rebuilt without the row.
+ */
+void aggregates_remove(double score) {
+    if (score_totals.stale) {
+        return;
+    }
+    StatsAccumulator *acc = &score_totals.stats;
+    totals_write_begin();
+    if (acc->count == 1) {
+        stats_init(acc);
+    } else {
+        double d = score - acc->shift;
+        kahan_add(&acc->sum, &acc->sum_c, -score);
+        kahan_add(&acc->dev, &acc->dev_c, -d);
+        kahan_add(&acc->dev_sq, &acc->dev_sq_c, -(d * d));
+        acc->count--;
+        if (score == acc->min) {
+            acc->min = score_index_select(0);
+        }
+        if (score == acc->max) {
+            acc->max = score_index_select(acc->count - 1);
+        }
+    }
+    score_totals.grade_counts[grade_index(get_letter_grade(score))]--;
+    totals_write_end();
+    score_totals.score_bins[score_bin(score)]--;
+}
+
+/**
+ * @brief Marks the start of a change to the totals that views read (the
+ * stats, grade counts and stale flag) by making the sequence odd.
+ */
+void totals_write_begin() {
+    __atomic_store_n(&score_totals.sequence, score_totals.sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Publishes a change started with totals_write_begin().
+ */
+void totals_write_end() {
+    __atomic_store_n(&score_totals.sequence, score_totals.sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copies the running totals for a thread other than the writer.
+ *
+ * A sequence lock: the copy is retried if the writer changed the totals
+ * meanwhile, which takes it nanoseconds, so readers never block.
+ * @param grade_counts Receives GRADE_COUNT counts, or NULL.
+ * @return 1, or 0 if the totals were not built since a snapshot load (the
+ * caller scans a view instead).
+ */
+int store_read_totals(StatsAccumulator *stats, size_t *grade_counts) {
+    unsigned long before, after;
+    int stale;
+    do {
+        before = __atomic_load_n(&score_totals.sequence, __ATOMIC_ACQUIRE);
+        stale = score_totals.stale;
+        *stats = score_totals.stats;
+        if (grade_counts != NULL) {
+            memcpy(grade_counts, score_totals.grade_counts, sizeof(score_totals.grade_counts));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&score_totals.sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) != 0 || before != after);
+    return !stale;
+}
+
+/**
+ * @brief Recomputes the running totals from the store if rows were loaded
+ * without them (a snapshot load), so startup does not pay for the scan.
+ */
+void store_ensure_aggregates() {
+    if (!score_totals.stale) {
+        return;
+    }
+    // Reduce into locals so views keep reading the old totals meanwhile
+    StatsAccumulator stats;
+    size_t grade_counts[GRADE_COUNT] = {0};
+    stats_init(&stats);
+    memset(score_totals.score_bins, 0, sizeof(score_totals.score_bins));
+    store_reduce(&stats, grade_counts, score_totals.score_bins);
+
+    totals_write_begin();
+    score_totals.stats = stats;
+    memcpy(score_totals.grade_counts, grade_counts, sizeof(grade_counts));
+    score_totals.stale = 0;
+    totals_write_end();
+}
+
+/**
+ * @brief Checks the running totals against a full rescan of the store.
+ *
+ * Counts, minimum, maximum and sketch bins must match exactly; sums and
+ * variance may differ in the last bits because the rescan adds in a
+ * different order.
+ * @return 1 if they agree, 0 (after printing the difference) otherwise.
+ */
+int aggregates_match_rescan() {
+    ScoreStats live = stats_finish(&score_totals.stats);
+    StatsAccumulator acc;
+    size_t counts[GRADE_COUNT] = {0};
+    size_t *bins = calloc(SCORE_SKETCH_BINS, sizeof(size_t));
+    if (bins == NULL) {
+        printf("Check skipped: out of memory.\n");
+        return 1;
+    }
+    stats_init(&acc);
+    store_reduce(&acc, counts, bins);
+    ScoreStats scan = stats_finish(&acc);
+
+    double tolerance = 1e-9 * (fabs(scan.mean) + 1.0);
+    int ok = live.count == scan.count && live.min == scan.min && live.max == scan.max &&
+             fabs(live.mean - scan.mean) <= tolerance &&
+             fabs(live.variance - scan.variance) <= 1e-9 * (scan.variance + 1.0) &&
+             memcmp(counts, score_totals.grade_counts, sizeof(counts)) == 0 &&
+             memcmp(bins, score_totals.score_bins, SCORE_SKETCH_BINS * sizeof(size_t)) == 0;
+    free(bins);
+    if (!ok) {
+        printf("Check failed: running totals (n=%zu mean=%.17g var=%.17g) "
+               "differ from a rescan (n=%zu mean=%.17g var=%.17g).\n",
+               live.count, live.mean, live.variance, scan.count, scan.mean, scan.variance);
+    }
+    return ok;
+}
+
+/**
+ * @brief Starts the worker threads if they are not running yet.
+ *
+ * @return 1 if at least one worker is available, 0 if the pool is
+ * configured for a single thread or no thread could be created.
+ */
+int pool_start() {
+    if (pool.started > 0) {
+        return 1;
+    }
+    if (pool.thread_count == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        pool.thread_count = cores > 0 ? (size_t)cores : 1;
+    }
+    if (pool.thread_count > MAX_POOL_THREADS) {
+        pool.thread_count = MAX_POOL_THREADS;
+    }
+    pool.stop = 0;
+    while (pool.started + 1 < pool.thread_count) {
+        if (pthread_create(&pool.workers[pool.started], NULL, pool_worker_main, NULL) != 0) {
+            break; // run with the workers we have
+        }
+        pool.started++;
+    }
+    return pool.started > 0;
+}
+
+/**
+ * @brief Body of a pool worker: waits for a job, helps with it, repeats.
+ */
+void *pool_worker_main(void *arg) {
+    (void)arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (!pool.stop && pool.generation == seen) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        if (pool.stop) {
+            break;
+        }
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+        pool_work();
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+/**
+ * @brief Claims and runs tasks of the current job until none are left.
+ */
+void pool_work() {
+    size_t index;
+    while ((index = __atomic_fetch_add(&pool.next_task, 1, __ATOMIC_RELAXED)) < pool.task_count) {
+        pool.task(index, pool.arg);
+    }
+}
+
+/**
+ * @brief Runs task(0 .. task_count-1, arg) on the pool and waits for all of
+ * them. Falls back to running them on the calling thread.
+ */
+void pool_run(size_t task_count, PoolTask task, void *arg) {
+    if (!pool_start()) {
+        for (size_t i = 0; i < task_count; i++) {
+            task(i, arg);
+        }
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.task = task;
+    pool.arg = arg;
+    pool.task_count = task_count;
+    pool.next_task = 0;
+    pool.busy = pool.started;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    pool_work();
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * @brief Stops and joins the worker threads.
+ */
+void pool_stop() {
+    if (pool.started == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t i = 0; i < pool.started; i++) {
+        pthread_join(pool.workers[i], NULL);
+    }
+    pool.started = 0;
+}
+
+/**
+ * @brief Folds a partial accumulator into another one.
+ *
+ * The partial's deviations were taken around its own shift; they are moved
+ * to the target's shift before being added, so the one-pass variance stays
+ * free of cancellation.
+ */
+void stats_merge(StatsAccumulator *acc, const StatsAccumulator *part) {
+    if (part->count == 0) {
+        return;
+    }
+    if (acc->count == 0) {
+        *acc = *part;
+        return;
+    }
+    double delta = part->shift - acc->shift;
+    double n = (double)part->count;
+    kahan_add(&acc->sum, &acc->sum_c, part->sum);
+    kahan_add(&acc->sum, &acc->sum_c, -part->sum_c);
+    // sum (x - s) = sum (x - s_part) + n * (s_part - s)
+    kahan_add(&acc->dev, &acc->dev_c, part->dev - part->dev_c);
+    kahan_add(&acc->dev, &acc->dev_c, n * delta);
+    // sum (x - s)^2 = sum (x - s_part)^2 + 2 (s_part - s) sum (x - s_part) + n (s_part - s)^2
+    kahan_add(&acc->dev_sq, &acc->dev_sq_c, part->dev_sq - part->dev_sq_c);
+    kahan_add(&acc->dev_sq, &acc->dev_sq_c, 2.0 * delta * (part->dev - part->dev_c));
+    kahan_add(&acc->dev_sq, &acc->dev_sq_c, n * delta * delta);
+    if (part->min < acc->min) acc->min = part->min;
+    if (part->max > acc->max) acc->max = part->max;
+    acc->count += part->count;
+}
+
+/**
+ * @brief Reduces rows [index * REDUCE_TASK_ROWS, ...) into the job's
+ * partials[index].
+ *
+ * REDUCE_TASK_ROWS divides STUDENT_CHUNK_SIZE, so a task never straddles
+ * two arena chunks.
+ */
+void reduce_task(size_t index, void *arg) {
+    const ReduceJob *job = arg;
+    ReducePartial *part = &job->partials[index];
+    const double *scores;
+    size_t stride;
+    size_t run;
+    size_t end = (index + 1) * REDUCE_TASK_ROWS;
+    for (size_t start = index * REDUCE_TASK_ROWS;
+         start < end && (run = store_score_run(start, &scores, &stride)) > 0; start += run) {
+        if (run > end - start) {
+            run = end - start;
+        }
+        if (scores == NULL) {
+            continue; // deleted rows
+        }
+        job->kernel(&part->stats, scores, run, stride);
+        for (size_t i = 0; i < run; i++) {
+            part->grade_counts[grade_index(get_letter_grade(scores[i * stride]))]++;
+        }
+        if (job->score_bins != NULL) {
+            // integer adds commute, so sharing the bins keeps the result deterministic
+            for (size_t i = 0; i < run; i++) {
+                __atomic_fetch_add(&job->score_bins[score_bin(scores[i * stride])], 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Accumulates the statistics of the whole score column, plus the
+ * per-grade histogram and the sketch bins when those are not NULL.
+ *
+ * Rosters of at least pool.threshold rows are split into
+ * REDUCE_TASK_ROWS-sized tasks run on the thread pool. The partial results
+ * are merged in task order, so the answer does not depend on the number of
+ * threads or on which thread ran which task.
+ */
+void store_reduce(StatsAccumulator *acc, size_t *grade_counts, size_t *score_bins) {
+    size_t task_count = (student_count + REDUCE_TASK_ROWS - 1) / REDUCE_TASK_ROWS;
+    ReducePartial *partials = NULL;
+    if (student_count >= pool.threshold && pool.thread_count != 1) {
+        partials = malloc(task_count * sizeof(ReducePartial));
+    }
+    if (partials == NULL) {
+        // Small roster (or out of memory): one pass on this thread
+        store_scan_stats(acc);
+        for (size_t i = 0; (grade_counts != NULL || score_bins != NULL) && i < student_count; i++) {
+            if (student_dead(i)) {
+                continue;
+            }
+            double score = student_score(i);
+            if (grade_counts != NULL) {
+                grade_counts[grade_index(get_letter_grade(score))]++;
+            }
+            if (score_bins != NULL) {
+                score_bins[score_bin(score)]++;
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < task_count; i++) {
+        stats_init(&partials[i].stats);
+        memset(partials[i].grade_counts, 0, sizeof(partials[i].grade_counts));
+    }
+    ReduceJob job = {select_stats_kernel(), partials, score_bins};
+    pool_run(task_count, reduce_task, &job);
+    for (size_t i = 0; i < task_count; i++) {
+        stats_merge(acc, &partials[i].stats);
+        if (grade_counts != NULL) {
+            for (int g = 0; g < GRADE_COUNT; g++) {
+                grade_counts[g] += partials[i].grade_counts[g];
+            }
+        }
+    }
+    free(partials);
+}
+
+/**
+ * @brief Returns the score with the given rank (0 = lowest) according to
+ * the sketch, i.e. the centre of the bin holding that rank.
+ */
+double sketch_select(const size_t *bins, size_t rank) {
+    size_t seen = 0;
+    for (int b = 0; b < SCORE_SKETCH_BINS; b++) {
+        seen += bins[b];
+        if (rank < seen) {
+            return b / 100.0;
+        }
+    }
+    return 100.0;
+}
+
+/**
+ * @brief Computes the q-quantile (0 <= q <= 1) of all scores.
+ *
+ * Uses linear interpolation between the two nearest ranks, so q = 0.5 of
+ * an even-sized roster is the mean of the two middle scores. The exact
+ * answer comes from two O(log n) rank selections in the ordered score
+ * index; the approximate one from the running sketch, which needs no index
+ * and is off by at most 0.005. The sketch is not saved in snapshots, so
+ * after a load the first approximate query fills it with one pass over
+ * the scores (store_ensure_aggregates()), still no sort.
+ * @param approximate Nonzero to read the sketch.
+ * @return The quantile, or NAN if there are no students or an index
+ * cannot be built.
+ */
+double score_quantile(double q, int approximate) {
+    size_t n = store_live_count();
+    if (n == 0) {
+        return NAN;
+    }
+    if (approximate) {
+        store_ensure_aggregates();
+    } else if (!store_ensure_indexes()) {
+        return NAN;
+    }
+    double h = (n - 1) * q;
+    size_t below = (size_t)h;
+    size_t above = below + 1 < n ? below + 1 : below;
+    double low, high;
+    if (approximate) {
+        low = sketch_select(score_totals.score_bins, below);
+        high = sketch_select(score_totals.score_bins, above);
+    } else {
+        low = score_index_select(below);
+        high = score_index_select(above);
+    }
+    return low + (h - below) * (high - low);
+}
+
+/**
+ * @brief Tells whether entry a ranks ahead of entry b.
+ *
+ * Entries are totally ordered by (score, row), so every query has one
+ * answer however the work is split; for the top ranking the order is
+ * simply reversed.
+ */
+int ranks_before(const ScoreEntry *a, const ScoreEntry *b, int top) {
+    return top ? score_entry_less(b, a) : score_entry_less(a, b);
+}
+
+/**
+ * @brief Offers a candidate to a bounded heap in O(log k).
+ */
+void rank_heap_push(RankHeap *heap, double score, size_t row) {
+    ScoreEntry entry = {score, row};
+    ScoreEntry *e = heap->entries;
+    size_t i;
+    if (heap->count < heap->k) {
+        // sift up: parents rank after their children
+        i = heap->count++;
+        while (i > 0 && ranks_before(&e[(i - 1) / 2], &entry, heap->top)) {
+            e[i] = e[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        e[i] = entry;
+        return;
+    }
+    if (heap->k == 0 || !ranks_before(&entry, &e[0], heap->top)) {
+        return;
+    }
+    // replace the root and sift down
+    i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && ranks_before(&e[child], &e[child + 1], heap->top)) {
+            child++;
+        }
+        if (!ranks_before(&entry, &e[child], heap->top)) {
+            break;
+        }
+        e[i] = e[child];
+        i = child;
+    }
+    e[i] = entry;
+}
+
+/**
+ * @brief Empties a heap into 'rows', best-ranked first.
+ *
+ * @return Number of rows written.
+ */
+size_t rank_heap_drain(RankHeap *heap, size_t *rows) {
+    size_t n = heap->count;
+    // popping the root always yields the worst remaining entry
+    while (heap->count > 0) {
+        ScoreEntry *e = heap->entries;
+        rows[heap->count - 1] = e[0].row;
+        ScoreEntry last = e[--heap->count];
+        size_t i = 0;
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= heap->count) {
+                break;
+            }
+            if (child + 1 < heap->count && ranks_before(&e[child], &e[child + 1], heap->top)) {
+                child++;
+            }
+            if (!ranks_before(&last, &e[child], heap->top)) {
+                break;
+            }
+            e[i] = e[child];
+            i = child;
+        }
+        e[i] = last;
+    }
+    return n;
+}
+
+/**
+ * @brief Scans one arena chunk into the job's heaps[index].
+ */
+void rank_task(size_t index, void *arg) {
+    const RankJob *job = arg;
+    RankHeap *heap = &job->heaps[index];
+    const double *scores;
+    size_t stride;
+    size_t run;
+    size_t end = (index + 1) * STUDENT_CHUNK_SIZE;
+    for (size_t start = index * STUDENT_CHUNK_SIZE;
+         start < end && (run = store_score_run(start, &scores, &stride)) > 0; start += run) {
+        for (size_t i = 0; scores != NULL && i < run; i++) {
+            rank_heap_push(heap, scores[i * stride], start + i);
+        }
+    }
+}
+
+/**
+ * @brief Finds the k students with the highest (top) or lowest scores,
+ * best-ranked first; equal scores are ordered by row.
+ *
+ * With the score index built this walks its leaf chain from the right
+ * rank, in O(log n + k). Straight after a snapshot load the index is not
+ * built yet, so instead of building it every arena chunk is scanned on the
+ * thread pool into its own bounded heap (O(n log k) in total) and the
+ * per-chunk heaps are merged.
+ * @param rows Receives up to k rows; k must not exceed MAX_RANK_K.
+ * @return Number of rows written (less than k if the roster is smaller),
+ * or 0 if memory is exhausted.
+ */
+size_t store_rank_students(int top, size_t k, size_t *rows) {
+    size_t live = store_live_count();
+    if (k > live) {
+        k = live;
+    }
+    if (k == 0) {
+        return 0;
+    }
+
+    if (!indexes_stale) {
+        size_t first = top ? live - k : 0;
+        int pos;
+        ScoreNode *leaf = score_index_locate(first, &pos);
+        for (size_t i = 0; i < k; i++) {
+            rows[top ? k - 1 - i : i] = leaf->keys[pos].row;
+            if (++pos == leaf->count) {
+                leaf = score_leaf_next(leaf);
+                pos = 0;
+            }
+        }
+        return k;
+    }
+
+    size_t chunk_count = (student_count + STUDENT_CHUNK_SIZE - 1) / STUDENT_CHUNK_SIZE;
+    RankHeap *heaps = calloc(chunk_count + 1, sizeof(RankHeap));
+    ScoreEntry *entries = malloc((chunk_count + 1) * k * sizeof(ScoreEntry));
+    if (heaps == NULL || entries == NULL) {
+        free(heaps);
+        free(entries);
+        return 0;
+    }
+    for (size_t c = 0; c <= chunk_count; c++) {
+        heaps[c].entries = entries + c * k;
+        heaps[c].k = k;
+        heaps[c].top = top;
+    }
+    RankJob job = {heaps};
+    if (student_count >= pool.threshold && pool.thread_count != 1) {
+        pool_run(chunk_count, rank_task, &job);
+    } else {
+        for (size_t c = 0; c < chunk_count; c++) {
+            rank_task(c, &job);
+        }
+    }
+
+    // merge the chunk winners into the last heap
+    RankHeap *merged = &heaps[chunk_count];
+    for (size_t c = 0; c < chunk_count; c++) {
+        for (size_t i = 0; i < heaps[c].count; i++) {
+            rank_heap_push(merged, heaps[c].entries[i].score, heaps[c].entries[i].row);
+        }
+    }
+    size_t found = rank_heap_drain(merged, rows);
+    free(heaps);
+    free(entries);
+    return found;
+}
+
+/**
+ * @brief Returns the kernel that evaluates nodes of the given kind.
+ */
+FilterKernel filter_kernel_for(FilterKind kind) {
+    switch (kind) {
+        case FILTER_FALSE: return filter_kernel_false;
+        case FILTER_TRUE: return filter_kernel_true;
+        case FILTER_ID: return filter_kernel_id;
+        case FILTER_SCORE: return filter_kernel_score;
+        case FILTER_NAME: return filter_kernel_name;
+        case FILTER_NAME_SET: return filter_kernel_name_set;
+        case FILTER_AND: return filter_kernel_and;
+        case FILTER_OR: return filter_kernel_or;
+        default: return filter_kernel_not;
+    }
+}
+
+/**
+ * @brief Allocates a filter node of the given kind.
+ *
+ * @return The node, or NULL if memory is exhausted.
+ */
+FilterNode *filter_node(FilterKind kind) {
+    FilterNode *node = calloc(1, sizeof(FilterNode));
+    if (node != NULL) {
+        node->kind = kind;
+        node->kernel = filter_kernel_for(kind);
+    }
+    return node;
+}
+
+/**
+ * @brief Frees a filter node and everything below it.
+ */
+void filter_free(FilterNode *node) {
+    if (node == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < node->child_count; i++) {
+        filter_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->name_bits);
+    free(node);
+}
+
+/**
+ * @brief Appends a child to an AND, OR or NOT node.
+ *
+ * @return 1 on success, 0 if memory is exhausted (the child is not freed).
+ */
+int filter_add_child(FilterNode *node, FilterNode *child) {
+    FilterNode **children = realloc(node->children, (node->child_count + 1) * sizeof(FilterNode *));
+    if (children == NULL) {
+        return 0;
+    }
+    node->children = children;
+    node->children[node->child_count++] = child;
+    return 1;
+}
+
+/**
+ * @brief Combines nodes into "left AND right", "left OR right" or "NOT left".
+ *
+ * Constants are folded, a double negation cancels out and chains of the
+ * same operator are flattened into one node, so the tree the kernels walk
+ * stays shallow.
+ * @return The combined node, or NULL if memory is exhausted (the operands
+ * are freed either way).
+ */
+FilterNode *filter_combine(FilterKind kind, FilterNode *left, FilterNode *right) {
+    if (kind == FILTER_NOT) {
+        if (left->kind == FILTER_TRUE || left->kind == FILTER_FALSE) {
+            left->kind = left->kind == FILTER_TRUE ? FILTER_FALSE : FILTER_TRUE;
+            left->kernel = filter_kernel_for(left->kind);
+            return left;
+        }
+        if (left->kind == FILTER_NOT) {
+            FilterNode *inner = left->children[0];
+            left->child_count = 0;
+            filter_free(left);
+            return inner;
+        }
+        FilterNode *node = filter_node(FILTER_NOT);
+        if (node == NULL || !filter_add_child(node, left)) {
+            filter_free(node);
+            filter_free(left);
+            return NULL;
+        }
+        return node;
+    }
+
+    // a constant either decides the result or drops out
+    FilterKind decisive = kind == FILTER_AND ? FILTER_FALSE : FILTER_TRUE;
+    if (left->kind == decisive || right->kind == (kind == FILTER_AND ? FILTER_TRUE : FILTER_FALSE)) {
+        filter_free(right);
+        return left;
+    }
+    if (right->kind == decisive || left->kind == (kind == FILTER_AND ? FILTER_TRUE : FILTER_FALSE)) {
+        filter_free(left);
+        return right;
+    }
+
+    FilterNode *node = left;
+    if (left->kind != kind) {
+        node = filter_node(kind);
+        if (node == NULL || !filter_add_child(node, left)) {
+            filter_free(node);
+            filter_free(left);
+            filter_free(right);
+            return NULL;
+        }
+    }
+    int ok = 1;
+    if (right->kind == kind) {
+        for (size_t i = 0; ok && i < right->child_count; i++) {
+            ok = filter_add_child(node, right->children[i]);
+            if (ok) {
+                right->children[i] = NULL;
+            }
+        }
+        filter_free(right); // the moved children are NULL
+    } else {
+        ok = filter_add_child(node, right);
+        if (!ok) {
+            filter_free(right);
+        }
+    }
+    if (!ok) {
+        filter_free(node);
+        return NULL;
+    }
+    return node;
+}
+
+/**
+ * @brief Makes a node for score_low <= score <= score_high (kind
+ * FILTER_SCORE) or id_low <= id <= id_high (FILTER_ID).
+ *
+ * @return The node (FILTER_FALSE for an empty range), or NULL if memory is
+ * exhausted.
+ */
+FilterNode *filter_range(FilterKind kind, double low, double high) {
+    FilterNode *node = filter_node(low <= high ? kind : FILTER_FALSE);
+    if (node != NULL && kind == FILTER_ID) {
+        node->id_low = (long long)low;
+        node->id_high = (long long)high;
+    } else if (node != NULL) {
+        node->score_low = low;
+        node->score_high = high;
+    }
+    return node;
+}
+
+/**
+ * @brief Matches a name against a glob pattern ('*' for any run of
+ * characters, '?' for any one), ignoring case like the prefix search.
+ */
+int glob_match(const char *pattern, const char *name) {
+    const char *star = NULL; // pattern just past the last '*' seen
+    const char *resume = NULL;
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            star = ++pattern;
+            resume = name;
+        } else if (*pattern != '\0' && (*pattern == '?' || trie_fold(*pattern) == trie_fold(*name))) {
+            pattern++;
+            name++;
+        } else if (star != NULL) {
+            // let the last '*' swallow one more character and retry
+            pattern = star;
+            name = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+/**
+ * @brief Compiles "name = TEXT" (glob 0) or "name ~ PATTERN" (glob 1).
+ *
+ * Names are interned, so the pattern is tested once per distinct name in
+ * the arena rather than once per row. If no name matches the node is
+ * FILTER_FALSE, if exactly one does it compares name offsets (FILTER_NAME),
+ * and otherwise it looks the offsets up in a bitmap over the arena
+ * (FILTER_NAME_SET).
+ * @return The node, or NULL if memory is exhausted.
+ */
+FilterNode *filter_name_node(const char *pattern, int glob) {
+    const char *names = student_database.names;
+    size_t used = student_database.names_used;
+    uint64_t *bits = calloc(used / 64 + 1, sizeof(uint64_t));
+    if (bits == NULL) {
+        return NULL;
+    }
+    size_t matches = 0;
+    unsigned int first = 0;
+    for (size_t offset = 0; offset < used; offset += strlen(names + offset) + 1) {
+        if (glob ? glob_match(pattern, names + offset) : strcmp(pattern, names + offset) == 0) {
+            bits[offset >> 6] |= 1ull << (offset & 63);
+            if (matches++ == 0) {
+                first = (unsigned int)offset;
+            }
+        }
+    }
+
+    FilterNode *node = filter_node(matches == 0 ? FILTER_FALSE : matches == 1 ? FILTER_NAME : FILTER_NAME_SET);
+    if (node != NULL && matches > 1) {
+        node->name_bits = bits;
+        return node;
+    }
+    if (node != NULL) {
+        node->name = first;
+    }
+    free(bits);
+    return node;
+}
+
+/**
+ * @brief Records the first parse error, with its column.
+ *
+ * @return NULL, for the caller to return.
+ */
+FilterNode *filter_error(FilterParser *parser, const char *message) {
+    if (parser->error[0] == '\0') {
+        snprintf(parser->error, sizeof(parser->error), "%s at column %d", message,
+                 (int)(parser->p - parser->text) + 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tells whether a character can be part of a keyword.
+ */
+int filter_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/**
+ * @brief Skips blanks before the next token.
+ */
+void filter_skip_space(FilterParser *parser) {
+    while (*parser->p == ' ' || *parser->p == '\t') {
+        parser->p++;
+    }
+}
+
+/**
+ * @brief Consumes the given keyword or operator if it comes next.
+ *
+ * A keyword only matches as a whole word, so "id" does not match "idx".
+ * @return 1 if it was consumed, 0 otherwise.
+ */
+int filter_accept(FilterParser *parser, const char *token) {
+    filter_skip_space(parser);
+    size_t len = strlen(token);
+    if (strncmp(parser->p, token, len) != 0 ||
+        (filter_word_char(token[0]) && filter_word_char(parser->p[len]))) {
+        return 0;
+    }
+    parser->p += len;
+    return 1;
+}
+
+/**
+ * @brief Reads a finite decimal number.
+ *
+ * @return 1 on success, 0 if no number comes next.
+ */
+int filter_number(FilterParser *parser, double *value) {
+    filter_skip_space(parser);
+    char *end;
+    *value = strtod(parser->p, &end);
+    if (end == parser->p || !isfinite(*value) || filter_word_char(*end)) {
+        return 0;
+    }
+    parser->p = end;
+    return 1;
+}
+
+/**
+ * @brief Reads a string in double or single quotes (no escapes).
+ *
+ * @return 1 on success, 0 if no quoted string of fewer than 'size' bytes
+ * comes next.
+ */
+int filter_string(FilterParser *parser, char *out, size_t size) {
+    filter_skip_space(parser);
+    char quote = *parser->p;
+    if (quote != '"' && quote != '\'') {
+        return 0;
+    }
+    const char *end = strchr(parser->p + 1, quote);
+    if (end == NULL || (size_t)(end - parser->p - 1) >= size) {
+        return 0;
+    }
+    memcpy(out, parser->p + 1, (size_t)(end - parser->p - 1));
+    out[end - parser->p - 1] = '\0';
+    parser->p = end + 1;
+    return 1;
+}
+
+/**
+ * @brief Parses one comparison on id, score, name or grade.
+ */
+FilterNode *filter_parse_comparison(FilterParser *parser) {
+    filter_skip_space(parser);
+    int is_id = filter_accept(parser, "id");
+    if (is_id || filter_accept(parser, "score")) {
+        // every comparison becomes a closed range, or the negation of one
+        static const char *const ops[] = {"==", "!=", "<=", ">=", "=", "<", ">"};
+        double low, high;
+        int negate = 0;
+        if (filter_accept(parser, "between")) {
+            if (!filter_number(parser, &low) || !filter_accept(parser, "and") || !filter_number(parser, &high)) {
+                return filter_error(parser, "expected 'between LOW and HIGH'");
+            }
+        } else {
+            int op = 0;
+            while (op < 7 && !filter_accept(parser, ops[op])) {
+                op++;
+            }
+            double value;
+            if (op == 7) {
+                return filter_error(parser, "expected a comparison (=, !=, <, <=, >, >= or between)");
+            }
+            if (!filter_number(parser, &value)) {
+                return filter_error(parser, "expected a number");
+            }
+            if (is_id && !(value == floor(value) && fabs(value) < 1e15)) {
+                return filter_error(parser, "expected a whole number");
+            }
+            double below = is_id ? value - 1 : nextafter(value, -INFINITY);
+            double above = is_id ? value + 1 : nextafter(value, INFINITY);
+            low = -INFINITY;
+            high = INFINITY;
+            switch (op) {
+                case 0: case 4: low = high = value; break;
+                case 1: low = high = value; negate = 1; break;
+                case 2: high = value; break;
+                case 3: low = value; break;
+                case 5: high = below; break;
+                default: low = above; break;
+            }
+        }
+        if (is_id) {
+            // IDs are ints: clamp, and round a fractional 'between' inward
+            low = low < INT_MIN ? INT_MIN : ceil(low);
+            high = high > INT_MAX ? INT_MAX : floor(high);
+        }
+        FilterNode *node = filter_range(is_id ? FILTER_ID : FILTER_SCORE, low, high);
+        return node != NULL && negate ? filter_combine(FILTER_NOT, node, NULL) : node;
+    }
+
+    if (filter_accept(parser, "name")) {
+        int glob = 1, negate = 0;
+        if (filter_accept(parser, "!~")) {
+            negate = 1;
+        } else if (filter_accept(parser, "!=")) {
+            glob = 0;
+            negate = 1;
+        } else if (filter_accept(parser, "==") || filter_accept(parser, "=")) {
+            glob = 0;
+        } else if (!filter_accept(parser, "~")) {
+            return filter_error(parser, "expected =, !=, ~ or !~");
+        }
+        char pattern[FILTER_MAX_TEXT];
+        if (!filter_string(parser, pattern, sizeof(pattern))) {
+            return filter_error(parser, "expected a quoted name or pattern");
+        }
+        FilterNode *node = filter_name_node(pattern, glob);
+        return node != NULL && negate ? filter_combine(FILTER_NOT, node, NULL) : node;
+    }
+
+    if (filter_accept(parser, "grade")) {
+        int negate = filter_accept(parser, "!=");
+        if (!negate && !filter_accept(parser, "==") && !filter_accept(parser, "=")) {
+            return filter_error(parser, "expected = or !=");
+        }
+        char text[4];
+        if (!filter_string(parser, text, sizeof(text))) {
+            filter_skip_space(parser);
+            text[0] = *parser->p;
+            text[1] = '\0';
+            if (filter_word_char(text[0]) && !filter_word_char(parser->p[1])) {
+                parser->p++;
+            } else {
+                text[0] = '\0';
+            }
+        }
+        char grade = (char)(text[0] >= 'a' && text[0] <= 'z' ? text[0] - 'a' + 'A' : text[0]);
+        if (text[0] == '\0' || text[1] != '\0' || strchr("ABCDF", grade) == NULL) {
+            return filter_error(parser, "expected a grade (A, B, C, D or F)");
+        }
+        double low, high;
+        grade_band_bounds(grade, &low, &high);
+        FilterNode *node = filter_range(FILTER_SCORE, low, nextafter(high, -INFINITY));
+        return node != NULL && negate ? filter_combine(FILTER_NOT, node, NULL) : node;
+    }
+
+    return filter_error(parser, "expected id, score, name, grade, 'not' or '('");
+}
+
+/**
+ * @brief Parses "not X", "( X )" or a comparison.
+ */
+FilterNode *filter_parse_not(FilterParser *parser) {
+    if (++parser->depth > FILTER_MAX_DEPTH) {
+        return filter_error(parser, "expression nested too deeply");
+    }
+    FilterNode *node;
+    if (filter_accept(parser, "not")) {
+        node = filter_parse_not(parser);
+        if (node != NULL) {
+            node = filter_combine(FILTER_NOT, node, NULL);
+        }
+    } else if (filter_accept(parser, "(")) {
+        node = filter_parse_or(parser);
+        if (node != NULL && !filter_accept(parser, ")")) {
+            filter_free(node);
+            node = filter_error(parser, "expected ')'");
+        }
+    } else {
+        node = filter_parse_comparison(parser);
+    }
+    parser->depth--;
+    return node;
+}
+
+/**
+ * @brief Parses terms joined by "and".
+ */
+FilterNode *filter_parse_and(FilterParser *parser) {
+    FilterNode *node = filter_parse_not(parser);
+    while (node != NULL && filter_accept(parser, "and")) {
+        FilterNode *right = filter_parse_not(parser);
+        if (right == NULL) {
+            filter_free(node);
+            return NULL;
+        }
+        node = filter_combine(FILTER_AND, node, right);
+    }
+    return node;
+}
+
+/**
+ * @brief Parses terms joined by "or", which binds more loosely than "and".
+ */
+FilterNode *filter_parse_or(FilterParser *parser) {
+    FilterNode *node = filter_parse_and(parser);
+    while (node != NULL && filter_accept(parser, "or")) {
+        FilterNode *right = filter_parse_and(parser);
+        if (right == NULL) {
+            filter_free(node);
+            return NULL;
+        }
+        node = filter_combine(FILTER_OR, node, right);
+    }
+    return node;
+}
+
+/**
+ * @brief Sets the estimated per-row cost of a node and its subtree, and
+ * puts the cheapest children of every AND and OR first so they shrink the
+ * selection vector before the dearer ones run.
+ */
+void filter_order(FilterNode *node) {
+    switch (node->kind) {
+        case FILTER_FALSE:
+        case FILTER_TRUE:
+            node->cost = 0;
+            return;
+        case FILTER_ID:
+        case FILTER_SCORE:
+        case FILTER_NAME:
+            node->cost = 2; // one load and two compares
+            return;
+        case FILTER_NAME_SET:
+            node->cost = 3; // plus a bitmap lookup
+            return;
+        default:
+            break;
+    }
+    node->cost = 1;
+    for (size_t i = 0; i < node->child_count; i++) {
+        filter_order(node->children[i]);
+        node->cost += node->children[i]->cost;
+    }
+    // insertion sort: the lists are short and ties keep their written order
+    for (size_t i = 1; i < node->child_count; i++) {
+        FilterNode *child = node->children[i];
+        size_t j = i;
+        for (; j > 0 && node->children[j - 1]->cost > child->cost; j--) {
+            node->children[j] = node->children[j - 1];
+        }
+        node->children[j] = child;
+    }
+}
+
+/**
+ * @brief Compiles a filter expression over the current store.
+ *
+ * The grammar, loosest binding first:
+ *
+ *   expr        := term { "or" term }
+ *   term        := factor { "and" factor }
+ *   factor      := "not" factor | "(" expr ")" | comparison
+ *   comparison  := ("id" | "score") OP NUMBER
+ *                | ("id" | "score") "between" NUMBER "and" NUMBER
+ *                | "name" ("=" | "!=") "TEXT"     exact, case-sensitive
+ *                | "name" ("~" | "!~") "PATTERN"  glob with * and ?, any case
+ *                | "grade" ("=" | "!=") LETTER
+ *
+ * where OP is one of = == != < <= > >=, and 'between' includes both ends.
+ * For example: score >= 75 and id between 1000 and 2000 and name ~ "Ra*".
+ * Name predicates are resolved against the name arena now, so the filter
+ * must be used before the store changes.
+ * @param error Receives a message if the expression is invalid.
+ * @return The filter, to be freed with filter_free(), or NULL on an error.
+ */
+FilterNode *filter_compile(const char *text, char *error, size_t error_size) {
+    FilterParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.text = text;
+    parser.p = text;
+    FilterNode *root = filter_parse_or(&parser);
+    filter_skip_space(&parser);
+    if (root != NULL && *parser.p != '\0') {
+        filter_free(root);
+        root = filter_error(&parser, "unexpected text");
+    }
+    if (root == NULL) {
+        snprintf(error, error_size, "%s", parser.error[0] != '\0' ? parser.error : "out of memory");
+        return NULL;
+    }
+    filter_order(root);
+    return root;
+}
+
+/**
+ * @brief Kernel of FILTER_FALSE: drops every row.
+ */
+size_t filter_kernel_false(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    (void)node;
+    (void)batch;
+    (void)sel;
+    (void)n;
+    return 0;
+}
+
+/**
+ * @brief Kernel of FILTER_TRUE: keeps every row.
+ */
+size_t filter_kernel_true(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    (void)node;
+    (void)batch;
+    (void)sel;
+    return n;
+}
+
+/*
+ * The leaf kernels below are branch-free: every row is written to the
+ * output position and the position only advances if the row passes, so
+ * unpredictable matches cost no mispredictions.
+ */
+
+/**
+ * @brief Kernel of FILTER_ID.
+ */
+size_t filter_kernel_id(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    const int *ids = batch->ids;
+    size_t stride = batch->stride;
+    long long low = node->id_low, high = node->id_high;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t row = sel[i];
+        long long id = ids[row * stride];
+        sel[k] = row;
+        k += (id >= low) & (id <= high);
+    }
+    return k;
+}
+
+/**
+ * @brief Kernel of FILTER_SCORE.
+ */
+size_t filter_kernel_score(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    const double *scores = batch->scores;
+    size_t stride = batch->score_stride;
+    double low = node->score_low, high = node->score_high;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t row = sel[i];
+        double score = scores[row * stride];
+        sel[k] = row;
+        k += (score >= low) & (score <= high);
+    }
+    return k;
+}
+
+/**
+ * @brief Kernel of FILTER_NAME.
+ */
+size_t filter_kernel_name(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    const unsigned int *names = batch->names;
+    size_t stride = batch->stride;
+    unsigned int name = node->name;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t row = sel[i];
+        sel[k] = row;
+        k += names[row * stride] == name;
+    }
+    return k;
+}
+
+/**
+ * @brief Kernel of FILTER_NAME_SET.
+ */
+size_t filter_kernel_name_set(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    const unsigned int *names = batch->names;
+    size_t stride = batch->stride;
+    const uint64_t *bits = node->name_bits;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t row = sel[i];
+        unsigned int offset = names[row * stride];
+        sel[k] = row;
+        k += (bits[offset >> 6] >> (offset & 63)) & 1;
+    }
+    return k;
+}
+
+/**
+ * @brief Kernel of FILTER_AND: each child narrows the selection in turn,
+ * so later children only see the rows that are still in.
+ */
+size_t filter_kernel_and(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    for (size_t i = 0; i < node->child_count && n > 0; i++) {
+        const FilterNode *child = node->children[i];
+        n = child->kernel(child, batch, sel, n);
+    }
+    return n;
+}
+
+/**
+ * @brief Kernel of FILTER_OR: each child only sees the rows no earlier
+ * child matched; the matches are collected in a per-row mask.
+ */
+size_t filter_kernel_or(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    uint32_t rest[FILTER_BATCH_ROWS], hits[FILTER_BATCH_ROWS];
+    unsigned char matched[FILTER_BATCH_ROWS];
+    for (size_t i = 0; i < n; i++) {
+        rest[i] = sel[i];
+        matched[sel[i]] = 0;
+    }
+    size_t left = n;
+    for (size_t c = 0; c < node->child_count && left > 0; c++) {
+        const FilterNode *child = node->children[c];
+        memcpy(hits, rest, left * sizeof(uint32_t));
+        size_t found = child->kernel(child, batch, hits, left);
+        for (size_t i = 0; i < found; i++) {
+            matched[hits[i]] = 1;
+        }
+        size_t k = 0;
+        for (size_t i = 0; i < left; i++) {
+            rest[k] = rest[i];
+            k += !matched[rest[i]];
+        }
+        left = k;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        sel[k] = sel[i];
+        k += matched[sel[i]];
+    }
+    return k;
+}
+
+/**
+ * @brief Kernel of FILTER_NOT: keeps the rows its child drops.
+ */
+size_t filter_kernel_not(const FilterNode *node, const FilterBatch *batch, uint32_t *sel, size_t n) {
+    uint32_t hits[FILTER_BATCH_ROWS];
+    unsigned char matched[FILTER_BATCH_ROWS];
+    for (size_t i = 0; i < n; i++) {
+        hits[i] = sel[i];
+        matched[sel[i]] = 0;
+    }
+    const FilterNode *child = node->children[0];
+    size_t found = child->kernel(child, batch, hits, n);
+    for (size_t i = 0; i < found; i++) {
+        matched[hits[i]] = 1;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        sel[k] = sel[i];
+        k += !matched[sel[i]];
+    }
+    return k;
+}
+
+/**
+ * @brief Runs a filter over one batch of rows.
+ *
+ * @param start First row of the batch, a multiple of FILTER_BATCH_ROWS.
+ * @param len Rows in the batch, at most FILTER_BATCH_ROWS.
+ * @param sel Receives the offsets from start of the live rows that pass,
+ * in ascending order.
+ * @return Number of offsets written.
+ */
+size_t filter_batch(const FilterNode *filter, size_t start, size_t len, uint32_t *sel) {
+    const StudentChunk *chunk = &student_database.chunks[start >> STUDENT_CHUNK_SHIFT];
+    size_t offset = start & STUDENT_CHUNK_MASK;
+    FilterBatch batch;
+    if (student_database.layout == LAYOUT_SOA) {
+        batch.ids = chunk->ids + offset;
+        batch.scores = chunk->scores + offset;
+        batch.names = chunk->name_offsets + offset;
+        batch.stride = 1;
+        batch.score_stride = 1;
+    } else {
+        const StudentRow *rows = chunk->rows + offset;
+        batch.ids = &rows->id;
+        batch.scores = &rows->score;
+        batch.names = &rows->name;
+        batch.stride = sizeof(StudentRow) / sizeof(int);
+        batch.score_stride = sizeof(StudentRow) / sizeof(double);
+    }
+
+    // the selection starts out as the batch's live rows
+    size_t n = 0;
+    if (chunk->dead == NULL) {
+        for (; n < len; n++) {
+            sel[n] = (uint32_t)n;
+        }
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            sel[n] = (uint32_t)i;
+            n += !tombstone_test(chunk->dead, offset + i);
+        }
+    }
+    return filter->kernel(filter, &batch, sel, n);
+}
+
+/**
+ * @brief Prints every live student that passes a filter, in row order,
+ * formatted like display_all_students.
+ *
+ * @return Number of students printed (no table is printed for 0).
+ */
+size_t filter_list(const FilterNode *filter) {
+    uint32_t sel[FILTER_BATCH_ROWS];
+    size_t matches = 0;
+    for (size_t start = 0; start < student_count; start += FILTER_BATCH_ROWS) {
+        size_t len = student_count - start < FILTER_BATCH_ROWS ? student_count - start : FILTER_BATCH_ROWS;
+        size_t n = filter_batch(filter, start, len, sel);
+        if (n > 0 && matches == 0) {
+            print_table_header();
+        }
+        for (size_t i = 0; i < n; i++) {
+            print_student_row(start + sel[i]);
+        }
+        matches += n;
+    }
+    if (matches > 0) {
+        print_table_footer();
+    }
+    return matches;
+}
+
+/**
+ * @brief Reduces the rows of task 'index' (REDUCE_TASK_ROWS of them) that
+ * pass the job's filter into partials[index].
+ *
+ * The scores of each batch's selection are gathered into a contiguous run
+ * for the statistics kernel.
+ */
+void filter_task(size_t index, void *arg) {
+    const FilterJob *job = arg;
+    ReducePartial *part = &job->partials[index];
+    uint32_t sel[FILTER_BATCH_ROWS];
+    double picked[FILTER_BATCH_ROWS];
+    size_t end = (index + 1) * REDUCE_TASK_ROWS;
+    if (end > student_count) {
+        end = student_count;
+    }
+    for (size_t start = index * REDUCE_TASK_ROWS; start < end; start += FILTER_BATCH_ROWS) {
+        size_t len = end - start < FILTER_BATCH_ROWS ? end - start : FILTER_BATCH_ROWS;
+        size_t n = filter_batch(job->filter, start, len, sel);
+        if (n == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            picked[i] = student_score(start + sel[i]);
+        }
+        job->kernel(&part->stats, picked, n, 1);
+        for (size_t i = 0; i < n; i++) {
+            part->grade_counts[grade_index(get_letter_grade(picked[i]))]++;
+        }
+    }
+}
+
+/**
+ * @brief Accumulates the statistics, and the per-grade histogram when
+ * grade_counts is not NULL, of the students that pass a filter.
+ *
+ * Works like store_reduce(): rosters of at least pool.threshold rows are
+ * filtered on the thread pool and the partials merged in task order.
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int filter_reduce(const FilterNode *filter, StatsAccumulator *acc, size_t *grade_counts) {
+    size_t task_count = (student_count + REDUCE_TASK_ROWS - 1) / REDUCE_TASK_ROWS;
+    ReducePartial *partials = malloc((task_count > 0 ? task_count : 1) * sizeof(ReducePartial));
+    if (partials == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < task_count; i++) {
+        stats_init(&partials[i].stats);
+        memset(partials[i].grade_counts, 0, sizeof(partials[i].grade_counts));
+    }
+    FilterJob job = {filter, select_stats_kernel(), partials};
+    if (student_count >= pool.threshold && pool.thread_count != 1) {
+        pool_run(task_count, filter_task, &job);
+    } else {
+        for (size_t i = 0; i < task_count; i++) {
+            filter_task(i, &job);
+        }
+    }
+    for (size_t i = 0; i < task_count; i++) {
+        stats_merge(acc, &partials[i].stats);
+        if (grade_counts != NULL) {
+            for (int g = 0; g < GRADE_COUNT; g++) {
+                grade_counts[g] += partials[i].grade_counts[g];
+            }
+        }
+    }
+    free(partials);
+    return 1;
+}
+
+/**
+ * @brief Parses the bucket width of a group-by: a number of points with at
+ * most two decimals, from 0.1 (GROUP_MAX_BUCKETS buckets) to 100.
+ *
+ * @param width_centi Set to the width in hundredths of a point.
+ * @return 1 on success, 0 if the text is not a valid width.
+ */
+int group_parse_width(const char *text, uint32_t *width_centi) {
+    char *end;
+    double width = strtod(text, &end);
+    if (end == text || *end != '\0' || !(width > 0.0 && width <= 100.0)) {
+        return 0;
+    }
+    double centi = round(width * 100.0);
+    if (fabs(width * 100.0 - centi) > 1e-6 || centi * GROUP_MAX_BUCKETS < 10000.0) {
+        return 0;
+    }
+    *width_centi = (uint32_t)centi;
+    return 1;
+}
+
+/**
+ * @brief Returns the number of groups of a group-by: GRADE_COUNT for letter
+ * grades, else the number of buckets covering 0-100.
+ */
+int group_count_for(uint32_t width_centi) {
+    return width_centi == 0 ? GRADE_COUNT : (int)((10000 + width_centi - 1) / width_centi);
+}
+
+/**
+ * @brief Returns the group of a score: its grade_index() when grouping by
+ * letter grade, else its bucket.
+ *
+ * Neither mapping branches. A letter grade is F minus the number of grade
+ * floors the score reaches. A bucket is the quotient score / width, clamped
+ * to the buckets that exist and then moved by at most one so that it
+ * agrees with the exact bucket bounds, which the rounded quotient may miss
+ * for scores on an edge.
+ */
+int group_index(const GroupJob *job, double score) {
+    if (job->width_centi == 0) {
+        return GRADE_COUNT - 1 - (score >= 60.0) - (score >= 70.0) - (score >= 80.0) - (score >= 90.0);
+    }
+    double q = score / job->width;
+    double last = job->group_count - 1;
+    q = q > 0.0 ? q : 0.0; // NaN goes to the first bucket
+    q = q < last ? q : last;
+    int k = (int)q;
+    k -= score < job->bounds[k];
+    k += score >= job->bounds[k + 1];
+    return k;
+}
+
+/**
+ * @brief Adds n scores, stride doubles apart, to a table of groups.
+ */
+void group_scores(const GroupJob *job, GroupTotals *table, const double *scores, size_t n, size_t stride) {
+    for (size_t i = 0; i < n; i++) {
+        double score = scores[i * stride];
+        GroupTotals *g = &table[group_index(job, score)];
+        g->count++;
+        g->sum += score;
+        g->min = score < g->min ? score : g->min;
+        g->max = score > g->max ? score : g->max;
+    }
+}
+
+/**
+ * @brief Groups rows [index * STUDENT_CHUNK_SIZE, ...), one arena chunk,
+ * into the task's own table in the job's partials.
+ *
+ * Without a filter the task walks the score runs of its chunk; with one it
+ * gathers the scores of each batch's selection, as filter_task() does.
+ */
+void group_task(size_t index, void *arg) {
+    const GroupJob *job = arg;
+    GroupTotals *table = &job->partials[index * (size_t)job->group_count];
+    size_t end = (index + 1) * STUDENT_CHUNK_SIZE;
+    if (end > student_count) {
+        end = student_count;
+    }
+    if (job->filter == NULL) {
+        const double *scores;
+        size_t stride;
+        size_t run;
+        for (size_t start = index * STUDENT_CHUNK_SIZE;
+             start < end && (run = store_score_run(start, &scores, &stride)) > 0; start += run) {
+            if (scores != NULL) {
+                group_scores(job, table, scores, run, stride);
+            }
+        }
+        return;
+    }
+
+    uint32_t sel[FILTER_BATCH_ROWS];
+    double picked[FILTER_BATCH_ROWS];
+    for (size_t start = index * STUDENT_CHUNK_SIZE; start < end; start += FILTER_BATCH_ROWS) {
+        size_t len = end - start < FILTER_BATCH_ROWS ? end - start : FILTER_BATCH_ROWS;
+        size_t n = filter_batch(job->filter, start, len, sel);
+        for (size_t i = 0; i < n; i++) {
+            picked[i] = student_score(start + sel[i]);
+        }
+        group_scores(job, table, picked, n, 1);
+    }
+}
+
+/**
+ * @brief Computes the count, sum, minimum and maximum of every letter grade
+ * or score bucket in one pass over the score column.
+ *
+ * Each arena chunk is one task with its own table of groups, so no group is
+ * updated by two threads. Rosters of at least pool.threshold rows run on
+ * the thread pool; the tables are merged in task order, so the sums do not
+ * depend on the number of threads.
+ * @param width_centi Bucket width from group_parse_width(), or 0 to group
+ * by letter grade.
+ * @param filter Only the rows that pass it are grouped; NULL for all.
+ * @param groups Receives group_count_for(width_centi) groups; an empty
+ * group has a min of +inf and a max of -inf.
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int store_group_by(uint32_t width_centi, const FilterNode *filter, GroupTotals *groups) {
+    GroupJob job;
+    job.width_centi = width_centi;
+    job.group_count = group_count_for(width_centi);
+    job.width = width_centi / 100.0;
+    job.filter = filter;
+    // k * width_centi / 100 is the double nearest the decimal edge, so an
+    // entered score of exactly 12.30 starts the bucket at 12.30
+    job.bounds[0] = -INFINITY;
+    for (int k = 1; k < job.group_count; k++) {
+        job.bounds[k] = (double)((uint32_t)k * width_centi) / 100.0;
+    }
+    job.bounds[job.group_count] = INFINITY;
+
+    size_t task_count = (student_count + STUDENT_CHUNK_SIZE - 1) / STUDENT_CHUNK_SIZE;
+    size_t slots = task_count * (size_t)job.group_count;
+    job.partials = malloc((slots > 0 ? slots : 1) * sizeof(GroupTotals));
+    if (job.partials == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        job.partials[i].count = 0;
+        job.partials[i].sum = 0.0;
+        job.partials[i].min = INFINITY;
+        job.partials[i].max = -INFINITY;
+    }
+    if (student_count >= pool.threshold && pool.thread_count != 1) {
+        pool_run(task_count, group_task, &job);
+    } else {
+        for (size_t i = 0; i < task_count; i++) {
+            group_task(i, &job);
+        }
+    }
+
+    double sum_c[GROUP_MAX_BUCKETS];
+    for (int k = 0; k < job.group_count; k++) {
+        groups[k].count = 0;
+        groups[k].sum = 0.0;
+        groups[k].min = INFINITY;
+        groups[k].max = -INFINITY;
+        sum_c[k] = 0.0;
+    }
+    for (size_t i = 0; i < task_count; i++) {
+        const GroupTotals *table = &job.partials[i * (size_t)job.group_count];
+        for (int k = 0; k < job.group_count; k++) {
+            groups[k].count += table[k].count;
+            kahan_add(&groups[k].sum, &sum_c[k], table[k].sum);
+            groups[k].min = table[k].min < groups[k].min ? table[k].min : groups[k].min;
+            groups[k].max = table[k].max > groups[k].max ? table[k].max : groups[k].max;
+        }
+    }
+    free(job.partials);
+    return 1;
+}
+
+/**
+ * @brief Returns a monotonic timestamp in seconds.
+ */
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Measures insert and scan throughput and peak RSS for growing
+ * roster sizes.
+ *
+ * Run with "--bench-store" (optionally after --layout=soa). Fills the store
+ * with 10^3 .. 10^7 synthetic students and prints one line per size; the
+ * scan column times one pass of the average computation and the lookup
+ * column times n random ID lookups.
+ */
+void run_store_benchmark() {
+    printf("Layout: %s, kernel: %s\n", student_database.layout == LAYOUT_SOA ? "SoA" : "AoS",
+           select_stats_kernel() == stats_kernel_scalar ? "scalar" : "AVX2");
+    printf("%-10s | %-12s | %-14s | %-14s | %-14s | %-12s\n",
+           "Students", "Seconds", "Inserts/sec", "Scan rows/sec", "Lookups/sec", "Peak RSS KB");
+
+    for (size_t n = 1000; n <= 10000000; n *= 10) {
+        Student s;
+        memset(&s, 0, sizeof(s));
+        double start = now_seconds();
+        for (size_t i = 0; i < n; i++) {
+            s.id = (int)i;
+            snprintf(s.name, MAX_NAME_LENGTH, "Student %zu", i);
+            s.score = (double)(i % 10001) / 100.0;
+            if (store_append(&s) != STORE_OK) {
+                printf("Out of memory after %zu students.\n", student_count);
+                store_reset();
+                return;
+            }
+        }
+        double elapsed = now_seconds() - start;
+
+        start = now_seconds();
+        volatile double mean = store_compute_stats().mean;
+        (void)mean;
+        double scan = now_seconds() - start;
+
+        start = now_seconds();
+        size_t found = 0;
+        for (size_t i = 0; i < n; i++) {
+            found += id_index_find((int)((i * 2654435761u) % n)) != NO_ROW;
+        }
+        double lookups = now_seconds() - start;
+        if (found != n) {
+            printf("ID index lost %zu students.\n", n - found);
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%-10zu | %-12.4f | %-14.0f | %-14.0f | %-14.0f | %-12ld\n",
+               n, elapsed, n / elapsed, n / scan, n / lookups, usage.ru_maxrss);
+        store_reset();
+    }
+}
+
+/**
+ * @brief Body of a --bench-readers reader thread: opens views until told
+ * to stop and checks that every row it reads is whole.
+ *
+ * Each read looks at 16 random rows and the newest one; every 256th read
+ * also scans the whole view and reads the running totals. The benchmark
+ * writer derives the score and name of a row from its ID, so any mix of
+ * two rows (or a half-written one) shows up as torn.
+ */
+void *reader_bench_main(void *arg) {
+    ReaderBench *bench = arg;
+    unsigned int x = bench->seed;
+
+    while (!__atomic_load_n(bench->stop, __ATOMIC_RELAXED)) {
+        StoreView view;
+        store_view_begin(&view);
+        for (int k = 0; k <= 16 && view.count > 0; k++) {
+            x = x * 1103515245u + 12345u;
+            size_t i = k == 16 ? view.count - 1 : x % view.count;
+            int id = view_student_id(&view, i);
+            const char *name = view_student_name(&view, i);
+            if (id != (int)i || view_student_score(&view, i) != (double)(i % 10001) / 100.0 ||
+                strncmp(name, "Student ", 8) != 0 || atoi(name + 8) != id) {
+                bench->torn++;
+            }
+            bench->rows++;
+        }
+        if (bench->reads % 256 == 0) {
+            StatsAccumulator acc;
+            stats_init(&acc);
+            store_view_stats(&view, &acc);
+            if (acc.count != view.count) {
+                bench->torn++;
+            }
+            // the totals must describe exactly their own first n rows
+            if (store_read_totals(&acc, NULL) && acc.count > 0) {
+                size_t n = acc.count, full = n / 10001, rest = n % 10001;
+                double expected = (full * (10000.0 * 10001.0 / 2.0) + rest * (rest - 1.0) / 2.0) / 100.0;
+                if (fabs(acc.sum - expected) > 1e-9 * expected) {
+                    bench->torn++;
+                }
+            }
+        }
+        store_view_end(&view);
+        bench->reads++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Measures how reads through views scale with the number of reader
+ * threads while one writer keeps adding students.
+ *
+ * Run with "--bench-readers" (optionally after --layout=soa). For 0, 1, 2,
+ * 4 ... readers (up to the core count, at least 2) the main thread adds
+ * students for half a second while the readers check rows; the store is
+ * emptied between runs. Torn must stay 0.
+ */
+void run_reader_benchmark() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_readers = cores > 2 ? (size_t)cores : 2;
+    if (max_readers > READER_SLOTS) {
+        max_readers = READER_SLOTS;
+    }
+    printf("Layout: %s, cores: %ld\n", student_database.layout == LAYOUT_SOA ? "SoA" : "AoS", cores);
+    printf("%-8s | %-14s | %-16s | %-14s | %-6s\n", "Readers", "Reads/sec", "Rows read/sec", "Inserts/sec", "Torn");
+
+    ReaderBench *benches = aligned_alloc(64, max_readers * sizeof(ReaderBench));
+    if (benches == NULL) {
+        printf("Out of memory.\n");
+        return;
+    }
+    for (size_t readers = 0; readers <= max_readers; readers = readers ? readers * 2 : 1) {
+        volatile int stop = 0;
+        size_t started = 0;
+        for (size_t r = 0; r < readers; r++) {
+            memset(&benches[r], 0, sizeof(ReaderBench));
+            benches[r].stop = &stop;
+            benches[r].seed = (unsigned int)(r * 2654435761u + 1);
+            if (pthread_create(&benches[r].thread, NULL, reader_bench_main, &benches[r]) != 0) {
+                break;
+            }
+            started++;
+        }
+
+        Student s;
+        memset(&s, 0, sizeof(s));
+        double start = now_seconds(), elapsed;
+        int ok = 1;
+        do {
+            for (int batch = 0; ok && batch < 1024; batch++) {
+                s.id = (int)student_count;
+                snprintf(s.name, MAX_NAME_LENGTH, "Student %d", s.id);
+                s.score = (double)(student_count % 10001) / 100.0;
+                ok = store_append(&s) == STORE_OK;
+            }
+            elapsed = now_seconds() - start;
+        } while (ok && elapsed < 0.5);
+
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        size_t reads = 0, rows = 0, torn = 0;
+        for (size_t r = 0; r < started; r++) {
+            pthread_join(benches[r].thread, NULL);
+            reads += benches[r].reads;
+            rows += benches[r].rows;
+            torn += benches[r].torn;
+        }
+        printf("%-8zu | %-14.0f | %-16.0f | %-14.0f | %-6zu\n",
+               started, reads / elapsed, rows / elapsed, student_count / elapsed, torn);
+        if (!ok) {
+            printf("Out of memory after %zu students.\n", student_count);
+        }
+        store_reset();
+        if (!ok || started < readers) {
+            break;
+        }
+    }
+    free(benches);
+}
+
+/**
+ * @brief Reads the --bench-rows and --bench-names settings.
+ *
+ * @param sizes Receives the roster sizes, at most BENCH_MAX_SIZES.
+ * @return 1 if both are valid, 0 after printing what is wrong.
+ */
+int bench_parse_options(size_t *sizes, size_t *size_count) {
+    const char *p = bench_suite.rows;
+    *size_count = 0;
+    while (*p != '\0') {
+        char *end;
+        unsigned long long n = strtoull(p, &end, 10);
+        if (end == p || n == 0 || (*end != ',' && *end != '\0') || *size_count == BENCH_MAX_SIZES) {
+            fprintf(stderr, "Invalid --bench-rows '%s': use up to %d sizes such as 1000,100000.\n",
+                    bench_suite.rows, BENCH_MAX_SIZES);
+            return 0;
+        }
+        sizes[(*size_count)++] = (size_t)n;
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (*size_count == 0) {
+        fprintf(stderr, "Invalid --bench-rows: no roster size given.\n");
+        return 0;
+    }
+
+    const char *spec = bench_suite.names;
+    int min = 0, max = 0, used = 0;
+    if (sscanf(spec, "fixed:%d%n", &min, &used) == 1 && spec[used] == '\0') {
+        bench_suite.distribution = NAMES_FIXED;
+        max = min;
+    } else if (sscanf(spec, "uniform:%d-%d%n", &min, &max, &used) == 2 && spec[used] == '\0') {
+        bench_suite.distribution = NAMES_UNIFORM;
+    } else if (sscanf(spec, "skewed:%d-%d%n", &min, &max, &used) == 2 && spec[used] == '\0') {
+        bench_suite.distribution = NAMES_SKEWED;
+    } else {
+        min = 0; // fall through to the error below
+    }
+    if (min < 1 || max < min || max > MAX_NAME_LENGTH - 1) {
+        fprintf(stderr, "Invalid --bench-names '%s': use fixed:N, uniform:MIN-MAX or skewed:MIN-MAX "
+                "with lengths from 1 to %d.\n", spec, MAX_NAME_LENGTH - 1);
+        return 0;
+    }
+    bench_suite.min_length = min;
+    bench_suite.max_length = max;
+    return 1;
+}
+
+/**
+ * @brief Opens the cache-miss, cache-reference and instruction counters.
+ *
+ * The counters follow this thread and every thread it starts later, so
+ * they must be opened before the thread pool. A counter the kernel or the
+ * hardware does not offer (or perf_event_paranoid forbids) stays at -1
+ * and is reported as null.
+ */
+void bench_open_counters() {
+    static const unsigned long long events[BENCH_COUNTERS] = {
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_INSTRUCTIONS};
+
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = events[i];
+        attr.disabled = 1;
+        attr.inherit = 1; // count the pool workers too
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        bench_suite.counters[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+/**
+ * @brief Zeroes and starts the open counters.
+ */
+void bench_counters_start() {
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (bench_suite.counters[i] >= 0) {
+            ioctl(bench_suite.counters[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(bench_suite.counters[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/**
+ * @brief Stops the counters and reads them.
+ *
+ * @param counts Receives one value per counter, -1 where it is unavailable.
+ */
+void bench_counters_stop(long long *counts) {
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        long long value = -1;
+        if (bench_suite.counters[i] >= 0) {
+            ioctl(bench_suite.counters[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(bench_suite.counters[i], &value, sizeof(value)) != (ssize_t)sizeof(value)) {
+                value = -1;
+            }
+        }
+        counts[i] = value;
+    }
+}
+
+/**
+ * @brief Closes the counters opened by bench_open_counters().
+ */
+void bench_close_counters() {
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (bench_suite.counters[i] >= 0) {
+            close(bench_suite.counters[i]);
+        }
+        bench_suite.counters[i] = -1;
+    }
+}
+
+/**
+ * @brief Returns the next 16 random bits of the benchmark's LCG.
+ */
+unsigned int bench_random() {
+    bench_suite.seed = bench_suite.seed * 1103515245u + 12345u;
+    return bench_suite.seed >> 16;
+}
+
+/**
+ * @brief Writes a random capitalised name whose length is drawn from the
+ * configured distribution.
+ *
+ * @param out At least MAX_NAME_LENGTH bytes.
+ */
+void bench_name(char *out) {
+    int span = bench_suite.max_length - bench_suite.min_length + 1;
+    int len = bench_suite.min_length + (int)(bench_random() % (unsigned int)span);
+    if (bench_suite.distribution == NAMES_SKEWED) {
+        int other = bench_suite.min_length + (int)(bench_random() % (unsigned int)span);
+        len = other < len ? other : len;
+    }
+    for (int k = 0; k < len; k++) {
+        out[k] = (char)((k == 0 ? 'A' : 'a') + bench_random() % 26);
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief Adds `calls` synthetic students with the steps add_student()
+ * takes after its prompts.
+ *
+ * The ID is checked against the index, the name is written straight into
+ * the arena tail where read_string() would put it and interned, and the
+ * row is inserted. IDs follow the current row count.
+ * @return The number of students added; fewer than `calls` only when
+ * memory ran out.
+ */
+size_t bench_add_students(size_t calls) {
+    size_t added = 0;
+    for (size_t i = 0; i < calls; i++) {
+        int id = (int)student_count;
+        if (!store_ensure_indexes() || id_index_find(id) != NO_ROW) {
+            break;
+        }
+        char *name = name_arena_tail(MAX_NAME_LENGTH);
+        if (name == NULL) {
+            break;
+        }
+        bench_name(name);
+        double score = (double)(bench_random() % 10001) / 100.0;
+        long name_offset = name_intern_tail();
+        if (name_offset < 0 || store_insert(id, (unsigned int)name_offset, score) != STORE_OK) {
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+/**
+ * @brief Renders the whole table `calls` times.
+ *
+ * @return The number of rows rendered.
+ */
+size_t bench_display(size_t calls) {
+    for (size_t i = 0; i < calls; i++) {
+        display_all_students();
+    }
+    return calls * store_live_count();
+}
+
+/**
+ * @brief Answers the average query `calls` times from the running totals.
+ */
+size_t bench_average(size_t calls) {
+    for (size_t i = 0; i < calls; i++) {
+        calculate_average_score();
+    }
+    return calls;
+}
+
+/**
+ * @brief Recomputes the statistics from the score column `calls` times,
+ * as the average query does when the totals are not available.
+ *
+ * @return The number of scores reduced.
+ */
+size_t bench_rescan(size_t calls) {
+    volatile double sink = 0.0;
+    for (size_t i = 0; i < calls; i++) {
+        sink = store_compute_stats().mean;
+    }
+    (void)sink;
+    return calls * store_live_count();
+}
+
+/**
+ * @brief Grades every live score `calls` times.
+ *
+ * @return The number of get_letter_grade() calls.
+ */
+size_t bench_letter_grades(size_t calls) {
+    size_t counts[8] = {0};
+    for (size_t k = 0; k < calls; k++) {
+        for (size_t i = 0; i < student_count;) {
+            const double *scores;
+            size_t stride;
+            size_t run = store_score_run(i, &scores, &stride);
+            for (size_t j = 0; scores != NULL && j < run; j++) {
+                counts[get_letter_grade(scores[j * stride]) & 7]++;
+            }
+            i += run;
+        }
+    }
+    size_t graded = 0;
+    for (int g = 0; g < 8; g++) {
+        graded += counts[g];
+    }
+    return graded;
+}
+
+/**
+ * @brief Times one operation, with the hardware counters and the peak RSS
+ * taken around the measured run.
+ *
+ * With `calls` 0 the operation is repeatable: it starts with one call and
+ * is run again with more calls until a run lasts BENCH_MIN_SECONDS, and
+ * that last run is the one reported. Otherwise it runs exactly once.
+ * Stdout is sent to /dev/null meanwhile, so display_all_students() and
+ * calculate_average_score() format and write their output as usual
+ * without mixing it into the report.
+ */
+void bench_measure(BenchResult *result, BenchBody body, size_t calls) {
+    int repeat = calls == 0;
+    if (repeat) {
+        calls = 1;
+    }
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved >= 0 && null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+    }
+
+    for (;;) {
+        bench_counters_start();
+        double start = now_seconds();
+        result->ops = body(calls);
+        result->seconds = now_seconds() - start;
+        bench_counters_stop(result->counts);
+        result->calls = calls;
+        if (!repeat || result->seconds >= BENCH_MIN_SECONDS) {
+            break;
+        }
+        // aim a little past the target, growing by 2x to 10x per step
+        double scale = result->seconds > 0.0 ? BENCH_MIN_SECONDS * 1.2 / result->seconds : 10.0;
+        scale = scale < 2.0 ? 2.0 : scale > 10.0 ? 10.0 : scale;
+        calls = (size_t)(calls * scale);
+    }
+
+    fflush(stdout);
+    if (saved >= 0 && null_fd >= 0) {
+        dup2(saved, STDOUT_FILENO);
+    }
+    if (saved >= 0) {
+        close(saved);
+    }
+    if (null_fd >= 0) {
+        close(null_fd);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result->peak_rss_kb = usage.ru_maxrss;
+}
+
+/**
+ * @brief Prints one measurement as a JSON object.
+ *
+ * @param last Nonzero for the last object of the array (no comma).
+ */
+void bench_print_result(const BenchResult *result, int last) {
+    static const char *counter_keys[BENCH_COUNTERS] = {"cache_misses", "cache_references", "instructions"};
+
+    double seconds = result->seconds > 0.0 ? result->seconds : 1e-9;
+    double ops = result->ops > 0 ? (double)result->ops : 1.0;
+    printf("        {\"name\": \"%s\", \"unit\": \"%s\", \"calls\": %zu, \"ops\": %zu, "
+           "\"seconds\": %.6f, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f",
+           result->name, result->unit, result->calls, result->ops,
+           result->seconds, seconds * 1e9 / ops, result->ops / seconds);
+    for (int i = 0; i < BENCH_COUNTERS; i++) {
+        if (result->counts[i] >= 0) {
+            printf(", \"%s\": %lld", counter_keys[i], result->counts[i]);
+        } else {
+            printf(", \"%s\": null", counter_keys[i]);
+        }
+    }
+    printf(", \"peak_rss_kb\": %ld}%s\n", result->peak_rss_kb, last ? "" : ",");
+}
+
+/**
+ * @brief Load-tests the operations behind the menu on synthetic rosters
+ * and prints the results as JSON, for comparing builds.
+ *
+ * Run with "--bench-suite" after any --layout, --no-simd, --threads,
+ * --parallel-threshold, --bench-rows=N[,N...] and --bench-names=SPEC
+ * options. For each roster size the store is filled through
+ * add_student()'s steps, then the table, the average (from the totals and
+ * by rescanning) and the letter grades are timed. ns_per_op is per unit:
+ * per student added, row rendered, query answered, score reduced or grade
+ * computed. Counters are null where perf_event_open() is unavailable, and
+ * peak_rss_kb is the process high-water mark so far, so list sizes in
+ * ascending order to read it per roster.
+ * @return 1 on success, 0 if an option was invalid or memory ran out.
+ */
+int run_bench_suite() {
+    static const char *distribution_names[] = {"fixed", "uniform", "skewed"};
+    size_t sizes[BENCH_MAX_SIZES], size_count;
+
+    if (!bench_parse_options(sizes, &size_count)) {
+        return 0;
+    }
+    bench_open_counters(); // before any pool worker starts
+    size_t threads = pool.thread_count;
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (size_t)cores : 1;
+    }
+    if (threads > MAX_POOL_THREADS) {
+        threads = MAX_POOL_THREADS;
+    }
+
+    printf("{\n");
+    printf("  \"benchmark\": \"student-grade-system\",\n");
+    printf("  \"layout\": \"%s\",\n", student_database.layout == LAYOUT_SOA ? "soa" : "aos");
+    printf("  \"kernel\": \"%s\",\n", select_stats_kernel() == stats_kernel_scalar ? "scalar" : "avx2");
+    printf("  \"threads\": %zu,\n", threads);
+    printf("  \"parallel_threshold\": %zu,\n", pool.threshold);
+    printf("  \"name_lengths\": {\"distribution\": \"%s\", \"min\": %d, \"max\": %d},\n",
+           distribution_names[bench_suite.distribution], bench_suite.min_length, bench_suite.max_length);
+    printf("  \"perf_counters\": %s,\n", bench_suite.counters[0] >= 0 ? "true" : "false");
+    printf("  \"runs\": [\n");
+
+    int ok = 1;
+    for (size_t s = 0; ok && s < size_count; s++) {
+        BenchResult results[5] = {
+            {"add_student", "student", 0, 0, 0.0, {0}, 0},
+            {"display_all_students", "row", 0, 0, 0.0, {0}, 0},
+            {"calculate_average_score", "query", 0, 0, 0.0, {0}, 0},
+            {"calculate_average_score_rescan", "score", 0, 0, 0.0, {0}, 0},
+            {"get_letter_grade", "grade", 0, 0, 0.0, {0}, 0},
+        };
+        BenchBody bodies[5] = {bench_add_students, bench_display, bench_average, bench_rescan, bench_letter_grades};
+
+        bench_suite.seed = 1; // every build sees the same roster
+        bench_measure(&results[0], bodies[0], sizes[s]);
+        if (results[0].ops != sizes[s]) {
+            fprintf(stderr, "Out of memory after %zu students.\n", student_count);
+            ok = 0;
+        }
+        for (int k = 1; ok && k < 5; k++) {
+            bench_measure(&results[k], bodies[k], 0);
+        }
+
+        printf("    {\"students\": %zu, \"name_bytes\": %zu, \"operations\": [\n",
+               student_count, student_database.names_used);
+        for (int k = 0; k < 5 && (ok || k == 0); k++) {
+            bench_print_result(&results[k], k == 4 || !ok);
+        }
+        printf("    ]}%s\n", ok && s + 1 < size_count ? "," : "");
+        store_reset();
+    }
+    printf("  ]\n}\n");
+
+    pool_stop();
+    bench_close_counters();
+    return ok;
+}
+
+/**
+ * @brief Displays the main menu options to the user.
+ */
+void display_menu() {
+    // Clear the terminal with an escape sequence rather than spawning a
+    // shell for clear(1); redirected output is left alone
+    if (isatty(STDOUT_FILENO)) {
+        fputs("\033[H\033[2J", stdout);
+    }
+    printf("==========================================\n");
+    printf("   Student Grade Management System\n");
+    printf("==========================================\n");
+    printf("1. Add a New Student\n");
+    printf("2. Display All Students\n");
+    printf("3. Calculate Average Score\n");
+    printf("4. Look Up Student by ID\n");
+    printf("5. List Students in a Grade Band\n");
+    printf("6. Count Students per Grade Band\n");
+    printf("7. Import Students from CSV\n");
+    printf("8. Save Snapshot\n");
+    printf("9. Search by Name Prefix\n");
+    printf("10. Score Percentiles\n");
+    printf("11. Top / Bottom K Students\n");
+    printf("12. Export Ranked Roster\n");
+    printf("13. Update a Student\n");
+    printf("14. Delete a Student\n");
+    printf("15. Show Command Statistics\n");
+    printf("16. Query with a Filter Expression\n");
+    printf("17. Group Report by Grade or Score Bucket\n");
+    printf("18. Exit\n");
+    printf("------------------------------------------\n");
+}
+
+/**
+ * @brief Prompts the user for a menu choice and returns it.
+ *
+ * @return The integer value of the user's choice.
+ */
+int get_menu_choice() {
+    int choice = 0;
+    printf("Enter your choice: ");
+    
+    // Loop until a valid integer is entered
+    while (scanf("%d", &choice) != 1) {
+        printf("Invalid input. Please enter a number: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer(); // Crucial for consuming the rest of the line
+    
+    return choice;
+}
+
+/**
+ * @brief Runs a headless command script, one command per line.
+ *
+ * No menu is drawn and nothing is prompted for, so a file or a pipe can
+ * drive the store at full speed. Tables stay in the render buffer across
+ * commands and are written out in large pieces; errors go to stderr with
+ * their line number and do not stop the script. Blank lines and lines
+ * starting with '#' are skipped. The commands are:
+ *
+ *   add ID,NAME,SCORE   add a student (checked like a CSV import line)
+ *   update ID,NAME,SCORE
+ *                       replace the name and score of a student, which
+ *                       moves it to the end of 'list'
+ *   delete ID           delete a student
+ *   get ID              show one student
+ *   list [FILTER]       show every student, or those matching FILTER
+ *   avg [FILTER]        count, average, minimum, maximum, std. deviation
+ *   grades [FILTER]     students per grade band
+ *   group grade [FILTER], group WIDTH [FILTER]
+ *                       count, average, minimum and maximum per letter
+ *                       grade or per score bucket WIDTH points wide
+ *   search PREFIX       the first NAME_SEARCH_LIMIT names starting with PREFIX
+ *   top K, bottom K     the K best or worst students
+ *   save [FILE]         write a snapshot (default: the --snapshot file)
+ *   stats               latency and counters of the commands run so far
+ *   quit                stop reading; the end of the input does the same
+ *
+ * A FILTER is an expression such as: score >= 75 and name ~ "Ra*" (see
+ * filter_compile()); commands given one are counted as queries.
+ * @param in The script to read.
+ * @return Number of commands that failed.
+ */
+size_t run_script(FILE *in) {
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t line_number = 0;
+    size_t failed = 0;
+    ssize_t len;
+
+    // each command is timed from the end of the previous one, so reading
+    // and parsing its line counts towards it
+    double start = command_begin(CMD_NONE);
+    table_output.hold = 1;
+    while ((len = getline(&line, &capacity, in)) >= 0) {
+        line_number++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        ScriptStatus status = run_script_command(line, line_number);
+        start = command_end(start);
+        if (status == SCRIPT_QUIT) {
+            break;
+        }
+        if (status == SCRIPT_FAILED) {
+            failed++;
+        }
+    }
+    table_output.hold = 0;
+    render_flush();
+    free(line);
+    return failed;
+}
+
+/**
+ * @brief Reports a failed script command on stderr.
+ */
+void script_error(size_t line_number, const char *format, ...) {
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    fprintf(stderr, "Error: line %zu: %s\n", line_number, message);
+}
+
+/**
+ * @brief Runs one line of a command script (see run_script()).
+ *
+ * @param line The line without its newline; it is modified in place.
+ * @return SCRIPT_OK, SCRIPT_FAILED, or SCRIPT_QUIT for the quit command.
+ */
+ScriptStatus run_script_command(char *line, size_t line_number) {
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '\0' || *line == '#') {
+        return SCRIPT_OK;
+    }
+
+    // split off the command word; the rest of the line is its argument
+    char *word_end = line;
+    while (*word_end != '\0' && *word_end != ' ' && *word_end != '\t') {
+        word_end++;
+    }
+    char *arg = word_end;
+    while (*arg == ' ' || *arg == '\t') {
+        arg++;
+    }
+    *word_end = '\0';
+    const char *arg_end = arg + strlen(arg);
+
+    if (strcmp(line, "add") == 0) {
+        command_kind(CMD_ADD);
+        Student s;
+        if (!parse_csv_line(arg, arg_end, &s)) {
+            script_error(line_number, "expected 'add ID,NAME,SCORE' with a score of 0-100");
+            return SCRIPT_FAILED;
+        }
+        StoreStatus status = store_append(&s);
+        if (status == STORE_DUPLICATE_ID) {
+            script_error(line_number, "a student with ID %d already exists", s.id);
+            return SCRIPT_FAILED;
+        }
+        if (status != STORE_OK) {
+            script_error(line_number,
+                         status == STORE_IO_ERROR ? "could not write the write-ahead log" : "out of memory");
+            return SCRIPT_FAILED;
+        }
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "update") == 0) {
+        command_kind(CMD_UPDATE);
+        Student s;
+        if (!parse_csv_line(arg, arg_end, &s)) {
+            script_error(line_number, "expected 'update ID,NAME,SCORE' with a score of 0-100");
+            return SCRIPT_FAILED;
+        }
+        StoreStatus status = store_update(&s);
+        if (status == STORE_NOT_FOUND) {
+            script_error(line_number, "no student with ID %d", s.id);
+            return SCRIPT_FAILED;
+        }
+        if (status != STORE_OK) {
+            script_error(line_number,
+                         status == STORE_IO_ERROR ? "could not write the write-ahead log" : "out of memory");
+            return SCRIPT_FAILED;
+        }
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "delete") == 0) {
+        command_kind(CMD_DELETE);
+        int id;
+        if (parse_csv_int(arg, arg_end, &id) != arg_end) {
+            script_error(line_number, "expected 'delete ID'");
+            return SCRIPT_FAILED;
+        }
+        StoreStatus status = store_delete(id);
+        if (status == STORE_NOT_FOUND) {
+            script_error(line_number, "no student with ID %d", id);
+            return SCRIPT_FAILED;
+        }
+        if (status != STORE_OK) {
+            script_error(line_number,
+                         status == STORE_IO_ERROR ? "could not write the write-ahead log" : "out of memory");
+            return SCRIPT_FAILED;
+        }
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "get") == 0) {
+        command_kind(CMD_LOOKUP);
+        int id;
+        if (parse_csv_int(arg, arg_end, &id) != arg_end) {
+            script_error(line_number, "expected 'get ID'");
+            return SCRIPT_FAILED;
+        }
+        if (!store_ensure_indexes()) {
+            script_error(line_number, "out of memory");
+            return SCRIPT_FAILED;
+        }
+        size_t row = id_index_find(id);
+        if (row == NO_ROW) {
+            render_printf("No student with ID %d.\n", id);
+            return SCRIPT_OK;
+        }
+        print_table_header();
+        print_student_row(row);
+        print_table_footer();
+        return SCRIPT_OK;
+    }
+
+    // list, avg and grades take an optional filter (see filter_compile())
+    if ((strcmp(line, "list") == 0 || strcmp(line, "avg") == 0 || strcmp(line, "grades") == 0) && *arg != '\0') {
+        command_kind(CMD_QUERY);
+        char error[160];
+        FilterNode *filter = filter_compile(arg, error, sizeof(error));
+        if (filter == NULL) {
+            script_error(line_number, "%s", error);
+            return SCRIPT_FAILED;
+        }
+        int ok = 1;
+        if (line[0] == 'l') {
+            if (filter_list(filter) == 0) {
+                render_printf("No students match the filter.\n");
+            }
+        } else {
+            StatsAccumulator acc;
+            size_t grade_counts[GRADE_COUNT] = {0};
+            stats_init(&acc);
+            ok = filter_reduce(filter, &acc, grade_counts);
+            ScoreStats stats = stats_finish(&acc);
+            if (ok && line[0] == 'g') {
+                const char grades[] = "ABCDF";
+                for (int g = 0; grades[g] != '\0'; g++) {
+                    render_printf("%c: %zu\n", grades[g], grade_counts[grade_index(grades[g])]);
+                }
+            } else if (ok && stats.count == 0) {
+                render_printf("No students match the filter.\n");
+            } else if (ok) {
+                render_printf("The average score for %zu student(s) is: %.2f\n", stats.count, stats.mean);
+                render_printf("Minimum: %.2f  Maximum: %.2f  Std. deviation: %.2f\n",
+                              stats.min, stats.max, sqrt(stats.variance));
+            }
+        }
+        filter_free(filter);
+        if (!ok) {
+            script_error(line_number, "out of memory");
+            return SCRIPT_FAILED;
+        }
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "list") == 0) {
+        command_kind(CMD_LIST);
+        if (store_live_count() == 0) {
+            render_printf("No students in the database.\n");
+            return SCRIPT_OK;
+        }
+        print_table_header();
+        for (size_t i = 0; i < student_count; i++) {
+            if (!student_dead(i)) {
+                print_student_row(i);
+            }
+        }
+        print_table_footer();
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "avg") == 0) {
+        command_kind(CMD_AVERAGE);
+        if (store_live_count() == 0) {
+            render_printf("No students in the database.\n");
+            return SCRIPT_OK;
+        }
+        store_ensure_aggregates();
+        ScoreStats stats = stats_finish(&score_totals.stats);
+        render_printf("The average score for %zu student(s) is: %.2f\n", stats.count, stats.mean);
+        render_printf("Minimum: %.2f  Maximum: %.2f  Std. deviation: %.2f\n",
+                      stats.min, stats.max, sqrt(stats.variance));
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "grades") == 0) {
+        command_kind(CMD_GRADES);
+        store_ensure_aggregates();
+        const char grades[] = "ABCDF";
+        for (int g = 0; grades[g] != '\0'; g++) {
+            render_printf("%c: %zu\n", grades[g], score_totals.grade_counts[grade_index(grades[g])]);
+        }
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "group") == 0) {
+        command_kind(CMD_GROUP);
+        char *filter_text = arg;
+        while (*filter_text != '\0' && *filter_text != ' ' && *filter_text != '\t') {
+            filter_text++;
+        }
+        if (*filter_text != '\0') {
+            *filter_text++ = '\0';
+            while (*filter_text == ' ' || *filter_text == '\t') {
+                filter_text++;
+            }
+        }
+        uint32_t width_centi = 0;
+        if (strcmp(arg, "grade") != 0 && !group_parse_width(arg, &width_centi)) {
+            script_error(line_number, "expected 'group grade' or 'group WIDTH' with a width of 0.1-100 points");
+            return SCRIPT_FAILED;
+        }
+        FilterNode *filter = NULL;
+        if (*filter_text != '\0') {
+            char error[160];
+            filter = filter_compile(filter_text, error, sizeof(error));
+            if (filter == NULL) {
+                script_error(line_number, "%s", error);
+                return SCRIPT_FAILED;
+            }
+        }
+        GroupTotals groups[GROUP_MAX_BUCKETS];
+        int ok = store_group_by(width_centi, filter, groups);
+        filter_free(filter);
+        if (!ok) {
+            script_error(line_number, "out of memory");
+            return SCRIPT_FAILED;
+        }
+        render_group_report(width_centi, groups, *filter_text != '\0');
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "search") == 0) {
+        command_kind(CMD_SEARCH);
+        if (name_trie.stale && !name_trie_rebuild()) {
+            script_error(line_number, "out of memory while building the name index");
+            return SCRIPT_FAILED;
+        }
+        size_t rows[NAME_SEARCH_LIMIT];
+        size_t found = name_trie_search(arg, rows, NAME_SEARCH_LIMIT);
+        if (found == 0) {
+            render_printf("No student's name starts with '%s'.\n", arg);
+            return SCRIPT_OK;
+        }
+        print_table_header();
+        for (size_t i = 0; i < found; i++) {
+            print_student_row(rows[i]);
+        }
+        print_table_footer();
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "top") == 0 || strcmp(line, "bottom") == 0) {
+        command_kind(CMD_RANK);
+        int k;
+        if (parse_csv_int(arg, arg_end, &k) != arg_end || k < 1 || k > MAX_RANK_K) {
+            script_error(line_number, "expected '%s K' with K between 1 and %d", line, MAX_RANK_K);
+            return SCRIPT_FAILED;
+        }
+        if (store_live_count() == 0) {
+            render_printf("No students in the database.\n");
+            return SCRIPT_OK;
+        }
+        size_t *rows = malloc((size_t)k * sizeof(size_t));
+        size_t found = rows != NULL ? store_rank_students(line[0] == 't', (size_t)k, rows) : 0;
+        if (found == 0) {
+            script_error(line_number, "out of memory");
+            free(rows);
+            return SCRIPT_FAILED;
+        }
+        print_table_header();
+        for (size_t i = 0; i < found; i++) {
+            print_student_row(rows[i]);
+        }
+        print_table_footer();
+        free(rows);
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "save") == 0) {
+        command_kind(CMD_SAVE);
+        const char *path = *arg != '\0' ? arg : snapshot_path;
+        if (path == NULL) {
+            script_error(line_number, "expected 'save FILE' (no --snapshot file was given)");
+            return SCRIPT_FAILED;
+        }
+        if (!(path == snapshot_path ? checkpoint_snapshot() : save_snapshot(path))) {
+            script_error(line_number, "could not save snapshot '%s'", path);
+            return SCRIPT_FAILED;
+        }
+        render_printf("Saved %zu student(s) to %s.\n", student_count, path);
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "stats") == 0) {
+        command_kind(CMD_STATS);
+        render_command_stats();
+        return SCRIPT_OK;
+    }
+
+    if (strcmp(line, "quit") == 0) {
+        return SCRIPT_QUIT;
+    }
+
+    script_error(line_number, "unknown command '%s'", line);
+    return SCRIPT_FAILED;
+}
+
+/**
+ * @brief Adds one latency sample to a histogram.
+ */
+void latency_record(LatencyHistogram *h, uint64_t ns) {
+    int bucket;
+    if (ns < 16) {
+        bucket = (int)ns;
+    } else {
+        int e = 63 - __builtin_clzll(ns); // 4..63
+        bucket = 16 + (e - 4) * 8 + (int)((ns >> (e - 3)) & 7);
+    }
+    stat_add(&h->counts[bucket], 1);
+    stat_add(&h->total, 1);
+}
+
+/**
+ * @brief Estimates a latency percentile from a histogram.
+ *
+ * @param q Fraction of samples at or below the result, in (0, 1].
+ * @return Midpoint of the bucket holding that sample, in nanoseconds
+ * (0 if the histogram is empty).
+ */
+uint64_t latency_percentile(const LatencyHistogram *h, double q) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(q * (double)h->total);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    int b = 0;
+    while (seen + h->counts[b] < rank) {
+        seen += h->counts[b++];
+    }
+    if (b < 16) {
+        return (uint64_t)b;
+    }
+    int e = 4 + (b - 16) / 8;
+    uint64_t width = 1ull << (e - 3);
+    return (uint64_t)(8 + (b - 16) % 8) * width + width / 2;
+}
+
+/**
+ * @brief Signal handler that asks the server loop to stop.
+ */
+void server_on_signal(int sig) {
+    (void)sig;
+    char byte = 0;
+    ssize_t n = write(server.stop_pipe[1], &byte, 1);
+    (void)n; // a full pipe already holds a stop request
+}
+
+/**
+ * @brief Serves the store over a Unix domain socket until SIGINT or SIGTERM.
+ *
+ * A single thread runs an epoll loop over the listening socket and every
+ * client, so any number of clients are served concurrently without locking
+ * the store: each request takes microseconds and runs to completion. All
+ * sockets are non-blocking, and a client whose unsent replies pass
+ * SERVER_HIGH_WATER is not read from until it catches up. The service time
+ * of every request is recorded per op, for the LATENCY request and for the
+ * summary printed on shutdown.
+ *
+ * With a write-ahead log open, a change is made at once but its reply
+ * (and every later reply to that client) is held until the log flusher
+ * reports its record durable, so the changes of all clients are committed
+ * in groups without the loop ever waiting for an fsync. If the log fails
+ * first, the held reply says REPLY_IO_ERROR: the change stays in memory
+ * but will not survive a restart, and the store refuses every later one.
+ * @param path Socket path; a socket left there by an earlier run is replaced.
+ * @return 1 after a clean shutdown, 0 if the socket could not be set up.
+ */
+int run_server(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int ok = 0;
+    struct sigaction stop, old_int, old_term;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = server_on_signal;
+    stop.sa_flags = SA_RESTART;
+    sigemptyset(&stop.sa_mask);
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    server.epoll_fd = epoll_create1(0);
+    if (server.listen_fd < 0 || server.epoll_fd < 0 || pipe(server.stop_pipe) != 0 || pipe(server.wal_pipe) != 0 ||
+        bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        goto done;
+    }
+    if (listen(server.listen_fd, SOMAXCONN) != 0) {
+        unlink(path);
+        goto done;
+    }
+    fcntl(server.listen_fd, F_SETFL, O_NONBLOCK);
+    fcntl(server.stop_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(server.wal_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(server.wal_pipe[1], F_SETFL, O_NONBLOCK);
+
+    // The listener and the stop pipe are told apart from clients by address
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &server.listen_fd;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev);
+    ev.data.ptr = server.stop_pipe;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.stop_pipe[0], &ev);
+    ev.data.ptr = server.wal_pipe;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wal_pipe[0], &ev);
+    // Changes are acknowledged by their held replies, so records are only queued
+    pthread_mutex_lock(&wal.lock);
+    wal.notify_fd = server.wal_pipe[1];
+    pthread_mutex_unlock(&wal.lock);
+    wal_deferred = 1;
+    sigaction(SIGINT, &stop, &old_int);
+    sigaction(SIGTERM, &stop, &old_term);
+
+    printf("Serving %zu student(s) on %s (Ctrl-C to stop).\n", store_live_count(), path);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &server.listen_fd) {
+                server_accept();
+                continue;
+            }
+            if (tag == server.stop_pipe) {
+                running = 0;
+                continue;
+            }
+            if (tag == server.wal_pipe) {
+                char drain[64];
+                while (read(server.wal_pipe[0], drain, sizeof(drain)) > 0) {
+                }
+                server_release_all();
+                continue;
+            }
+            ServerClient *client = tag;
+            int alive = !(events[i].events & (EPOLLHUP | EPOLLERR));
+            if (alive && (events[i].events & EPOLLIN)) {
+                alive = server_read(client);
+            }
+            if (alive) {
+                alive = server_process(client) && server_write(client) && server_update_events(client);
+            }
+            if (!alive) {
+                server_close_client(client);
+            }
+        }
+    }
+    ok = 1;
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    // commit what is queued and send the replies it releases, best effort
+    if (wal.fd >= 0) {
+        wal_wait_idle();
+    }
+    for (size_t i = 0; i < server.client_count; i++) {
+        server_write(server.clients[i]);
+    }
+    while (server.client_count > 0) {
+        server_close_client(server.clients[server.client_count - 1]);
+    }
+    unlink(path);
+    print_server_latency();
+
+done:
+    wal_deferred = 0;
+    pthread_mutex_lock(&wal.lock);
+    wal.notify_fd = -1;
+    pthread_mutex_unlock(&wal.lock);
+    free(server.clients);
+    server.clients = NULL;
+    server.client_capacity = 0;
+    int fds[] = {server.listen_fd, server.epoll_fd, server.stop_pipe[0], server.stop_pipe[1],
+                 server.wal_pipe[0], server.wal_pipe[1]};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    server.listen_fd = server.epoll_fd = server.stop_pipe[0] = server.stop_pipe[1] = -1;
+    server.wal_pipe[0] = server.wal_pipe[1] = -1;
+    return ok;
+}
+
+/**
+ * @brief Accepts every pending connection and starts watching it.
+ */
+void server_accept() {
+    for (;;) {
+        int fd = accept(server.listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return; // EAGAIN once the backlog is empty; otherwise retried on the next wakeup
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+
+        if (server.client_count == server.client_capacity) {
+            size_t new_capacity = server.client_capacity ? server.client_capacity * 2 : 64;
+            ServerClient **grown = realloc(server.clients, new_capacity * sizeof(ServerClient *));
+            if (grown == NULL) {
+                close(fd);
+                return;
+            }
+            server.clients = grown;
+            server.client_capacity = new_capacity;
+        }
+        ServerClient *client = calloc(1, sizeof(ServerClient));
+        if (client == NULL) {
+            close(fd);
+            return;
+        }
+        client->fd = fd;
+        client->events = EPOLLIN;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(client);
+            return;
+        }
+        client->slot = server.client_count;
+        server.clients[server.client_count++] = client;
+    }
+}
+
+/**
+ * @brief Disconnects a client and frees its buffers.
+ */
+void server_close_client(ServerClient *client) {
+    close(client->fd); // also removes it from the epoll set
+    ServerClient *last = server.clients[--server.client_count];
+    server.clients[client->slot] = last;
+    last->slot = client->slot;
+    free(client->in);
+    free(client->out);
+    free(client->holds);
+    free(client);
+}
+
+/**
+ * @brief Reads whatever the client has sent, up to SERVER_READ_SIZE bytes.
+ *
+ * One read per wakeup keeps a busy client from starving the others.
+ * @return 1 if the connection is still open, 0 if it was closed or failed.
+ */
+int server_read(ServerClient *client) {
+    if (client->in_capacity - client->in_used < SERVER_READ_SIZE) {
+        size_t new_capacity = client->in_capacity ? client->in_capacity * 2 : SERVER_READ_SIZE;
+        while (new_capacity - client->in_used < SERVER_READ_SIZE) {
+            new_capacity *= 2;
+        }
+        unsigned char *grown = realloc(client->in, new_capacity);
+        if (grown == NULL) {
+            return 0;
+        }
+        client->in = grown;
+        client->in_capacity = new_capacity;
+    }
+    ssize_t n = recv(client->fd, client->in + client->in_used, SERVER_READ_SIZE, 0);
+    if (n > 0) {
+        client->in_used += (size_t)n;
+        return 1;
+    }
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/**
+ * @brief Drops the held replies whose records are now durable and tells
+ * how far the client's replies may be sent. A reply whose record the log
+ * failed to write is released with its status changed to REPLY_IO_ERROR.
+ *
+ * @return Offset in the out buffer up to which replies may be sent.
+ */
+size_t server_release_holds(ServerClient *client) {
+    size_t released = 0;
+    while (released < client->hold_count) {
+        ServerHold *hold = &client->holds[released];
+        if (hold->sequence > __atomic_load_n(&wal.synced, __ATOMIC_ACQUIRE)) {
+            // a failed log never syncs again; read synced after failed so a
+            // group that succeeded first is not reported as lost
+            if (!__atomic_load_n(&wal.failed, __ATOMIC_ACQUIRE) ||
+                hold->sequence <= __atomic_load_n(&wal.synced, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            client->out[hold->start + 4] = REPLY_IO_ERROR;
+        }
+        released++;
+    }
+    if (released > 0) {
+        client->hold_count -= released;
+        memmove(client->holds, client->holds + released, client->hold_count * sizeof(ServerHold));
+    }
+    return client->hold_count > 0 ? client->holds[0].start : client->out_used;
+}
+
+/**
+ * @brief Holds the reply starting at 'start', and every reply after it,
+ * until log record 'sequence' is durable.
+ *
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int server_hold_reply(ServerClient *client, size_t start, unsigned long long sequence) {
+    if (client->hold_count == client->hold_capacity) {
+        size_t new_capacity = client->hold_capacity ? client->hold_capacity * 2 : 16;
+        ServerHold *grown = realloc(client->holds, new_capacity * sizeof(ServerHold));
+        if (grown == NULL) {
+            return 0;
+        }
+        client->holds = grown;
+        client->hold_capacity = new_capacity;
+    }
+    client->holds[client->hold_count].start = start;
+    client->holds[client->hold_count].sequence = sequence;
+    client->hold_count++;
+    return 1;
+}
+
+/**
+ * @brief Sends the replies a group commit released, to every client that
+ * was waiting for one. A client whose socket fails is shut down, and
+ * closed when epoll reports the hangup.
+ */
+void server_release_all() {
+    for (size_t i = 0; i < server.client_count; i++) {
+        ServerClient *client = server.clients[i];
+        if (client->hold_count > 0 && !(server_write(client) && server_update_events(client))) {
+            shutdown(client->fd, SHUT_RDWR);
+        }
+    }
+}
+
+/**
+ * @brief Sends as much of the client's releasable replies as the socket
+ * takes.
+ *
+ * @return 1 unless the connection failed.
+ */
+int server_write(ServerClient *client) {
+    size_t limit = server_release_holds(client);
+    while (client->out_sent < limit) {
+        ssize_t n = send(client->fd, client->out + client->out_sent,
+                         limit - client->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->out_sent += (size_t)n;
+    }
+    if (client->out_sent == client->out_used) {
+        client->out_sent = client->out_used = 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Handles every complete request frame the client has sent, unless
+ * its unsent replies have reached SERVER_HIGH_WATER.
+ *
+ * @return 1 unless the client broke the framing or memory ran out.
+ */
+int server_process(ServerClient *client) {
+    size_t pos = 0;
+    while (client->out_used - client->out_sent < SERVER_HIGH_WATER && client->in_used - pos >= 4) {
+        uint32_t len;
+        memcpy(&len, client->in + pos, sizeof(len));
+        if (len == 0 || len > SERVER_MAX_FRAME) {
+            return 0;
+        }
+        if (client->in_used - pos - 4 < len) {
+            break;
+        }
+        if (!server_handle(client, client->in + pos + 4, len)) {
+            return 0;
+        }
+        pos += 4 + len;
+    }
+    if (pos > 0) {
+        memmove(client->in, client->in + pos, client->in_used - pos);
+        client->in_used -= pos;
+    }
+    return 1;
+}
+
+/**
+ * @brief Registers interest in reading while the client is under
+ * SERVER_HIGH_WATER and in writing while replies are pending.
+ *
+ * @return 1 on success, 0 if epoll refused the change.
+ */
+int server_update_events(ServerClient *client) {
+    size_t unsent = client->out_used - client->out_sent;
+    size_t sendable = (client->hold_count > 0 ? client->holds[0].start : client->out_used) - client->out_sent;
+    uint32_t events = 0;
+    if (unsent < SERVER_HIGH_WATER) {
+        events |= EPOLLIN;
+    }
+    if (sendable > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events == client->events) {
+        return 1;
+    }
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = client;
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) != 0) {
+        return 0;
+    }
+    client->events = events;
+    return 1;
+}
+
+/**
+ * @brief Returns space for len more bytes of replies. Sent bytes are
+ * dropped from the front first. The caller advances out_used.
+ *
+ * @return Pointer to the space, or NULL if memory is exhausted.
+ */
+unsigned char *server_reply_reserve(ServerClient *client, size_t len) {
+    if (client->out_used + len > client->out_capacity && client->out_sent > 0) {
+        memmove(client->out, client->out + client->out_sent, client->out_used - client->out_sent);
+        client->out_used -= client->out_sent;
+        for (size_t i = 0; i < client->hold_count; i++) {
+            client->holds[i].start -= client->out_sent;
+        }
+        client->out_sent = 0;
+    }
+    if (client->out_used + len > client->out_capacity) {
+        size_t new_capacity = client->out_capacity ? client->out_capacity * 2 : 64 * 1024;
+        while (new_capacity < client->out_used + len) {
+            new_capacity *= 2;
+        }
+        unsigned char *grown = realloc(client->out, new_capacity);
+        if (grown == NULL) {
+            return NULL;
+        }
+        client->out = grown;
+        client->out_capacity = new_capacity;
+    }
+    return client->out + client->out_used;
+}
+
+/**
+ * @brief Encodes one student as a reply record.
+ *
+ * @return Pointer just past the record (at most 13 + MAX_NAME_LENGTH bytes).
+ */
+unsigned char *server_put_record(unsigned char *p, size_t row) {
+    int32_t id = student_id(row);
+    double score = student_score(row);
+    const char *name = student_name(row);
+    size_t name_len = strlen(name);
+    memcpy(p, &id, sizeof(id));
+    memcpy(p + 4, &score, sizeof(score));
+    p[12] = (unsigned char)name_len;
+    memcpy(p + 13, name, name_len);
+    return p + 13 + name_len;
+}
+
+/**
+ * @brief Runs one request and queues its reply frame.
+ *
+ * A malformed request gets a REPLY_BAD_REQUEST reply; the connection stays
+ * usable because the framing is intact.
+ * @param request The request payload (op byte first).
+ * @param len Payload length, at least 1.
+ * @return 1 on success, 0 if there was no memory for the reply.
+ */
+int server_handle(ServerClient *client, const unsigned char *request, uint32_t len) {
+    double start = now_seconds();
+    int op = request[0];
+    const unsigned char *args = request + 1;
+    uint32_t args_len = len - 1;
+
+    // Size the reply up front; only LIST replies can be large
+    size_t first = 0;
+    size_t rows = 0;
+    if (op == OP_LIST && args_len == 8) {
+        uint32_t first32, limit32;
+        memcpy(&first32, args, sizeof(first32));
+        memcpy(&limit32, args + 4, sizeof(limit32));
+        first = first32;
+        if (first < student_count) {
+            rows = student_count - first;
+            rows = rows < limit32 ? rows : limit32;
+            rows = rows < SERVER_LIST_LIMIT ? rows : SERVER_LIST_LIMIT;
+        }
+    }
+    unsigned char *reply = server_reply_reserve(client, 256 + rows * (13 + MAX_NAME_LENGTH));
+    if (reply == NULL) {
+        return 0;
+    }
+    unsigned char *p = reply + 5; // after the length and the status byte
+    ReplyStatus status = REPLY_OK;
+    unsigned long long logged = wal.sequence;
+
+    switch (op) {
+        case OP_ADD:
+        case OP_UPDATE: {
+            Student s;
+            int32_t id;
+            double score;
+            size_t name_len = args_len >= 12 ? args_len - 12 : 0;
+            if (name_len == 0 || name_len > MAX_NAME_LENGTH - 1) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            memcpy(&id, args, sizeof(id));
+            memcpy(&score, args + 4, sizeof(score));
+            if (!(score >= 0 && score <= 100) || memchr(args + 12, '\0', name_len) != NULL ||
+                memchr(args + 12, '\n', name_len) != NULL) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            s.id = id;
+            s.score = score;
+            memcpy(s.name, args + 12, name_len);
+            s.name[name_len] = '\0';
+            StoreStatus stored = op == OP_ADD ? store_append(&s) : store_update(&s);
+            status = stored == STORE_OK ? REPLY_OK
+                   : stored == STORE_DUPLICATE_ID ? REPLY_DUPLICATE_ID
+                   : stored == STORE_NOT_FOUND ? REPLY_NOT_FOUND
+                   : stored == STORE_IO_ERROR ? REPLY_IO_ERROR : REPLY_NO_MEMORY;
+            break;
+        }
+        case OP_DELETE: {
+            int32_t id;
+            if (args_len != 4) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            memcpy(&id, args, sizeof(id));
+            StoreStatus deleted = store_delete(id);
+            status = deleted == STORE_OK ? REPLY_OK
+                   : deleted == STORE_NOT_FOUND ? REPLY_NOT_FOUND
+                   : deleted == STORE_IO_ERROR ? REPLY_IO_ERROR : REPLY_NO_MEMORY;
+            break;
+        }
+        case OP_GET: {
+            int32_t id;
+            if (args_len != 4) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            memcpy(&id, args, sizeof(id));
+            if (!store_ensure_indexes()) {
+                status = REPLY_NO_MEMORY;
+                break;
+            }
+            size_t row = id_index_find(id);
+            if (row == NO_ROW) {
+                status = REPLY_NOT_FOUND;
+                break;
+            }
+            p = server_put_record(p, row);
+            break;
+        }
+        case OP_LIST: {
+            if (args_len != 8) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            unsigned char *count_at = p;
+            uint32_t count = 0;
+            p += sizeof(count);
+            for (size_t i = first; i < first + rows; i++) {
+                if (!student_dead(i)) {
+                    p = server_put_record(p, i);
+                    count++;
+                }
+            }
+            memcpy(count_at, &count, sizeof(count));
+            break;
+        }
+        case OP_STATS: {
+            if (args_len != 0) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            store_ensure_aggregates();
+            ScoreStats stats = stats_finish(&score_totals.stats);
+            uint64_t count = stats.count;
+            double values[4] = {stats.mean, stats.min, stats.max, sqrt(stats.variance)};
+            if (count == 0) {
+                memset(values, 0, sizeof(values));
+            }
+            memcpy(p, &count, sizeof(count));
+            memcpy(p + 8, values, sizeof(values));
+            p += 8 + sizeof(values);
+            const char grades[] = "ABCDF";
+            for (int g = 0; grades[g] != '\0'; g++) {
+                uint64_t in_band = score_totals.grade_counts[grade_index(grades[g])];
+                memcpy(p, &in_band, sizeof(in_band));
+                p += sizeof(in_band);
+            }
+            break;
+        }
+        case OP_LATENCY: {
+            if (args_len != 0) {
+                status = REPLY_BAD_REQUEST;
+                break;
+            }
+            for (int o = OP_ADD; o < SERVER_OP_END; o++) {
+                uint64_t summary[3] = {server_latency[o].total,
+                                       latency_percentile(&server_latency[o], 0.50),
+                                       latency_percentile(&server_latency[o], 0.99)};
+                memcpy(p, summary, sizeof(summary));
+                p += sizeof(summary);
+            }
+            break;
+        }
+        default:
+            status = REPLY_BAD_REQUEST;
+            break;
+    }
+
+    reply[4] = (unsigned char)status;
+    uint32_t reply_len = (uint32_t)(p - reply - 4);
+    memcpy(reply, &reply_len, sizeof(reply_len));
+    // a change is acknowledged only once its log record is durable
+    if (wal.sequence != logged && !server_hold_reply(client, (size_t)(reply - client->out), wal.sequence)) {
+        return 0;
+    }
+    client->out_used += 4 + reply_len;
+    if (op >= OP_ADD && op < SERVER_OP_END) {
+        latency_record(&server_latency[op], (uint64_t)((now_seconds() - start) * 1e9));
+    }
+    return 1;
+}
+
+/**
+ * @brief Prints the request count and p50/p99 service time of each op.
+ */
+void print_server_latency() {
+    printf("\n%-8s %12s %12s %12s\n", "Op", "Requests", "p50 (us)", "p99 (us)");
+    for (int o = OP_ADD; o < SERVER_OP_END; o++) {
+        const LatencyHistogram *h = &server_latency[o];
+        printf("%-8s %12llu %12.2f %12.2f\n", server_op_names[o], (unsigned long long)h->total,
+               latency_percentile(h, 0.50) / 1000.0, latency_percentile(h, 0.99) / 1000.0);
+    }
+}
+
+/**
+ * @brief Adds to a counter that only this thread writes but other threads
+ * may read.
+ */
+void stat_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns this thread's statistics block, allocating and
+ * registering it on first use.
+ *
+ * @return The block, or NULL if memory is exhausted (the thread then goes
+ * uncounted).
+ */
+ThreadStats *thread_stats_get() {
+    if (thread_stats == NULL) {
+        ThreadStats *ts = calloc(1, sizeof(ThreadStats));
+        if (ts == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&stats_registry.lock);
+        ts->next = stats_registry.threads;
+        stats_registry.threads = ts;
+        pthread_mutex_unlock(&stats_registry.lock);
+        thread_stats = ts;
+    }
+    return thread_stats;
+}
+
+/**
+ * @brief Counts table rows formatted by this thread's current command.
+ */
+void stats_count_rows(size_t n) {
+    if (thread_stats != NULL) {
+        stat_add(&thread_stats->commands[thread_stats->current].rows, n);
+    }
+}
+
+/**
+ * @brief Starts timing a command on this thread.
+ *
+ * @param kind The command, or CMD_NONE if it is not known yet (see
+ * command_kind()).
+ * @return The start time, for command_end().
+ */
+double command_begin(CommandKind kind) {
+    ThreadStats *ts = thread_stats_get();
+    if (ts != NULL) {
+        render_mark(ts->current); // output buffered outside any command
+        ts->current = kind;
+    }
+    return now_seconds();
+}
+
+/**
+ * @brief Names the command being timed, once it has been parsed.
+ */
+void command_kind(CommandKind kind) {
+    if (thread_stats != NULL) {
+        thread_stats->current = kind;
+    }
+}
+
+/**
+ * @brief Records the latency of the command started by command_begin().
+ *
+ * Lines that turned out not to be a command (blank, unknown, exit) are
+ * not recorded.
+ * @return The end time, which a caller running commands back to back can
+ * use as the start of the next one instead of reading the clock again.
+ */
+double command_end(double start) {
+    double end = now_seconds();
+    ThreadStats *ts = thread_stats;
+    if (ts == NULL) {
+        return end;
+    }
+    render_mark(ts->current);
+    if (ts->current == CMD_NONE) {
+        return end;
+    }
+    CommandCounters *c = &ts->commands[ts->current];
+    uint64_t ns = (uint64_t)((end - start) * 1e9);
+    latency_record(&c->latency, ns);
+    stat_add(&c->total_ns, ns);
+    if (ns > c->max_ns) {
+        __atomic_store_n(&c->max_ns, ns, __ATOMIC_RELAXED);
+    }
+    ts->current = CMD_NONE;
+    return end;
+}
+
+/**
+ * @brief Adds up the statistics of every thread.
+ *
+ * @param sum Zeroed block that receives the totals.
+ */
+void stats_sum_threads(ThreadStats *sum) {
+    pthread_mutex_lock(&stats_registry.lock);
+    for (ThreadStats *ts = stats_registry.threads; ts != NULL; ts = ts->next) {
+        for (int k = 0; k < COMMAND_END; k++) {
+            CommandCounters *from = &ts->commands[k], *to = &sum->commands[k];
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                to->latency.counts[b] += __atomic_load_n(&from->latency.counts[b], __ATOMIC_RELAXED);
+            }
+            to->latency.total += __atomic_load_n(&from->latency.total, __ATOMIC_RELAXED);
+            to->total_ns += __atomic_load_n(&from->total_ns, __ATOMIC_RELAXED);
+            uint64_t max_ns = __atomic_load_n(&from->max_ns, __ATOMIC_RELAXED);
+            to->max_ns = max_ns > to->max_ns ? max_ns : to->max_ns;
+            to->write_ns += __atomic_load_n(&from->write_ns, __ATOMIC_RELAXED);
+            to->rows += __atomic_load_n(&from->rows, __ATOMIC_RELAXED);
+            to->bytes += __atomic_load_n(&from->bytes, __ATOMIC_RELAXED);
+        }
+        sum->records_added += __atomic_load_n(&ts->records_added, __ATOMIC_RELAXED);
+        sum->records_updated += __atomic_load_n(&ts->records_updated, __ATOMIC_RELAXED);
+        sum->records_deleted += __atomic_load_n(&ts->records_deleted, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_registry.lock);
+}
+
+/**
+ * @brief Prints the per-command latency table and the counters of all
+ * threads.
+ *
+ * Write % is the share of a command's time spent in write(2) for table
+ * output; the rest went to parsing and computing (and, in the menu, to
+ * waiting at its prompts). Output that is flushed outside a command, such
+ * as the end of a script, is shown as "other".
+ * @return 1 on success, 0 if memory is exhausted.
+ */
+int print_command_stats(FILE *out) {
+    ThreadStats *sum = calloc(1, sizeof(ThreadStats));
+    if (sum == NULL) {
+        return 0;
+    }
+    stats_sum_threads(sum);
+
+    fprintf(out, "%-12s %10s %10s %10s %10s %10s %10s %7s %12s %14s\n", "Command", "Calls", "Mean (us)",
+            "p50 (us)", "p90 (us)", "p99 (us)", "Max (us)", "Write %", "Rows", "Bytes");
+    uint64_t rows = 0, bytes = 0;
+    for (int k = 0; k < COMMAND_END; k++) {
+        const CommandCounters *c = &sum->commands[k];
+        rows += c->rows;
+        bytes += c->bytes;
+        if (c->latency.total == 0 && c->rows == 0 && c->bytes == 0) {
+            continue;
+        }
+        if (c->latency.total == 0) {
+            fprintf(out, "%-12s %10d %10s %10s %10s %10s %10s %7s %12llu %14llu\n", command_names[k], 0,
+                    "-", "-", "-", "-", "-", "-", (unsigned long long)c->rows, (unsigned long long)c->bytes);
+            continue;
+        }
+        double p[3];
+        const double q[3] = {0.50, 0.90, 0.99};
+        for (int i = 0; i < 3; i++) {
+            // a bucket midpoint may lie past the slowest sample
+            uint64_t ns = latency_percentile(&c->latency, q[i]);
+            p[i] = (ns < c->max_ns ? ns : c->max_ns) / 1000.0;
+        }
+        fprintf(out, "%-12s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %7.1f %12llu %14llu\n", command_names[k],
+                (unsigned long long)c->latency.total, (double)c->total_ns / c->latency.total / 1000.0,
+                p[0], p[1], p[2], c->max_ns / 1000.0,
+                c->total_ns > 0 ? 100.0 * c->write_ns / c->total_ns : 0.0,
+                (unsigned long long)c->rows, (unsigned long long)c->bytes);
+    }
+    fprintf(out, "Records added: %llu, updated: %llu, deleted: %llu\n",
+            (unsigned long long)sum->records_added, (unsigned long long)sum->records_updated,
+            (unsigned long long)sum->records_deleted);
+    fprintf(out, "Rows rendered: %llu, bytes written: %llu\n",
+            (unsigned long long)rows, (unsigned long long)bytes);
+    free(sum);
+    return 1;
+}
+
+/**
+ * @brief Appends the statistics report to the render buffer, so it stays
+ * in order with the tables around it.
+ */
+void render_command_stats() {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (out == NULL) {
+        render_printf("Error: Out of memory.\n");
+        return;
+    }
+    int ok = print_command_stats(out);
+    fclose(out);
+    if (ok) {
+        render_append(text, len);
+    } else {
+        render_printf("Error: Out of memory.\n");
+    }
+    free(text);
+    if (!table_output.hold) {
+        render_flush();
+    }
+}
+
+/**
+ * @brief Shows the latency and counters of every command run so far.
+ */
+void show_command_stats() {
+    printf("\n--- Command Statistics ---\n");
+    render_command_stats();
+}
+
+/**
+ * @brief Replaces the --stats-file dump with the current statistics.
+ *
+ * The report is written to PATH.tmp and renamed over PATH, so a reader
+ * never sees half a dump.
+ * @return 1 on success, 0 on failure (errno is set).
+ */
+int stats_dump_write() {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", stats_registry.dump_path) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        return 0;
+    }
+    int ok = print_command_stats(out);
+    if (fclose(out) != 0 || !ok) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return rename(tmp_path, stats_registry.dump_path) == 0;
+}
+
+/**
+ * @brief Body of the dump thread: rewrites the dump file every
+ * stats_registry.dump_interval seconds until stopped.
+ */
+void *stats_dump_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&stats_registry.lock);
+    while (!stats_registry.stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double wake = deadline.tv_sec + deadline.tv_nsec / 1e9 + stats_registry.dump_interval;
+        deadline.tv_sec = (time_t)wake;
+        deadline.tv_nsec = (long)((wake - (double)deadline.tv_sec) * 1e9);
+        while (!stats_registry.stop &&
+               pthread_cond_timedwait(&stats_registry.wake, &stats_registry.lock, &deadline) != ETIMEDOUT) {
+        }
+        if (stats_registry.stop) {
+            break;
+        }
+        pthread_mutex_unlock(&stats_registry.lock); // stats_sum_threads() takes it
+        stats_dump_write();
+        pthread_mutex_lock(&stats_registry.lock);
+    }
+    pthread_mutex_unlock(&stats_registry.lock);
+    return NULL;
+}
+
+/**
+ * @brief Writes a first dump and starts the dump thread.
+ *
+ * @return 1 on success, 0 if the file cannot be written or the thread
+ * cannot be created (errno is set).
+ */
+int stats_dump_start() {
+    if (!stats_dump_write()) {
+        return 0;
+    }
+    stats_registry.stop = 0;
+    int err = pthread_create(&stats_registry.dumper, NULL, stats_dump_main, NULL);
+    if (err != 0) {
+        errno = err;
+        return 0;
+    }
+    stats_registry.dumping = 1;
+    return 1;
+}
+
+/**
+ * @brief Stops the dump thread and writes the final dump.
+ */
+void stats_dump_stop() {
+    if (!stats_registry.dumping) {
+        return;
+    }
+    pthread_mutex_lock(&stats_registry.lock);
+    stats_registry.stop = 1;
+    pthread_cond_signal(&stats_registry.wake);
+    pthread_mutex_unlock(&stats_registry.lock);
+    pthread_join(stats_registry.dumper, NULL);
+    stats_registry.dumping = 0;
+    if (!stats_dump_write()) {
+        fprintf(stderr, "Warning: Could not write statistics to '%s' (%s).\n",
+                stats_registry.dump_path, strerror(errno));
+    }
+}
+
+/**
+ * @brief Adds a new student record to the database.
+ *
+ * Prompts the user for the student's ID, name, and score. It validates
+ * the score and appends the record to the growable store.
+ */
+void add_student() {
+    printf("\n--- Add New Student ---\n");
+    
+    // get Student ID
+    printf("Enter Student ID: ");
+    int new_id;
+    while (scanf("%d", &new_id) != 1) {
+        printf("Invalid ID. Please enter a number: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    // IDs must be unique; the hash index answers this in constant time
+    if (!store_ensure_indexes()) {
+        printf("Error: Out of memory. Cannot add more students.\n");
+        return;
+    }
+    if (id_index_find(new_id) != NO_ROW) {
+        printf("Error: A student with ID %d already exists.\n", new_id);
+        return;
+    }
+    
+    // get Student Name, read straight into the free end of the name arena
+    printf("Enter Student Name: ");
+    char *name = name_arena_tail(MAX_NAME_LENGTH);
+    if (name == NULL) {
+        printf("Error: Out of memory. Cannot add more students.\n");
+        clear_input_buffer();
+        return;
+    }
+    read_string(name, MAX_NAME_LENGTH);
+
+    // get Student Score
+    double new_score = -1.0;
+    printf("Enter Student Score (0-100): ");
+    while (scanf("%lf", &new_score) != 1 || new_score < 0 || new_score > 100) {
+        printf("Invalid score. Please enter a number between 0 and 100: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    // keep the name (or reuse an identical stored one), then add the student
+    // to the store (this also increments student_count)
+    long name_offset = name_intern_tail();
+    StoreStatus status = name_offset < 0 ? STORE_NO_MEMORY
+                                         : store_insert(new_id, (unsigned int)name_offset, new_score);
+    if (status == STORE_IO_ERROR) {
+        printf("Error: Could not write the write-ahead log. The student was not added.\n");
+        return;
+    }
+    if (status != STORE_OK) {
+        printf("Error: Out of memory. Cannot add more students.\n");
+        return;
+    }
+
+    printf("\nStudent added successfully!\n");
+}
+
+/**
+ * @brief Replaces the name and score of the student with a given ID.
+ *
+ * The new version is stored as a fresh row, so the student moves to the
+ * end of Display All Students.
+ */
+void update_student() {
+    printf("\n--- Update Student ---\n");
+
+    printf("Enter Student ID: ");
+    Student s;
+    while (scanf("%d", &s.id) != 1) {
+        printf("Invalid ID. Please enter a number: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    if (!store_ensure_indexes()) {
+        printf("Error: Out of memory while building the index.\n");
+        return;
+    }
+    size_t row = id_index_find(s.id);
+    if (row == NO_ROW) {
+        printf("No student with ID %d.\n", s.id);
+        return;
+    }
+    print_table_header();
+    print_student_row(row);
+    print_table_footer();
+
+    printf("Enter New Name: ");
+    read_string(s.name, MAX_NAME_LENGTH);
+    printf("Enter New Score (0-100): ");
+    while (scanf("%lf", &s.score) != 1 || s.score < 0 || s.score > 100) {
+        printf("Invalid score. Please enter a number between 0 and 100: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    StoreStatus status = store_update(&s);
+    if (status == STORE_IO_ERROR) {
+        printf("Error: Could not write the write-ahead log. The student was not changed.\n");
+        return;
+    }
+    if (status != STORE_OK) {
+        printf("Error: Out of memory. The student was not changed.\n");
+        return;
+    }
+    printf("\nStudent updated successfully!\n");
+}
+
+/**
+ * @brief Deletes the student with a given ID.
+ */
+void delete_student() {
+    printf("\n--- Delete Student ---\n");
+
+    printf("Enter Student ID: ");
+    int id;
+    while (scanf("%d", &id) != 1) {
+        printf("Invalid ID. Please enter a number: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    StoreStatus status = store_delete(id);
+    if (status == STORE_NOT_FOUND) {
+        printf("No student with ID %d.\n", id);
+        return;
+    }
+    if (status == STORE_IO_ERROR) {
+        printf("Error: Could not write the write-ahead log. The student was not deleted.\n");
+        return;
+    }
+    if (status != STORE_OK) {
+        printf("Error: Out of memory. The student was not deleted.\n");
+        return;
+    }
+    printf("Student %d deleted.\n", id);
+}
+
+/**
+ * @brief Displays all student records currently in the database.
+ *
+ * If no students are present, it prints a message. Otherwise, it iterates
+ * through the student array and prints each record in a formatted table.
+ * Students are listed in the order they were added, except that an
+ * updated student is listed last, where its new version was stored.
+ * It reads through a view, so it may run on another thread while students
+ * are being added; the table holds the rows published when it started.
+ */
+void display_all_students() {
+    printf("\n--- List of All Students ---\n");
+
+    StoreView view;
+    store_view_begin(&view);
+
+    // Loop through all students and print their details; the header waits
+    // for the first live row in case every row was deleted
+    size_t shown = 0;
+    for (size_t i = 0; i < view.count; i++) {
+        if (view_student_dead(&view, i)) {
+            continue;
+        }
+        if (shown++ == 0) {
+            print_table_header();
+        }
+        const char *name = view_student_name(&view, i);
+        char *out = render_reserve(strlen(name) + ROW_FORMAT_SLACK);
+        table_output.used += format_student_row(out, view_student_id(&view, i), name, view_student_score(&view, i));
+    }
+    store_view_end(&view);
+    stats_count_rows(shown);
+    if (shown == 0) {
+        printf("No students in the database.\n");
+        return;
+    }
+    print_table_footer();
+}
+
+/**
+ * @brief Prints the column headings of the student table.
+ */
+void print_table_header() {
+    static const char rule[] = "----------------------------------------------------------\n";
+    char headings[128];
+    int len = snprintf(headings, sizeof(headings), "| %-5s | %-25s | %-10s | %-5s |\n", "ID", "Name", "Score", "Grade");
+    render_append(rule, sizeof(rule) - 1);
+    render_append(headings, (size_t)len);
+    render_append(rule, sizeof(rule) - 1);
+}
+
+/**
+ * @brief Prints the closing rule of the student table and flushes the
+ * buffered table to stdout (unless a script is holding the output).
+ */
+void print_table_footer() {
+    static const char rule[] = "----------------------------------------------------------\n";
+    render_append(rule, sizeof(rule) - 1);
+    if (!table_output.hold) {
+        render_flush();
+    }
+}
+
+/**
+ * @brief Prints one student as a row of the student table.
+ *
+ * The row is formatted straight into the render buffer; the table is
+ * written out by print_table_footer() (or earlier if the buffer fills).
+ * @param index Row of the student in the store.
+ */
+void print_student_row(size_t index) {
+    const char *name = student_name(index);
+    char *out = render_reserve(strlen(name) + ROW_FORMAT_SLACK);
+    table_output.used += format_student_row(out, student_id(index), name, student_score(index));
+    stats_count_rows(1);
+}
+
+/**
+ * @brief Looks up a single student by ID using the hash index.
+ */
+void lookup_student() {
+    printf("\n--- Look Up Student ---\n");
+
+    printf("Enter Student ID: ");
+    int id;
+    while (scanf("%d", &id) != 1) {
+        printf("Invalid ID. Please enter a number: ");
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    if (!store_ensure_indexes()) {
+        printf("Error: Out of memory while building the index.\n");
+        return;
+    }
+    size_t row = id_index_find(id);
+    if (row == NO_ROW) {
+        printf("No student with ID %d.\n", id);
+        return;
+    }
+    print_table_header();
+    print_student_row(row);
+    print_table_footer();
+}
+
+/**
+ * @brief Lists every student whose score falls in one letter-grade band,
+ * in ascending score order.
+ *
+ * The ordered score index is searched for the band's lower bound and the
+ * leaf chain is followed from there, so the cost is O(log n) plus the rows
+ * shown.
+ */
+void list_grade_band() {
+    printf("\n--- Students in a Grade Band ---\n");
+
+    printf("Enter Grade (A, B, C, D or F): ");
+    char line[16];
+    read_string(line, sizeof(line));
+    char grade = line[0];
+    if (grade >= 'a' && grade <= 'z') {
+        grade = grade - 'a' + 'A';
+    }
+    if (grade != 'A' && grade != 'B' && grade != 'C' && grade != 'D' && grade != 'F') {
+        printf("Invalid grade.\n");
+        return;
+    }
+
+    if (!store_ensure_indexes()) {
+        printf("Error: Out of memory while building the index.\n");
+        return;
+    }
+    double low, high;
+    grade_band_bounds(grade, &low, &high);
+    ScoreNode *leaf;
+    int pos;
+    score_index_seek(low, &leaf, &pos);
+
+    if (leaf == NULL || !(leaf->keys[pos].score < high)) {
+        printf("No students with grade %c.\n", grade);
+        return;
+    }
+    print_table_header();
+    while (leaf != NULL && leaf->keys[pos].score < high) {
+        print_student_row(leaf->keys[pos].row);
+        if (++pos == leaf->count) {
+            leaf = score_leaf_next(leaf);
+            pos = 0;
+        }
+    }
+    print_table_footer();
+}
+
+/**
+ * @brief Shows how many students fall in each letter-grade band, read from
+ * the running per-grade histogram.
+ */
+void display_grade_band_counts() {
+    printf("\n--- Students per Grade Band ---\n");
+
+    store_ensure_aggregates();
+    if (check_aggregates) {
+        aggregates_match_rescan();
+    }
+    const char grades[] = "ABCDF";
+    for (int g = 0; grades[g] != '\0'; g++) {
+        printf("%c: %zu\n", grades[g], score_totals.grade_counts[grade_index(grades[g])]);
+    }
+}
+
+/**
+ * @brief Lists the first NAME_SEARCH_LIMIT students whose name starts with
+ * a given prefix (ignoring case), in name order.
+ */
+void search_by_name_prefix() {
+    printf("\n--- Search by Name Prefix ---\n");
+
+    printf("Enter name prefix: ");
+    char prefix[MAX_NAME_LENGTH];
+    read_string(prefix, MAX_NAME_LENGTH);
+
+    if (name_trie.stale && !name_trie_rebuild()) {
+        printf("Error: Out of memory while building the name index.\n");
+        return;
+    }
+    size_t rows[NAME_SEARCH_LIMIT];
+    double start = now_seconds();
+    size_t found = name_trie_search(prefix, rows, NAME_SEARCH_LIMIT);
+    double elapsed = now_seconds() - start;
+
+    if (found == 0) {
+        printf("No student's name starts with '%s'.\n", prefix);
+        return;
+    }
+    print_table_header();
+    for (size_t i = 0; i < found; i++) {
+        print_student_row(rows[i]);
+    }
+    print_table_footer();
+    if (found == NAME_SEARCH_LIMIT) {
+        printf("Showing the first %d matches, found in %.3f ms.\n", NAME_SEARCH_LIMIT, elapsed * 1000.0);
+    } else {
+        printf("Found %zu match(es) in %.3f ms.\n", found, elapsed * 1000.0);
+    }
+}
+
+/**
+ * @brief Prompts for a CSV file and bulk-imports it into the store.
+ */
+void import_students() {
+    printf("\n--- Import Students from CSV ---\n");
+
+    printf("Enter CSV file path (id,name,score per line): ");
+    char path[4096];
+    read_string(path, sizeof(path));
+
+    ImportResult result;
+    double start = now_seconds();
+    int ok = import_csv(path, &result);
+    double elapsed = now_seconds() - start;
+
+    if (!ok && result.bytes == 0) {
+        printf("Error: Could not read '%s'.\n", path);
+        return;
+    }
+    if (!ok && result.log_failed) {
+        printf("Error: Could not write the write-ahead log. The import stopped early.\n");
+    } else if (!ok) {
+        printf("Error: Out of memory. The import stopped early.\n");
+    }
+    printf("Imported %zu student(s), rejected %zu line(s).\n", result.imported, result.rejected);
+    if (result.first_bad_line != 0) {
+        printf("First rejected line: %zu\n", result.first_bad_line);
+    }
+    if (elapsed > 0) {
+        printf("Read %.1f MB in %.3f s (%.1f MB/s).\n",
+               result.bytes / 1e6, elapsed, result.bytes / 1e6 / elapsed);
+    }
+}
+
+/**
+ * @brief Saves the store to a binary snapshot, to the --snapshot file if
+ * one was given or else to a path entered by the user.
+ */
+void save_snapshot_command() {
+    printf("\n--- Save Snapshot ---\n");
+
+    char path[4096];
+    if (snapshot_path != NULL) {
+        snprintf(path, sizeof(path), "%s", snapshot_path);
+    } else {
+        printf("Enter snapshot file path: ");
+        read_string(path, sizeof(path));
+    }
+
+    double start = now_seconds();
+    if (!(snapshot_path != NULL ? checkpoint_snapshot() : save_snapshot(path))) {
+        printf("Error: Could not save snapshot '%s'.\n", path);
+        return;
+    }
+    printf("Saved %zu student(s) to %s in %.2f ms.\n", student_count, path, (now_seconds() - start) * 1000.0);
+}
+
+/**
+ * @brief Saves the --snapshot file and, once it is safely on disk, empties
+ * the write-ahead log, whose records the snapshot now contains.
+ *
+ * @return 1 on success, 0 if the snapshot could not be written.
+ */
+int checkpoint_snapshot() {
+    if (!save_snapshot(snapshot_path)) {
+        return 0;
+    }
+    if (wal.fd >= 0 && !wal_checkpoint()) {
+        printf("Warning: Could not truncate the write-ahead log.\n");
+    }
+    return 1;
+}
+
+/**
+ * @brief Calculates and displays the average score of all students,
+ * together with the minimum, maximum and standard deviation.
+ */
+void calculate_average_score() {
+    printf("\n--- Average Score Calculation ---\n");
+
+    // The running totals already hold every statistic. They are read like
+    // a view so this never waits for (or tears against) an insert on
+    // another thread; until they are rebuilt after a snapshot load, a view
+    // is scanned instead.
+    StatsAccumulator totals;
+    if (!store_read_totals(&totals, NULL)) {
+        StoreView view;
+        stats_init(&totals);
+        store_view_begin(&view);
+        store_view_stats(&view, &totals);
+        store_view_end(&view);
+    } else if (check_aggregates) {
+        aggregates_match_rescan();
+    }
+    ScoreStats stats = stats_finish(&totals);
+    if (stats.count == 0) {
+        printf("Cannot calculate average. No students in the database.\n");
+        return;
+    }
+
+    printf("The average score for %zu student(s) is: %.2f\n", stats.count, stats.mean);
+    printf("Minimum: %.2f  Maximum: %.2f  Std. deviation: %.2f\n",
+           stats.min, stats.max, sqrt(stats.variance));
+}
+
+/**
+ * @brief Reports chosen percentiles of the scores (the median, quartiles
+ * and P10/P90 by default).
+ *
+ * Exact unless the program was started with --approx-quantiles.
+ */
+void show_percentiles() {
+    printf("\n--- Score Percentiles ---\n");
+
+    if (store_live_count() == 0) {
+        printf("No students in the database.\n");
+        return;
+    }
+
+    printf("Enter percentiles (0-100) separated by spaces, or press Enter for 10 25 50 75 90: ");
+    char line[256];
+    read_string(line, sizeof(line));
+    double percentiles[16];
+    int count = 0;
+    char *p = line;
+    while (count < 16) {
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p) {
+            break;
+        }
+        if (!(value >= 0.0 && value <= 100.0)) {
+            printf("Invalid percentile %g; use values from 0 to 100.\n", value);
+            return;
+        }
+        percentiles[count++] = value;
+        p = end;
+    }
+    if (count == 0) {
+        const double defaults[] = {10, 25, 50, 75, 90};
+        for (count = 0; count < 5; count++) {
+            percentiles[count] = defaults[count];
+        }
+    }
+
+    double start = now_seconds();
+    double values[16];
+    for (int i = 0; i < count; i++) {
+        values[i] = score_quantile(percentiles[i] / 100.0, approx_quantiles);
+    }
+    double elapsed = now_seconds() - start;
+    if (isnan(values[0])) {
+        printf("Error: Out of memory while building the index.\n");
+        return;
+    }
+
+    printf("%-10s | %-10s\n", "Percentile", "Score");
+    for (int i = 0; i < count; i++) {
+        printf("P%-9g | %-10.2f%s\n", percentiles[i], values[i], percentiles[i] == 50.0 ? " (median)" : "");
+    }
+    printf("%s, %zu student(s), %.3f ms.\n", approx_quantiles ? "Approximate (0.01-point sketch)" : "Exact",
+           store_live_count(), elapsed * 1000.0);
+}
+
+/**
+ * @brief Lists the K best or worst students by score, formatted like
+ * display_all_students.
+ */
+void show_top_students() {
+    printf("\n--- Top / Bottom K Students ---\n");
+
+    if (store_live_count() == 0) {
+        printf("No students in the database.\n");
+        return;
+    }
+
+    printf("Enter T for the top students or B for the bottom students: ");
+    char line[16];
+    read_string(line, sizeof(line));
+    int top = line[0] == 'T' || line[0] == 't';
+    if (!top && line[0] != 'B' && line[0] != 'b') {
+        printf("Invalid choice.\n");
+        return;
+    }
+    printf("Enter K (1-%d): ", MAX_RANK_K);
+    int k;
+    while (scanf("%d", &k) != 1 || k < 1 || k > MAX_RANK_K) {
+        printf("Invalid K. Please enter a number between 1 and %d: ", MAX_RANK_K);
+        clear_input_buffer();
+    }
+    clear_input_buffer();
+
+    size_t *rows = malloc((size_t)k * sizeof(size_t));
+    if (rows == NULL) {
+        printf("Error: Out of memory.\n");
+        return;
+    }
+    double start = now_seconds();
+    size_t found = store_rank_students(top, (size_t)k, rows);
+    double elapsed = now_seconds() - start;
+    if (found == 0) {
+        printf("Error: Out of memory.\n");
+        free(rows);
+        return;
+    }
+
+    print_table_header();
+    for (size_t i = 0; i < found; i++) {
+        print_student_row(rows[i]);
+    }
+    print_table_footer();
+    printf("%s %zu student(s), found in %.3f ms.\n", top ? "Top" : "Bottom", found, elapsed * 1000.0);
+    free(rows);
+}
+
+/**
+ * @brief Lists the students that pass a filter expression (see
+ * filter_compile()), or reports their average.
+ */
+void query_students() {
+    printf("\n--- Query with a Filter Expression ---\n");
+
+    printf("Fields: id, score, name, grade. Example: score >= 75 and id between 1000 and 2000 and name ~ \"Ra*\"\n");
+    printf("Enter filter: ");
+    char text[1024];
+    read_string(text, sizeof(text));
+    char error[160];
+    FilterNode *filter = filter_compile(text, error, sizeof(error));
+    if (filter == NULL) {
+        printf("Error: %s.\n", error);
+        return;
+    }
+
+    printf("Enter L to list the matching students or A for their average: ");
+    char line[16];
+    read_string(line, sizeof(line));
+    int average = line[0] == 'A' || line[0] == 'a';
+    if (!average && line[0] != 'L' && line[0] != 'l') {
+        printf("Invalid choice.\n");
+        filter_free(filter);
+        return;
+    }
+
+    double start = now_seconds();
+    if (!average) {
+        size_t matches = filter_list(filter);
+        double elapsed = now_seconds() - start;
+        if (matches == 0) {
+            printf("No students match the filter.\n");
+        } else {
+            printf("Matched %zu student(s) in %.3f ms.\n", matches, elapsed * 1000.0);
+        }
+        filter_free(filter);
+        return;
+    }
+
+    StatsAccumulator acc;
+    stats_init(&acc);
+    int ok = filter_reduce(filter, &acc, NULL);
+    double elapsed = now_seconds() - start;
+    filter_free(filter);
+    if (!ok) {
+        printf("Error: Out of memory.\n");
+        return;
+    }
+    ScoreStats stats = stats_finish(&acc);
+    if (stats.count == 0) {
+        printf("No students match the filter.\n");
+        return;
+    }
+    printf("The average score for %zu student(s) is: %.2f\n", stats.count, stats.mean);
+    printf("Minimum: %.2f  Maximum: %.2f  Std. deviation: %.2f\n",
+           stats.min, stats.max, sqrt(stats.variance));
+    printf("Computed in %.3f ms.\n", elapsed * 1000.0);
+}
+
+/**
+ * @brief Renders the result of store_group_by() as a table, one line per
+ * letter grade or score bucket, and flushes it unless a script is holding
+ * the output.
+ *
+ * Buckets are half-open except the last, which also holds a score of 100.
+ * @param filtered Whether the groups were restricted by a filter (only
+ * changes the message shown when no student was grouped).
+ */
+void render_group_report(uint32_t width_centi, const GroupTotals *groups, int filtered) {
+    static const char rule[] = "---------------------------------------------------------------\n";
+    int count = group_count_for(width_centi);
+    size_t total = 0;
+    for (int k = 0; k < count; k++) {
+        total += groups[k].count;
+    }
+    if (total == 0) {
+        render_printf(filtered ? "No students match the filter.\n" : "No students in the database.\n");
+    } else {
+        render_append(rule, sizeof(rule) - 1);
+        render_printf("| %-17s | %-10s | %-7s | %-7s | %-7s |\n",
+                      width_centi == 0 ? "Grade" : "Scores", "Students", "Average", "Minimum", "Maximum");
+        render_append(rule, sizeof(rule) - 1);
+        for (int k = 0; k < count; k++) {
+            char label[32];
+            if (width_centi == 0) {
+                snprintf(label, sizeof(label), "%c", "ABCDF"[k]); // grade_index() order
+            } else {
+                uint32_t high = (uint32_t)(k + 1) * width_centi;
+                snprintf(label, sizeof(label), "[%.2f, %.2f%c", (uint32_t)k * width_centi / 100.0,
+                         (high < 10000 ? high : 10000) / 100.0, k + 1 < count ? ')' : ']');
+            }
+            const GroupTotals *g = &groups[k];
+            if (g->count == 0) {
+                render_printf("| %-17s | %-10d | %-7s | %-7s | %-7s |\n", label, 0, "-", "-", "-");
+            } else {
+                render_printf("| %-17s | %-10zu | %-7.2f | %-7.2f | %-7.2f |\n",
+                              label, g->count, g->sum / g->count, g->min, g->max);
+            }
+        }
+        render_append(rule, sizeof(rule) - 1);
+    }
+    if (!table_output.hold) {
+        render_flush();
+    }
+}
+
+/**
+ * @brief Reports count, average, minimum and maximum per letter grade or
+ * per score bucket, optionally over the students matching a filter.
+ */
+void show_group_report() {
+    printf("\n--- Group Report by Grade or Score Bucket ---\n");
+
+    printf("Enter G to group by letter grade, or a bucket width in points (0.1-100): ");
+    char line[32];
+    read_string(line, sizeof(line));
+    uint32_t width_centi = 0;
+    int by_grade = (line[0] == 'G' || line[0] == 'g') && line[1] == '\0';
+    if (!by_grade && !group_parse_width(line, &width_centi)) {
+        printf("Invalid choice.\n");
+        return;
+    }
+
+    printf("Enter filter (leave empty for every student): ");
+    char text[1024];
+    read_string(text, sizeof(text));
+    FilterNode *filter = NULL;
+    if (text[0] != '\0') {
+        char error[160];
+        filter = filter_compile(text, error, sizeof(error));
+        if (filter == NULL) {
+            printf("Error: %s.\n", error);
+            return;
+        }
+    }
+
+    GroupTotals groups[GROUP_MAX_BUCKETS];
+    double start = now_seconds();
+    int ok = store_group_by(width_centi, filter, groups);
+    double elapsed = now_seconds() - start;
+    filter_free(filter);
+    if (!ok) {
+        printf("Error: Out of memory.\n");
+        return;
+    }
+    render_group_report(width_centi, groups, text[0] != '\0');
+    printf("Computed in %.3f ms.\n", elapsed * 1000.0);
+}
+
+/**
+ * @brief Writes the whole roster, ranked by score (or ordered by ID), to
+ * the screen or a file in the display_all_students table format.
+ */
+void export_roster() {
+    printf("\n--- Export Ranked Roster ---\n");
+
+    size_t live = store_live_count();
+    if (live == 0) {
+        printf("No students in the database.\n");
+        return;
+    }
+
+    printf("Order by S (score, highest first) or I (ID): ");
+    char line[16];
+    read_string(line, sizeof(line));
+    ExportOrder order;
+    if (line[0] == 'S' || line[0] == 's') {
+        order = EXPORT_BY_SCORE;
+    } else if (line[0] == 'I' || line[0] == 'i') {
+        order = EXPORT_BY_ID;
+    } else {
+        printf("Invalid choice.\n");
+        return;
+    }
+    printf("Enter output file path (leave empty for the screen): ");
+    char path[4096];
+    read_string(path, sizeof(path));
+
+    int fd = STDOUT_FILENO;
+    if (path[0] != '\0') {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            printf("Error: Could not create '%s' (%s).\n", path, strerror(errno));
+            return;
+        }
+    }
+
+    double start = now_seconds();
+    unsigned int *rows = store_sorted_order(order);
+    double sort_time = now_seconds() - start;
+    if (rows == NULL) {
+        printf("Error: Out of memory.\n");
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        return;
+    }
+
+    // Stream the table through the display formatter
+    table_output.fd = fd;
+    table_output.failed = 0;
+    print_table_header();
+    for (size_t i = 0; i < live; i++) {
+        print_student_row(rows[i]);
+    }
+    print_table_footer();
+    table_output.fd = STDOUT_FILENO;
+    int failed = table_output.failed;
+    free(rows);
+
+    if (fd != STDOUT_FILENO && close(fd) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        printf("Error: Could not write the export (%s).\n", strerror(errno));
+        return;
+    }
+    printf("Exported %zu student(s) (sorted in %.2f ms, %.2f ms in total).\n",
+           live, sort_time * 1000.0, (now_seconds() - start) * 1000.0);
+}
+
+/**
+ * @brief Converts a numerical score to a letter grade.
+ *
+ * @param score The numerical score.
+ * @return The corresponding letter grade (A, B, C, D, or F).
+ */
+char get_letter_grade(double score) {
+    if (score >= 90.0) {
+        return 'A';
+    } else if (score >= 80.0) {
+        return 'B';
+    } else if (score >= 70.0) {
+        return 'C';
+    } else if (score >= 60.0) {
+        return 'D';
+    } else {
+        return 'F';
+    }
+}
+
+/**
+ * @brief Safely reads a line of string input from the user.
+ *
+ * This function reads a string from stdin and removes the trailing newline
+ * character, making it safer than using scanf("%s", ...).
+ * @param str The buffer to store the string in.
+ * @param max_len The maximum number of characters to read.
+ */
+void read_string(char *str, int max_len) {
+    fgets(str, max_len, stdin);
+    // Remove the trailing newline character, if it exists
+    size_t len = strlen(str);
+    if (len > 0 && str[len - 1] == '\n') {
+        str[len - 1] = '\0';
+    }
+}
+
+/**
+ * @brief Clears the standard input buffer.
+ */
+void clear_input_buffer() {
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+}